@@ -9,7 +9,6 @@
 #include <unordered_map>
 
 #include "common/params_keys.h"
-#include "common/queue.h"
 #include "common/swaglog.h"
 #include "common/util.h"
 #include "system/hardware/hw.h"
@@ -100,7 +99,7 @@ Params::~Params() {
   if (future.valid()) {
     future.wait();
   }
-  assert(queue.empty());
+  assert(!queue || queue->empty());
 }
 
 std::vector<std::string> Params::allKeys() const {
@@ -225,7 +224,20 @@ void Params::clearAll(ParamKeyFlag key_flag) {
 }
 
 void Params::putNonBlocking(const std::string &key, const std::string &val) {
-   queue.push(std::make_pair(key, val));
+  std::lock_guard lk(nonblocking_lock);
+  if (!queue) {
+    queue = std::make_unique<SPSCQueue<std::pair<std::string, std::string>>>(256);
+  }
+  auto item = std::make_pair(key, val);
+  if (!queue->try_push(std::move(item))) {
+    // queue is full, make sure the writer is draining it before blocking
+    startAsyncWriter();
+    queue->push(std::move(item));
+  }
+  startAsyncWriter();
+}
+
+void Params::startAsyncWriter() {
   // start thread on demand
   if (!future.valid() || future.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready) {
     future = std::async(std::launch::async, &Params::asyncWriteThread, this);
@@ -235,7 +247,7 @@ void Params::putNonBlocking(const std::string &key, const std::string &val) {
 void Params::asyncWriteThread() {
   // TODO: write the latest one if a key has multiple values in the queue.
   std::pair<std::string, std::string> p;
-  while (queue.try_pop(p, 0)) {
+  while (queue->try_pop(p, 0)) {
     // Params::put is Thread-Safe
     put(p.first, p.second);
   }
@@ -2,13 +2,15 @@
 
 #include <future>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <tuple>
 #include <utility>
 #include <vector>
 
-#include "common/queue.h"
+#include "common/spsc_queue.h"
 
 enum ParamKeyFlag {
   PERSISTENT = 0x02,
@@ -80,11 +82,14 @@ public:
 
 private:
   void asyncWriteThread();
+  void startAsyncWriter();
 
   std::string params_path;
   std::string params_prefix;
 
-  // for nonblocking write
+  // for nonblocking write. callers are serialized by nonblocking_lock to keep a single producer.
+  // the queue is created by the first write, most Params objects never make one.
+  std::mutex nonblocking_lock;
   std::future<void> future;
-  SafeQueue<std::pair<std::string, std::string>> queue;
+  std::unique_ptr<SPSCQueue<std::pair<std::string, std::string>>> queue;
 };
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <ctime>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+// Blocks on a 32-bit atomic until its value is no longer `expected`.
+// Backed by futex(2) on Linux, so neither side takes a lock.
+namespace futex {
+
+#ifdef __linux__
+
+// Returns false on timeout. May return spuriously, callers must re-check their condition.
+inline bool wait(std::atomic<uint32_t> &word, uint32_t expected, int timeout_ms = -1) {
+  struct timespec ts = {.tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000L};
+  int ret = syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT_PRIVATE, expected,
+                    timeout_ms < 0 ? nullptr : &ts, nullptr, 0);
+  return !(ret == -1 && errno == ETIMEDOUT);
+}
+
+inline void wake(std::atomic<uint32_t> &word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+#else
+
+inline std::mutex &fallback_lock() { static std::mutex m; return m; }
+inline std::condition_variable &fallback_cv() { static std::condition_variable cv; return cv; }
+
+inline bool wait(std::atomic<uint32_t> &word, uint32_t expected, int timeout_ms = -1) {
+  std::unique_lock lk(fallback_lock());
+  auto changed = [&]() { return word.load() != expected; };
+  if (timeout_ms < 0) {
+    fallback_cv().wait(lk, changed);
+    return true;
+  }
+  return fallback_cv().wait_for(lk, std::chrono::milliseconds(timeout_ms), changed);
+}
+
+inline void wake(std::atomic<uint32_t> &) {
+  { std::lock_guard lk(fallback_lock()); }
+  fallback_cv().notify_all();
+}
+
+#endif
+
+}  // namespace futex
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+// push() blocks while the queue is full and pop() while it is empty. Sleeping is done
+// on a futex, and the other side only makes the wake syscall when someone is asleep.
+template <class T>
+class SPSCQueue {
+public:
+  explicit SPSCQueue(size_t capacity) {
+    while (capacity_ < capacity) capacity_ <<= 1;
+    buffer_ = std::make_unique<T[]>(capacity_);
+  }
+  SPSCQueue(const SPSCQueue &) = delete;
+  SPSCQueue &operator=(const SPSCQueue &) = delete;
+
+  // The rvalue overloads only move from `v` once it is queued, it is left as is when full.
+  bool try_push(const T &v) { return push_one(v); }
+  bool try_push(T &&v) { return push_one(std::move(v)); }
+  void push(const T &v) { push_blocking(v); }
+  void push(T &&v) { push_blocking(std::move(v)); }
+
+  bool try_pop(T &v, int timeout_ms = 0) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (!pop_one(v)) {
+      int remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+      if (remaining <= 0 || !wait(pushed_, consumer_waiting_, [this]() { return !empty(); }, remaining)) {
+        return pop_one(v);
+      }
+    }
+    return true;
+  }
+
+  T pop() {
+    T v;
+    while (!pop_one(v)) {
+      wait(pushed_, consumer_waiting_, [this]() { return !empty(); }, -1);
+    }
+    return v;
+  }
+
+  bool empty() const { return size() == 0; }
+  size_t size() const { return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire); }
+  size_t capacity() const { return capacity_; }
+
+private:
+  template <class U>
+  bool push_one(U &&v) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_cache_ == capacity_) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      if (tail - head_cache_ == capacity_) return false;
+    }
+    buffer_[tail & (capacity_ - 1)] = std::forward<U>(v);
+    tail_.store(tail + 1, std::memory_order_seq_cst);
+    signal(pushed_, consumer_waiting_);
+    return true;
+  }
+
+  template <class U>
+  void push_blocking(U &&v) {
+    while (!push_one(std::forward<U>(v))) {
+      wait(popped_, producer_waiting_, [this]() { return size() < capacity_; }, -1);
+    }
+  }
+
+  bool pop_one(T &v) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_cache_) {
+      tail_cache_ = tail_.load(std::memory_order_acquire);
+      if (head == tail_cache_) return false;
+    }
+    v = std::move(buffer_[head & (capacity_ - 1)]);
+    head_.store(head + 1, std::memory_order_seq_cst);
+    signal(popped_, producer_waiting_);
+    return true;
+  }
+
+  static void signal(std::atomic<uint32_t> &seq, std::atomic<bool> &waiting) {
+    seq.fetch_add(1, std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_seq_cst)) {
+      futex::wake(seq);
+    }
+  }
+
+  template <class Ready>
+  static bool wait(std::atomic<uint32_t> &seq, std::atomic<bool> &waiting, Ready ready, int timeout_ms) {
+    const uint32_t current = seq.load(std::memory_order_seq_cst);
+    waiting.store(true, std::memory_order_seq_cst);
+    // Re-check after announcing ourselves, the other side may have moved before it saw the flag
+    bool ret = ready() || futex::wait(seq, current, timeout_ms);
+    waiting.store(false, std::memory_order_relaxed);
+    return ret;
+  }
+
+  size_t capacity_ = 1;
+  std::unique_ptr<T[]> buffer_;
+
+  // Consumer side
+  alignas(64) std::atomic<size_t> head_ = 0;
+  size_t tail_cache_ = 0;
+  std::atomic<uint32_t> popped_ = 0;
+  std::atomic<bool> producer_waiting_ = false;
+
+  // Producer side
+  alignas(64) std::atomic<size_t> tail_ = 0;
+  size_t head_cache_ = 0;
+  std::atomic<uint32_t> pushed_ = 0;
+  std::atomic<bool> consumer_waiting_ = false;
+};
@@ -0,0 +1,58 @@
+#include <memory>
+#include <thread>
+
+#include "catch2/catch.hpp"
+#include "common/spsc_queue.h"
+
+TEST_CASE("SPSCQueue") {
+  SPSCQueue<int> queue(5);
+  REQUIRE(queue.capacity() == 8);
+  REQUIRE(queue.empty());
+
+  SECTION("try_push fails when full") {
+    for (size_t i = 0; i < queue.capacity(); ++i) {
+      REQUIRE(queue.try_push(i));
+    }
+    REQUIRE_FALSE(queue.try_push(-1));
+    int v = -1;
+    REQUIRE(queue.try_pop(v));
+    REQUIRE(v == 0);
+    REQUIRE(queue.try_push(8));
+  }
+
+  SECTION("try_pop times out when empty") {
+    int v = 0;
+    REQUIRE_FALSE(queue.try_pop(v, 10));
+  }
+
+  SECTION("blocking producer and consumer keep order") {
+    const int count = 100000;
+    bool in_order = true;
+    std::thread consumer([&]() {
+      for (int i = 0; i < count; ++i) {
+        in_order &= (queue.pop() == i);
+      }
+    });
+    for (int i = 0; i < count; ++i) {
+      queue.push(i);
+    }
+    consumer.join();
+    REQUIRE(in_order);
+    REQUIRE(queue.empty());
+  }
+}
+
+TEST_CASE("SPSCQueue moves rvalues") {
+  SPSCQueue<std::unique_ptr<int>> queue(1);
+  auto v = std::make_unique<int>(1);
+  REQUIRE(queue.try_push(std::move(v)));
+  REQUIRE(v == nullptr);
+
+  // A failed push leaves the value with the caller
+  v = std::make_unique<int>(2);
+  REQUIRE_FALSE(queue.try_push(std::move(v)));
+  REQUIRE(*v == 2);
+  REQUIRE(*queue.pop() == 1);
+  queue.push(std::move(v));
+  REQUIRE(*queue.pop() == 2);
+}
@@ -353,19 +353,19 @@ const std::vector<std::array<uint32_t, 8>> &BinaryViewModel::getBitFlipChanges(s
   auto [first, last] = can->eventsInRange(msg_id, time_range);
   if (std::distance(first, last) <= 1) return bit_flip_tracker.flip_counts;
 
-  std::vector<uint8_t> prev_values((*first)->dat, (*first)->dat + (*first)->size);
+  std::vector<uint8_t> prev_values(first->dat, first->dat + first->size);
   for (auto it = std::next(first); it != last; ++it) {
-    const CanEvent *event = *it;
-    int size = std::min<int>(msg_size, event->size);
+    const CanEvent event = *it;
+    int size = std::min<int>(msg_size, event.size);
     for (int i = 0; i < size; ++i) {
-      const uint8_t diff = event->dat[i] ^ prev_values[i];
+      const uint8_t diff = event.dat[i] ^ prev_values[i];
       if (!diff) continue;
 
       auto &bit_flips = bit_flip_tracker.flip_counts[i];
       for (int bit = 0; bit < 8; ++bit) {
         if (diff & (1u << bit)) ++bit_flips[7 - bit];
       }
-      prev_values[i] = event->dat[i];
+      prev_values[i] = event.dat[i];
     }
   }
 
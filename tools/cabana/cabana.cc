@@ -36,7 +36,7 @@ int main(int argc, char *argv[]) {
   cmd_parser.addOption({"zmq", "read can messages from zmq at the specified ip-address", "ip-address"});
   cmd_parser.addOption({"data_dir", "local directory with routes", "data_dir"});
   cmd_parser.addOption({"no-vipc", "do not output video"});
-  cmd_parser.addOption({"dbc", "dbc file to open", "dbc"});
+  cmd_parser.addOption({"dbc", "dbc file to open, or bus:file pairs separated by commas", "dbc"});
   cmd_parser.process(app);
 
   AbstractStream *stream = nullptr;
@@ -26,6 +26,7 @@ const double MIN_ZOOM_SECONDS = 0.01; // 10ms
 // Define a small value of epsilon to compare double values
 const float EPSILON = 0.000001;
 static inline bool xLessThan(const QPointF &p, float x) { return p.x() < (x - EPSILON); }
+static inline bool xBefore(const QPointF &p, double x) { return p.x() < x; }
 
 ChartView::ChartView(const std::pair<double, double> &x_range, ChartsWidget *parent)
     : charts_widget(parent), QChartView(parent) {
@@ -218,6 +219,9 @@ void ChartView::updatePlotArea(int left_pos, bool force) {
     x_label_size += QSizeF{5, 5};
     chart()->setPlotArea(rect().adjusted(align_to + left, adjust_top + top, -x_label_size.width() / 2 - right, -x_label_size.height() - bottom));
     chart()->layout()->invalidate();
+    for (auto &s : sigs) {
+      updateSeriesData(s);
+    }
     resetChartCache();
   }
 }
@@ -249,6 +253,9 @@ void ChartView::updatePlot(double cur, double min, double max) {
   if (min != axis_x->min() || max != axis_x->max()) {
     axis_x->setRange(min, max);
     updateAxisY();
+    for (auto &s : sigs) {
+      updateSeriesData(s);
+    }
     updateSeriesPoints();
     // update tooltip
     if (tooltip_x >= 0) {
@@ -282,19 +289,34 @@ void ChartView::updateSeriesPoints() {
   }
 }
 
-void ChartView::appendCanEvents(const cabana::Signal *sig, const std::vector<const CanEvent *> &events,
+void ChartView::updateSeriesData(SigItem &s) {
+  // Give the series the visible range only, with at most two points per horizontal pixel
+  const auto &pts = series_type == SeriesType::StepLine ? s.step_vals : s.vals;
+  const int max_points = std::max<int>(chart()->plotArea().width(), 100) * 2;
+  std::vector<QPointF> points;
+  s.pyramid.sample(pts, axis_x->min(), axis_x->max(), max_points, points);
+  s.series->replace(QVector<QPointF>::fromStdVector(points));
+}
+
+void ChartView::appendCanEvents(const cabana::Signal *sig, const MessageEvents &events,
                                 std::vector<QPointF> &vals, std::vector<QPointF> &step_vals) {
-  vals.reserve(vals.size() + events.capacity());
-  step_vals.reserve(step_vals.size() + events.capacity() * 2);
-
-  double value = 0;
-  for (const CanEvent *e : events) {
-    if (sig->getValue(e->dat, e->size, &value)) {
-      const double ts = can->toSeconds(e->mono_time);
-      vals.emplace_back(ts, value);
+  // Only size up front when empty: exact reserves on every live append would reallocate each time
+  if (vals.empty()) {
+    vals.reserve(events.size());
+    step_vals.reserve(events.size() * 2);
+  }
+
+  std::vector<double> values;
+  std::vector<uint8_t> valid;
+  events.decode(cabana::SignalDecoder(*sig), 0, events.size(), values, valid);
+  const auto &mono_times = events.monoTimes();
+  for (size_t i = 0; i < values.size(); ++i) {
+    if (valid[i]) {
+      const double ts = can->toSeconds(mono_times[i]);
+      vals.emplace_back(ts, values[i]);
       if (!step_vals.empty())
         step_vals.emplace_back(ts, step_vals.back().y());
-      step_vals.emplace_back(ts, value);
+      step_vals.emplace_back(ts, values[i]);
     }
   }
 }
@@ -306,12 +328,26 @@ void ChartView::updateSeries(const cabana::Signal *sig, const MessageEventsMap *
         s.vals.clear();
         s.step_vals.clear();
       }
+      // Drop the points of events no longer cached by a live stream
+      if (const double min_sec = can->minSeconds(); can->liveStreaming() && !s.vals.empty() && s.vals.front().x() < min_sec) {
+        s.vals.erase(s.vals.begin(), std::lower_bound(s.vals.begin(), s.vals.end(), min_sec, xBefore));
+        s.step_vals.erase(s.step_vals.begin(), std::lower_bound(s.step_vals.begin(), s.step_vals.end(), min_sec, xBefore));
+        s.pyramid.build(series_type == SeriesType::StepLine ? s.step_vals : s.vals);
+      }
       auto events = msg_new_events ? msg_new_events : &can->eventsMap();
       auto it = events->find(s.msg_id);
       if (it == events->end() || it->second.empty()) continue;
 
-      if (s.vals.empty() || can->toSeconds(it->second.back()->mono_time) > s.vals.back().x()) {
+      auto &pts = series_type == SeriesType::StepLine ? s.step_vals : s.vals;
+      const size_t prev_size = pts.size();
+      if (s.vals.empty() || can->toSeconds(it->second.front().mono_time) >= s.vals.back().x()) {
+        // Appended at the end, the common case when live streaming. Only the tail needs updating,
+        // and the series only if the new points are in view.
         appendCanEvents(s.sig, it->second, s.vals, s.step_vals);
+        s.pyramid.update(pts, prev_size > 0 ? prev_size - 1 : 0);
+        if (!msg_new_events || (pts.size() > prev_size && pts[prev_size].x() <= axis_x->max())) {
+          updateSeriesData(s);
+        }
       } else {
         std::vector<QPointF> vals, step_vals;
         appendCanEvents(s.sig, it->second, vals, step_vals);
@@ -319,12 +355,9 @@ void ChartView::updateSeries(const cabana::Signal *sig, const MessageEventsMap *
                       vals.begin(), vals.end());
         s.step_vals.insert(std::lower_bound(s.step_vals.begin(), s.step_vals.end(), step_vals.front().x(), xLessThan),
                            step_vals.begin(), step_vals.end());
+        s.pyramid.build(pts);
+        updateSeriesData(s);
       }
-
-      if (!can->liveStreaming()) {
-        s.segment_tree.build(s.vals);
-      }
-      s.series->replace(QVector<QPointF>::fromStdVector(series_type == SeriesType::StepLine ? s.step_vals : s.vals));
     }
   }
   updateAxisY();
@@ -348,18 +381,10 @@ void ChartView::updateAxisY() {
       unit.clear();
     }
 
-    auto first = std::lower_bound(s.vals.cbegin(), s.vals.cend(), axis_x->min(), xLessThan);
-    auto last = std::lower_bound(first, s.vals.cend(), axis_x->max(), xLessThan);
-    s.min = std::numeric_limits<double>::max();
-    s.max = std::numeric_limits<double>::lowest();
-    if (can->liveStreaming()) {
-      for (auto it = first; it != last; ++it) {
-        if (it->y() < s.min) s.min = it->y();
-        if (it->y() > s.max) s.max = it->y();
-      }
-    } else {
-      std::tie(s.min, s.max) = s.segment_tree.minmax(std::distance(s.vals.cbegin(), first), std::distance(s.vals.cbegin(), last));
-    }
+    const auto &pts = series_type == SeriesType::StepLine ? s.step_vals : s.vals;
+    auto first = std::lower_bound(pts.cbegin(), pts.cend(), axis_x->min(), xLessThan);
+    auto last = std::lower_bound(first, pts.cend(), axis_x->max(), xLessThan);
+    std::tie(s.min, s.max) = s.pyramid.minmax(pts, first - pts.cbegin(), last - pts.cbegin());
     min = std::min(min, s.min);
     max = std::max(max, s.max);
   }
@@ -838,7 +863,8 @@ void ChartView::setSeriesType(SeriesType type) {
     }
     for (auto &s : sigs) {
       s.series = createSeries(series_type, s.sig->color);
-      s.series->replace(QVector<QPointF>::fromStdVector(series_type == SeriesType::StepLine ? s.step_vals : s.vals));
+      s.pyramid.build(series_type == SeriesType::StepLine ? s.step_vals : s.vals);
+      updateSeriesData(s);
     }
     updateSeriesPoints();
     updateTitle();
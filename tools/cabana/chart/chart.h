@@ -48,7 +48,7 @@ public:
     std::vector<QPointF> vals;
     std::vector<QPointF> step_vals;
     QPointF track_pt{};
-    SegmentTree segment_tree;
+    MinMaxPyramid pyramid;  // of the points shown by the series
     double min = 0;
     double max = 0;
   };
@@ -65,7 +65,7 @@ private slots:
   void signalRemoved(const cabana::Signal *sig) { removeIf([=](auto &s) { return s.sig == sig; }); }
 
 private:
-  void appendCanEvents(const cabana::Signal *sig, const std::vector<const CanEvent *> &events,
+  void appendCanEvents(const cabana::Signal *sig, const MessageEvents &events,
                        std::vector<QPointF> &vals, std::vector<QPointF> &step_vals);
   void createToolButtons();
   void addSeries(QXYSeries *series);
@@ -95,6 +95,7 @@ private:
   QXYSeries *createSeries(SeriesType type, QColor color);
   void setSeriesColor(QXYSeries *, QColor color);
   void updateSeriesPoints();
+  void updateSeriesData(SigItem &s);
   void removeIf(std::function<bool(const SigItem &)> predicate);
   inline void clearTrackPoints() { for (auto &s : sigs) s.track_pt = {}; }
 
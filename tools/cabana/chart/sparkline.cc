@@ -4,7 +4,7 @@
 #include <limits>
 #include <QPainter>
 
-void Sparkline::update(const cabana::Signal *sig, CanEventIter first, CanEventIter last, int range, QSize size) {
+void Sparkline::update(const cabana::Signal *sig, const MessageEvents &events, CanEventIter first, CanEventIter last, int range, QSize size) {
   if (first == last || size.isEmpty()) {
     pixmap = QPixmap();
     return;
@@ -15,13 +15,16 @@ void Sparkline::update(const cabana::Signal *sig, CanEventIter first, CanEventIt
   max_val = std::numeric_limits<double>::lowest();
   points_.reserve(std::distance(first, last));
 
-  uint64_t start_time = (*first)->mono_time;
-  double value = 0.0;
-  for (auto it = first; it != last; ++it) {
-    if (sig->getValue((*it)->dat, (*it)->size, &value)) {
-      min_val = std::min(min_val, value);
-      max_val = std::max(max_val, value);
-      points_.emplace_back(((*it)->mono_time - start_time) / 1e9, value);
+  std::vector<double> values;
+  std::vector<uint8_t> valid;
+  events.decode(cabana::SignalDecoder(*sig), first.index(), last.index(), values, valid);
+  const uint64_t *mono_times = events.monoTimes().data() + first.index();
+  const uint64_t start_time = mono_times[0];
+  for (size_t i = 0; i < values.size(); ++i) {
+    if (valid[i]) {
+      min_val = std::min(min_val, values[i]);
+      max_val = std::max(max_val, values[i]);
+      points_.emplace_back((mono_times[i] - start_time) / 1e9, values[i]);
     }
   }
 
@@ -1,6 +1,7 @@
 #include "tools/cabana/dbc/dbc.h"
 
 #include <algorithm>
+#include <cstring>
 
 #include "tools/cabana/utils/util.h"
 
@@ -177,6 +178,114 @@ bool cabana::Signal::operator==(const cabana::Signal &other) const {
          multiplex_value == other.multiplex_value && type == other.type && receiver_name == other.receiver_name;
 }
 
+// cabana::SignalDecoder
+
+template <bool big_endian, bool is_signed>
+void cabana::SignalDecoder::Field::decodeKernel(const Field &f, const uint8_t *window, size_t stride, size_t count, double *values) {
+  const int shift = f.shift, sign_shift = f.sign_shift;
+  const uint64_t mask = f.mask;
+  const double factor = f.factor, offset = f.offset;
+  for (size_t i = 0; i < count; ++i, window += stride) {
+    uint64_t word;
+    memcpy(&word, window, sizeof(word));
+    if constexpr (big_endian) word = __builtin_bswap64(word);
+    uint64_t val = (word >> shift) & mask;
+    if constexpr (is_signed) val = static_cast<int64_t>(val << sign_shift) >> sign_shift;
+    values[i] = static_cast<int64_t>(val) * factor + offset;
+  }
+}
+
+void cabana::SignalDecoder::Field::compile(const cabana::Signal &sig) {
+  const int msb_byte = sig.msb / 8, lsb_byte = sig.lsb / 8;
+  const bool big_endian = !sig.is_little_endian;
+  factor = sig.factor;
+  offset = sig.offset;
+  mask = sig.size >= 64 ? ~0ULL : (1ULL << sig.size) - 1;
+  sign_shift = 64 - std::clamp(sig.size, 1, 64);
+  min_size = std::max(msb_byte, lsb_byte) + 1;
+  if (big_endian) {
+    // Bytes msb_byte..lsb_byte, read as a big endian word starting at msb_byte
+    load_byte = msb_byte;
+    shift = (7 - (lsb_byte - msb_byte)) * 8 + (sig.lsb & 7);
+  } else {
+    load_byte = lsb_byte;
+    shift = sig.lsb & 7;
+  }
+  fits = sig.size > 0 && load_byte >= 0 && shift >= 0 && shift + sig.size <= 64;
+
+  static constexpr decltype(kernel) kernels[2][2] = {
+      {decodeKernel<false, false>, decodeKernel<false, true>},
+      {decodeKernel<true, false>, decodeKernel<true, true>},
+  };
+  kernel = kernels[big_endian][sig.is_signed];
+}
+
+double cabana::SignalDecoder::Field::value(const uint8_t *data, size_t data_size, const cabana::Signal &sig) const {
+  if (!fits || data_size < min_size) {
+    return get_raw_value(data, data_size, sig);
+  }
+  // Zero pad the window where it runs past the end of the frame
+  uint8_t window[8] = {};
+  memcpy(window, data + load_byte, std::min<size_t>(sizeof(window), data_size - load_byte));
+  double val;
+  kernel(*this, window, 0, 1, &val);
+  return val;
+}
+
+cabana::SignalDecoder::SignalDecoder(const cabana::Signal &sig) : sig_(&sig) {
+  field_.compile(sig);
+  if (sig.multiplexor) {
+    mux_.compile(*sig.multiplexor);
+  }
+}
+
+bool cabana::SignalDecoder::getValue(const uint8_t *data, size_t data_size, double *val) const {
+  if (sig_->multiplexor && mux_.value(data, data_size, *sig_->multiplexor) != sig_->multiplex_value) {
+    return false;
+  }
+  *val = field_.value(data, data_size, *sig_);
+  return true;
+}
+
+void cabana::SignalDecoder::decode(const uint8_t *data, size_t stride, const uint8_t *sizes, size_t count,
+                                   double *values, uint8_t *valid) const {
+  // Number of leading frames whose 64-bit window lies inside the buffer. A window may run
+  // into the next frame, those bits are masked off.
+  auto direct_count = [&](const Field &f) -> size_t {
+    const size_t end = f.load_byte + 8, total = count * stride;
+    if (!f.fits || stride == 0 || total < end) return 0;
+    return std::min(count, (total - end) / stride + 1);
+  };
+  const bool multiplexed = sig_->multiplexor != nullptr;
+  size_t n = direct_count(field_);
+  size_t min_size = field_.min_size;
+  if (multiplexed) {
+    n = std::min(n, direct_count(mux_));
+    min_size = std::max(min_size, mux_.min_size);
+  }
+
+  field_.kernel(field_, data + field_.load_byte, stride, n, values);
+  if (multiplexed) {
+    std::vector<double> mux_values(n);
+    mux_.kernel(mux_, data + mux_.load_byte, stride, n, mux_values.data());
+    for (size_t i = 0; i < n; ++i) {
+      valid[i] = mux_values[i] == sig_->multiplex_value;
+    }
+  } else {
+    memset(valid, 1, n);
+  }
+
+  // Frames too short for the direct path, and the tail of the buffer
+  for (size_t i = 0; i < n; ++i) {
+    if (sizes[i] < min_size) {
+      valid[i] = getValue(data + i * stride, sizes[i], &values[i]);
+    }
+  }
+  for (size_t i = n; i < count; ++i) {
+    valid[i] = getValue(data + i * stride, sizes[i], &values[i]);
+  }
+}
+
 // helper functions
 
 double get_raw_value(const uint8_t *data, size_t data_size, const cabana::Signal &sig) {
@@ -85,6 +85,39 @@ public:
   Signal *multiplexor = nullptr;
 };
 
+// A Signal compiled into a fixed 64-bit load, shift and mask, for decoding many frames at once.
+// It keeps a pointer to the signal, which must outlive it.
+class SignalDecoder {
+public:
+  SignalDecoder() = default;
+  explicit SignalDecoder(const Signal &sig);
+  // Same result as Signal::getValue
+  bool getValue(const uint8_t *data, size_t data_size, double *val) const;
+  // Decodes `count` frames stored `stride` bytes apart. valid[i] is 0 where a multiplexed signal is absent.
+  void decode(const uint8_t *data, size_t stride, const uint8_t *sizes, size_t count, double *values, uint8_t *valid) const;
+
+private:
+  struct Field {
+    void compile(const Signal &sig);
+    double value(const uint8_t *data, size_t data_size, const Signal &sig) const;
+    template <bool big_endian, bool is_signed>
+    static void decodeKernel(const Field &f, const uint8_t *window, size_t stride, size_t count, double *values);
+
+    int load_byte = 0;  // first byte of the 64-bit window holding the signal
+    int shift = 0;
+    uint64_t mask = 0;
+    int sign_shift = 0;
+    bool fits = false;  // the signal lies within one 64-bit window
+    size_t min_size = 0;  // shorter frames are decoded bit by bit
+    double factor = 1.0, offset = 0;
+    // Specialized for byte order and signedness. `window` points at load_byte of the first frame.
+    void (*kernel)(const Field &f, const uint8_t *window, size_t stride, size_t count, double *values) = nullptr;
+  };
+
+  const Signal *sig_ = nullptr;
+  Field field_, mux_;
+};
+
 class Msg {
 public:
   Msg() = default;
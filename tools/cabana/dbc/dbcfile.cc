@@ -1,22 +1,27 @@
 #include "tools/cabana/dbc/dbcfile.h"
 
+#include <algorithm>
+#include <limits>
+#include <optional>
+
 #include <QFile>
 #include <QFileInfo>
-#include <QRegularExpression>
 
 DBCFile::DBCFile(const QString &dbc_file_name) {
   QFile file(dbc_file_name);
   if (file.open(QIODevice::ReadOnly)) {
     name_ = QFileInfo(dbc_file_name).baseName();
     filename = dbc_file_name;
-    parse(file.readAll());
+    const QByteArray content = file.readAll();
+    parse({content.constData(), (size_t)content.size()});
   } else {
     throw std::runtime_error("Failed to open file.");
   }
 }
 
 DBCFile::DBCFile(const QString &name, const QString &content) : name_(name), filename("") {
-  parse(content);
+  const QByteArray utf8 = content.toUtf8();
+  parse({utf8.constData(), (size_t)utf8.size()});
 }
 
 bool DBCFile::save() {
@@ -61,45 +66,183 @@ cabana::Signal *DBCFile::signal(uint32_t address, const QString &name) {
   return m ? (cabana::Signal *)m->sig(name) : nullptr;
 }
 
-void DBCFile::parse(const QString &content) {
+namespace {
+
+inline bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f'; }
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+inline bool isWordChar(char c) { return isDigit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+inline bool isNumberChar(char c) { return isDigit(c) || c == '.' || c == '+' || c == '-' || c == 'e' || c == 'E'; }
+
+inline QString toQString(std::string_view s) { return QString::fromUtf8(s.data(), s.size()); }
+
+std::string_view trimmed(std::string_view s) {
+  while (!s.empty() && isSpace(s.front())) s.remove_prefix(1);
+  while (!s.empty() && isSpace(s.back())) s.remove_suffix(1);
+  return s;
+}
+
+// Same results as QString::toUInt/toInt: base 10, 0 if not a number or out of range
+uint32_t toUInt(std::string_view s) {
+  uint64_t v = 0;
+  for (char c : s) {
+    if (!isDigit(c) || (v = v * 10 + (c - '0')) > std::numeric_limits<uint32_t>::max()) return 0;
+  }
+  return v;
+}
+
+int toInt(std::string_view s) {
+  const bool negative = !s.empty() && s[0] == '-';
+  if (!s.empty() && (s[0] == '-' || s[0] == '+')) s.remove_prefix(1);
+  int64_t v = 0;
+  for (char c : s) {
+    if (!isDigit(c) || (v = v * 10 + (c - '0')) > std::numeric_limits<int>::max() + (int64_t)negative) return 0;
+  }
+  return negative ? -v : v;
+}
+
+// Same result as QString::toDouble. Numbers of up to 15 significant digits with a decimal exponent
+// within +-22, which covers nearly every number in a DBC, are exact as a single multiplication or
+// division of two exact doubles. Anything else takes Qt's conversion.
+double toDouble(std::string_view s) {
+  static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  auto slow = [s]() { return QByteArray(s.data(), s.size()).toDouble(); };
+
+  size_t i = 0;
+  const bool negative = !s.empty() && s[0] == '-';
+  if (!s.empty() && (s[0] == '-' || s[0] == '+')) ++i;
+  uint64_t mantissa = 0;
+  int digits = 0, exp10 = 0;
+  bool has_digits = false, has_dot = false;
+  for (; i < s.size(); ++i) {
+    if (isDigit(s[i])) {
+      has_digits = true;
+      if (mantissa != 0 || s[i] != '0') {
+        if (++digits > 15) return slow();
+        mantissa = mantissa * 10 + (s[i] - '0');
+      }
+      exp10 -= has_dot;
+    } else if (s[i] == '.' && !has_dot) {
+      has_dot = true;
+    } else {
+      break;
+    }
+  }
+  if (!has_digits) return slow();
+  if (i < s.size() && (s[i] == 'e' || s[i] == 'E')) {
+    const size_t exp_start = ++i;
+    if (i < s.size() && (s[i] == '-' || s[i] == '+')) ++i;
+    if (i == s.size() || s.size() - i > 3) return slow();
+    exp10 += toInt(s.substr(exp_start));
+    for (; i < s.size() && isDigit(s[i]); ++i) {}
+  }
+  if (i != s.size() || exp10 < -22 || exp10 > 22) return slow();
+
+  const double v = exp10 >= 0 ? mantissa * pow10[exp10] : mantissa / pow10[-exp10];
+  return negative ? -v : v;
+}
+
+// Reads tokens from the raw UTF-8 content. Tokens are views into the content, nothing is copied
+// until a value is stored into a Msg or Signal.
+class Tokenizer {
+public:
+  explicit Tokenizer(std::string_view s) : s_(s) {}
+  size_t pos() const { return pos_; }
+  std::string_view rest() const { return s_.substr(pos_); }
+  bool atEnd() const { return pos_ >= s_.size(); }
+  char peek() const { return atEnd() ? '\0' : s_[pos_]; }
+
+  bool consume(char c) { return !atEnd() && s_[pos_] == c && ++pos_; }
+  bool consume(std::string_view token) {
+    if (s_.substr(pos_, token.size()) != token) return false;
+    pos_ += token.size();
+    return true;
+  }
+  // Skips all occurrences of c, returns how many
+  size_t skip(char c) {
+    const size_t start = pos_;
+    while (!atEnd() && s_[pos_] == c) ++pos_;
+    return pos_ - start;
+  }
+  void skipSpaces() {
+    while (!atEnd() && isSpace(s_[pos_])) ++pos_;
+  }
+  // The longest run of characters satisfying pred, empty if there is none
+  template <class Pred>
+  std::string_view take(Pred pred) {
+    const size_t start = pos_;
+    while (!atEnd() && pred(s_[pos_])) ++pos_;
+    return s_.substr(start, pos_ - start);
+  }
+  std::string_view word() { return take(isWordChar); }
+  std::string_view digits() { return take(isDigit); }
+  std::string_view number() { return take(isNumberChar); }
+  // The body of a "quoted" string with \-escapes, which may span lines. Empty optional if unterminated.
+  std::optional<std::string_view> quoted() {
+    if (!consume('"')) return std::nullopt;
+    const size_t start = pos_;
+    while (!atEnd() && s_[pos_] != '"') {
+      pos_ += (s_[pos_] == '\\' && pos_ + 1 < s_.size()) ? 2 : 1;
+    }
+    if (atEnd()) return std::nullopt;
+    return s_.substr(start, pos_++ - start);
+  }
+
+private:
+  std::string_view s_;
+  size_t pos_ = 0;
+};
+
+inline bool startsWith(std::string_view s, std::string_view prefix) { return s.substr(0, prefix.size()) == prefix; }
+
+}  // namespace
+
+void DBCFile::parse(std::string_view content) {
   msgs.clear();
+  if (startsWith(content, "\xEF\xBB\xBF")) content.remove_prefix(3);
 
   int line_num = 0;
-  QString line;
   cabana::Msg *current_msg = nullptr;
   int multiplexor_cnt = 0;
   bool seen_first = false;
-  QTextStream stream((QString *)&content);
+  size_t pos = 0;
 
-  while (!stream.atEnd()) {
+  while (pos < content.size()) {
     ++line_num;
-    QString raw_line = stream.readLine();
-    line = raw_line.trimmed();
+    size_t end = std::min(content.find('\n', pos), content.size());
+    std::string_view raw_line = content.substr(pos, end - pos);
+    if (!raw_line.empty() && raw_line.back() == '\r') raw_line.remove_suffix(1);
+    std::string_view line = trimmed(raw_line);
+    pos = end + 1;
 
     bool seen = true;
     try {
-      if (line.startsWith("BO_ ")) {
+      if (startsWith(line, "BO_ ")) {
         multiplexor_cnt = 0;
         current_msg = parseBO(line);
-      } else if (line.startsWith("SG_ ")) {
+      } else if (startsWith(line, "SG_ ")) {
         parseSG(line, current_msg, multiplexor_cnt);
-      } else if (line.startsWith("VAL_ ")) {
+      } else if (startsWith(line, "VAL_ ")) {
         parseVAL(line);
-      } else if (line.startsWith("CM_ BO_")) {
-        parseCM_BO(line, content, raw_line, stream);
-      } else if (line.startsWith("CM_ SG_ ")) {
-        parseCM_SG(line, content, raw_line, stream);
+      } else if (startsWith(line, "CM_ BO_") || startsWith(line, "CM_ SG_ ")) {
+        // Comments may continue on the following lines, resume after the one the comment ends on
+        const size_t start = line.data() - content.data();
+        const size_t comment_end = start + parseCM(content.substr(start));
+        if (comment_end > pos) {
+          line_num += std::count(content.begin() + pos, content.begin() + comment_end, '\n') + 1;
+          pos = std::min(content.find('\n', comment_end), content.size()) + 1;
+        }
       } else {
         seen = false;
       }
     } catch (std::exception &e) {
-      throw std::runtime_error(QString("[%1:%2]%3: %4").arg(filename).arg(line_num).arg(e.what()).arg(line).toStdString());
+      throw std::runtime_error(QString("[%1:%2]%3: %4").arg(filename).arg(line_num).arg(e.what()).arg(toQString(line)).toStdString());
     }
 
     if (seen) {
       seen_first = true;
     } else if (!seen_first) {
-      header += raw_line + "\n";
+      header += toQString(raw_line) + "\n";
     }
   }
 
@@ -108,65 +251,75 @@ void DBCFile::parse(const QString &content) {
   }
 }
 
-cabana::Msg *DBCFile::parseBO(const QString &line) {
-  static QRegularExpression bo_regexp(R"(^BO_ (?<address>\w+) (?<name>\w+) *: (?<size>\w+) (?<transmitter>\w+))");
-
-  QRegularExpressionMatch match = bo_regexp.match(line);
-  if (!match.hasMatch())
+// BO_ <address> <name>: <size> <transmitter>
+cabana::Msg *DBCFile::parseBO(std::string_view line) {
+  Tokenizer t(line);
+  t.consume("BO_ ");
+  auto address_str = t.word();
+  bool ok = !address_str.empty() && t.consume(' ');
+  auto name = t.word();
+  ok = ok && !name.empty() && (t.skip(' '), t.consume(':')) && t.consume(' ');
+  auto size = t.word();
+  ok = ok && !size.empty() && t.consume(' ');
+  auto transmitter = t.word();
+  if (!ok || transmitter.empty())
     throw std::runtime_error("Invalid BO_ line format");
 
-  uint32_t address = match.captured("address").toUInt();
+  uint32_t address = toUInt(address_str);
   if (msgs.count(address) > 0)
     throw std::runtime_error(QString("Duplicate message address: %1").arg(address).toStdString());
 
   // Create a new message object
   cabana::Msg *msg = &msgs[address];
   msg->address = address;
-  msg->name = match.captured("name");
-  msg->size = match.captured("size").toULong();
-  msg->transmitter = match.captured("transmitter").trimmed();
+  msg->name = toQString(name);
+  msg->size = toUInt(size);
+  msg->transmitter = toQString(transmitter);
   return msg;
 }
 
-void DBCFile::parseCM_BO(const QString &line, const QString &content, const QString &raw_line, const QTextStream &stream) {
-  static QRegularExpression msg_comment_regexp(R"(^CM_ BO_ *(?<address>\w+) *\"(?<comment>(?:[^"\\]|\\.)*)\"\s*;)");
-
-  QString parse_line = line;
-  if (!parse_line.endsWith("\";")) {
-    int pos = stream.pos() - raw_line.length() - 1;
-    parse_line = content.mid(pos, content.indexOf("\";", pos));
-  }
-  auto match = msg_comment_regexp.match(parse_line);
-  if (!match.hasMatch())
-    throw std::runtime_error("Invalid message comment format");
-
-  if (auto m = (cabana::Msg *)msg(match.captured("address").toUInt()))
-    m->comment = match.captured("comment").trimmed().replace("\\\"", "\"");
-}
-
-void DBCFile::parseSG(const QString &line, cabana::Msg *current_msg, int &multiplexor_cnt) {
-  static QRegularExpression sg_regexp(R"(^SG_ (\w+) *: (\d+)\|(\d+)@(\d+)([\+|\-]) \(([0-9.+\-eE]+),([0-9.+\-eE]+)\) \[([0-9.+\-eE]+)\|([0-9.+\-eE]+)\] \"(.*)\" (.*))");
-  static QRegularExpression sgm_regexp(R"(^SG_ (\w+) (\w+) *: (\d+)\|(\d+)@(\d+)([\+|\-]) \(([0-9.+\-eE]+),([0-9.+\-eE]+)\) \[([0-9.+\-eE]+)\|([0-9.+\-eE]+)\] \"(.*)\" (.*))");
-
+// SG_ <name> [M|m<value>] : <start>|<size>@<endian><sign> (<factor>,<offset>) [<min>|<max>] "<unit>" <receivers>
+void DBCFile::parseSG(std::string_view line, cabana::Msg *current_msg, int &multiplexor_cnt) {
   if (!current_msg)
     throw std::runtime_error("No Message");
 
-  int offset = 0;
-  auto match = sg_regexp.match(line);
-  if (!match.hasMatch()) {
-    match = sgm_regexp.match(line);
-    offset = 1;
+  Tokenizer t(line);
+  t.consume("SG_ ");
+  auto name = t.word();
+  std::string_view indicator;
+  bool ok = !name.empty();
+  if (size_t spaces = t.skip(' '); ok && t.peek() != ':') {
+    indicator = t.word();
+    ok = spaces == 1 && !indicator.empty();
+    t.skip(' ');
   }
-  if (!match.hasMatch())
+  ok = ok && t.consume(':') && t.consume(' ');
+  auto start_bit = t.digits();
+  ok = ok && !start_bit.empty() && t.consume('|');
+  auto size = t.digits();
+  ok = ok && !size.empty() && t.consume('@');
+  auto endian = t.digits();
+  const char sign = t.peek();
+  ok = ok && !endian.empty() && (t.consume('+') || t.consume('|') || t.consume('-')) && t.consume(" (");
+  auto factor = t.number();
+  ok = ok && !factor.empty() && t.consume(',');
+  auto offset = t.number();
+  ok = ok && !offset.empty() && t.consume(") [");
+  auto min = t.number();
+  ok = ok && !min.empty() && t.consume('|');
+  auto max = t.number();
+  ok = ok && !max.empty() && t.consume("] \"");
+  // The unit runs up to the last quote followed by a space
+  const auto rest = t.rest();
+  const size_t unit_end = rest.rfind("\" ");
+  if (!ok || unit_end == std::string_view::npos)
     throw std::runtime_error("Invalid SG_ line format");
 
-  QString name = match.captured(1);
-  if (current_msg->sig(name) != nullptr)
+  if (findSignal(current_msg, name) != nullptr)
     throw std::runtime_error("Duplicate signal name");
 
   cabana::Signal s{};
-  if (offset == 1) {
-    auto indicator = match.captured(2);
+  if (!indicator.empty()) {
     if (indicator == "M") {
       ++multiplexor_cnt;
       // Only one signal within a single message can be the multiplexer switch.
@@ -176,57 +329,103 @@ void DBCFile::parseSG(const QString &line, cabana::Msg *current_msg, int &multip
       s.type = cabana::Signal::Type::Multiplexor;
     } else {
       s.type = cabana::Signal::Type::Multiplexed;
-      s.multiplex_value = indicator.mid(1).toInt();
+      s.multiplex_value = toInt(indicator.substr(1));
     }
   }
-  s.name = name;
-  s.start_bit = match.captured(offset + 2).toInt();
-  s.size = match.captured(offset + 3).toInt();
-  s.is_little_endian = match.captured(offset + 4).toInt() == 1;
-  s.is_signed = match.captured(offset + 5) == "-";
-  s.factor = match.captured(offset + 6).toDouble();
-  s.offset = match.captured(offset + 7).toDouble();
-  s.min = match.captured(8 + offset).toDouble();
-  s.max = match.captured(9 + offset).toDouble();
-  s.unit = match.captured(10 + offset);
-  s.receiver_name = match.captured(11 + offset).trimmed();
+  s.name = toQString(name);
+  s.start_bit = toInt(start_bit);
+  s.size = toInt(size);
+  s.is_little_endian = toInt(endian) == 1;
+  s.is_signed = sign == '-';
+  s.factor = toDouble(factor);
+  s.offset = toDouble(offset);
+  s.min = toDouble(min);
+  s.max = toDouble(max);
+  s.unit = toQString(rest.substr(0, unit_end));
+  s.receiver_name = toQString(trimmed(rest.substr(unit_end + 2)));
   current_msg->sigs.push_back(new cabana::Signal(s));
 }
 
-void DBCFile::parseCM_SG(const QString &line, const QString &content, const QString &raw_line, const QTextStream &stream) {
-  static QRegularExpression sg_comment_regexp(R"(^CM_ SG_ *(\w+) *(\w+) *\"((?:[^"\\]|\\.)*)\"\s*;)");
-
-  QString parse_line = line;
-  if (!parse_line.endsWith("\";")) {
-    int pos = stream.pos() - raw_line.length() - 1;
-    parse_line = content.mid(pos, content.indexOf("\";", pos));
+// CM_ BO_ <address> "<comment>"; or CM_ SG_ <address> <signal> "<comment>";
+// `content` starts at the comment and runs to the end of the file. Returns the length of the comment.
+size_t DBCFile::parseCM(std::string_view content) {
+  Tokenizer t(content);
+  const bool is_msg = t.consume("CM_ BO_");
+  if (!is_msg) t.consume("CM_ SG_ ");
+  t.skip(' ');
+  auto address = t.word();
+  std::string_view sig_name;
+  if (!is_msg) {
+    t.skip(' ');
+    sig_name = t.word();
   }
-  auto match = sg_comment_regexp.match(parse_line);
-  if (!match.hasMatch())
-    throw std::runtime_error("Invalid CM_ SG_ line format");
-
-  if (auto s = signal(match.captured(1).toUInt(), match.captured(2))) {
-    s->comment = match.captured(3).trimmed().replace("\\\"", "\"");
+  t.skip(' ');
+  auto comment = t.quoted();
+  bool ok = !address.empty() && (is_msg || !sig_name.empty()) && comment;
+  if (ok) {
+    t.skipSpaces();
+    ok = t.consume(';');
+  }
+  if (!ok)
+    throw std::runtime_error(is_msg ? "Invalid message comment format" : "Invalid CM_ SG_ line format");
+
+  const QString text = toQString(*comment).trimmed().replace("\\\"", "\"");
+  if (is_msg) {
+    if (auto m = msg(toUInt(address))) m->comment = text;
+  } else if (auto s = findSignal(msg(toUInt(address)), sig_name)) {
+    s->comment = text;
   }
+  return t.pos();
 }
 
-void DBCFile::parseVAL(const QString &line) {
-  static QRegularExpression val_regexp(R"(VAL_ (\w+) (\w+) (\s*[-+]?[0-9]+\s+\".+?\"[^;]*))");
-
-  auto match = val_regexp.match(line);
-  if (!match.hasMatch())
+// VAL_ <address> <signal> <value> "<description>" ... ;
+void DBCFile::parseVAL(std::string_view line) {
+  Tokenizer t(line);
+  t.consume("VAL_ ");
+  auto address = t.word();
+  bool ok = !address.empty() && t.consume(' ');
+  auto sig_name = t.word();
+  ok = ok && !sig_name.empty() && t.consume(' ');
+
+  // At least one <integer> "<description>" pair, the list runs up to the next ';'
+  const size_t list_start = t.pos();
+  t.skipSpaces();
+  if (!t.consume('-')) t.consume('+');
+  ok = ok && !t.digits().empty();
+  const size_t spaces_start = t.pos();
+  t.skipSpaces();
+  ok = ok && t.pos() > spaces_start && t.consume('"');
+  const size_t desc_end = t.rest().find('"', 1);
+  if (!ok || desc_end == std::string_view::npos)
     throw std::runtime_error("invalid VAL_ line format");
 
-  if (auto s = signal(match.captured(1).toUInt(), match.captured(2))) {
-    QStringList desc_list = match.captured(3).trimmed().split('"');
-    for (int i = 0; i < desc_list.size(); i += 2) {
-      auto val = desc_list[i].trimmed();
-      if (!val.isEmpty() && (i + 1) < desc_list.size()) {
-        auto desc = desc_list[i + 1].trimmed();
-        s->val_desc.push_back({val.toDouble(), desc});
+  if (auto s = findSignal(msg(toUInt(address)), sig_name)) {
+    const size_t list_end = line.find(';', t.pos() + desc_end);
+    const auto list = trimmed(line.substr(list_start, list_end == std::string_view::npos ? list_end : list_end - list_start));
+    // Split at the quotes into alternating values and descriptions
+    std::string_view val;
+    for (size_t i = 0, start = 0;; ++i) {
+      const size_t quote = list.find('"', start);
+      const auto part = trimmed(list.substr(start, quote == std::string_view::npos ? quote : quote - start));
+      if (i % 2 == 0) {
+        val = part;
+      } else if (!val.empty()) {
+        s->val_desc.push_back({toDouble(val), toQString(part)});
       }
+      if (quote == std::string_view::npos) break;
+      start = quote + 1;
+    }
+  }
+}
+
+cabana::Signal *DBCFile::findSignal(cabana::Msg *m, std::string_view name) {
+  if (m) {
+    const QLatin1String latin1_name(name.data(), name.size());
+    for (auto s : m->sigs) {
+      if (s->name == latin1_name) return s;
     }
   }
+  return nullptr;
 }
 
 QString DBCFile::generateDBC() {
@@ -1,7 +1,7 @@
 #pragma once
 
 #include <map>
-#include <QTextStream>
+#include <string_view>
 
 #include "tools/cabana/dbc/dbc.h"
 
@@ -31,12 +31,12 @@ public:
   QString filename;
 
 private:
-  void parse(const QString &content);
-  cabana::Msg *parseBO(const QString &line);
-  void parseSG(const QString &line, cabana::Msg *current_msg, int &multiplexor_cnt);
-  void parseCM_BO(const QString &line, const QString &content, const QString &raw_line, const QTextStream &stream);
-  void parseCM_SG(const QString &line, const QString &content, const QString &raw_line, const QTextStream &stream);
-  void parseVAL(const QString &line);
+  void parse(std::string_view content);
+  cabana::Msg *parseBO(std::string_view line);
+  void parseSG(std::string_view line, cabana::Msg *current_msg, int &multiplexor_cnt);
+  size_t parseCM(std::string_view content);
+  void parseVAL(std::string_view line);
+  static cabana::Signal *findSignal(cabana::Msg *m, std::string_view name);
 
   QString header;
   std::map<uint32_t, cabana::Msg> msgs;
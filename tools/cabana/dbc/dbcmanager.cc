@@ -1,22 +1,57 @@
 #include "tools/cabana/dbc/dbcmanager.h"
 
 #include <QSet>
+#include <QtConcurrent>
 #include <algorithm>
 #include <numeric>
 
 bool DBCManager::open(const SourceSet &sources, const QString &dbc_file_name, QString *error) {
-  try {
-    auto it = std::find_if(dbc_files.begin(), dbc_files.end(),
-                           [&](auto &f) { return f.second && f.second->filename == dbc_file_name; });
-    auto file = (it != dbc_files.end()) ? it->second : std::make_shared<DBCFile>(dbc_file_name);
-    for (auto s : sources) {
-      dbc_files[s] = file;
+  return open({{sources, dbc_file_name}}, error);
+}
+
+bool DBCManager::open(const std::vector<std::pair<SourceSet, QString>> &files, QString *error) {
+  struct Job {
+    QString filename;
+    std::shared_ptr<DBCFile> file;
+    QString error;
+  };
+  // One job per file name, a file listed more than once is parsed once and shared
+  std::vector<Job> jobs;
+  std::vector<size_t> file_jobs;
+  for (const auto &[_, fn] : files) {
+    auto job = std::find_if(jobs.begin(), jobs.end(), [&](auto &j) { return j.filename == fn; });
+    file_jobs.push_back(job - jobs.begin());
+    if (job == jobs.end()) {
+      auto it = std::find_if(dbc_files.begin(), dbc_files.end(),
+                             [&](auto &f) { return f.second && f.second->filename == fn; });
+      jobs.push_back({fn, it != dbc_files.end() ? it->second : nullptr});
     }
-  } catch (std::exception &e) {
-    if (error) *error = e.what();
+  }
+
+  // Files are independent until they are assigned to their sources
+  QtConcurrent::blockingMap(jobs, [](Job &job) {
+    if (job.file) return;
+    try {
+      job.file = std::make_shared<DBCFile>(job.filename);
+    } catch (std::exception &e) {
+      job.error = e.what();
+    }
+  });
+
+  QStringList errors;
+  for (const auto &job : jobs) {
+    if (!job.error.isEmpty()) errors.push_back(job.error);
+  }
+  if (!errors.isEmpty()) {
+    if (error) *error = errors.join("\n");
     return false;
   }
 
+  for (size_t i = 0; i < files.size(); ++i) {
+    for (auto s : files[i].first) {
+      dbc_files[s] = jobs[file_jobs[i]].file;
+    }
+  }
   emit DBCFileChanged();
   return true;
 }
@@ -4,6 +4,8 @@
 #include <memory>
 #include <map>
 #include <set>
+#include <utility>
+#include <vector>
 
 #include "tools/cabana/dbc/dbcfile.h"
 
@@ -20,6 +22,8 @@ public:
   ~DBCManager() {}
   bool open(const SourceSet &sources, const QString &dbc_file_name, QString *error = nullptr);
   bool open(const SourceSet &sources, const QString &name, const QString &content, QString *error = nullptr);
+  // Parses the files in parallel. Nothing is opened if any of them fails.
+  bool open(const std::vector<std::pair<SourceSet, QString>> &files, QString *error = nullptr);
   void close(const SourceSet &sources);
   void close(DBCFile *dbc_file);
   void closeAll();
@@ -86,7 +86,7 @@ void HistoryLogModel::updateState(bool clear) {
 
 bool HistoryLogModel::canFetchMore(const QModelIndex &parent) const {
   const auto &events = can->events(msg_id);
-  return !events.empty() && !messages.empty() && messages.back().mono_time > events.front()->mono_time;
+  return !events.empty() && !messages.empty() && messages.back().mono_time > events.front().mono_time;
 }
 
 void HistoryLogModel::fetchMore(const QModelIndex &parent) {
@@ -96,24 +96,34 @@ void HistoryLogModel::fetchMore(const QModelIndex &parent) {
 
 void HistoryLogModel::fetchData(std::deque<Message>::iterator insert_pos, uint64_t from_time, uint64_t min_time) {
   const auto &events = can->events(msg_id);
-  auto first = std::upper_bound(events.rbegin(), events.rend(), from_time, [](uint64_t ts, auto e) {
-    return ts > e->mono_time;
-  });
+  std::vector<cabana::SignalDecoder> decoders;
+  for (auto s : sigs) decoders.emplace_back(*s);
+  std::vector<std::vector<double>> sig_values(sigs.size());
+  std::vector<std::vector<uint8_t>> sig_valid(sigs.size());
 
   std::vector<HistoryLogModel::Message> msgs;
   std::vector<double> values(sigs.size());
   msgs.reserve(batch_size);
-  for (; first != events.rend() && (*first)->mono_time > min_time; ++first) {
-    const CanEvent *e = *first;
+  // Walk back from from_time, decoding batch_size events at a time
+  const size_t begin = events.upperBound(min_time).index();
+  size_t end = events.lowerBound(from_time).index();
+  bool done = false;
+  while (end > begin && !done) {
+    const size_t start = end - std::min<size_t>(end - begin, batch_size);
     for (int i = 0; i < sigs.size(); ++i) {
-      sigs[i]->getValue(e->dat, e->size, &values[i]);
+      events.decode(decoders[i], start, end, sig_values[i], sig_valid[i]);
     }
-    if (!filter_cmp || filter_cmp(values[filter_sig_idx], filter_value)) {
-       msgs.emplace_back(Message{e->mono_time, values, {e->dat, e->dat + e->size}});
-      if (msgs.size() >= batch_size && min_time == 0) {
-        break;
+    for (size_t idx = end; idx-- > start && !done;) {
+      for (int i = 0; i < sigs.size(); ++i) {
+        if (sig_valid[i][idx - start]) values[i] = sig_values[i][idx - start];
+      }
+      if (!filter_cmp || filter_cmp(values[filter_sig_idx], filter_value)) {
+        const CanEvent e = events[idx];
+        msgs.emplace_back(Message{e.mono_time, values, {e.dat, e.dat + e.size}});
+        done = msgs.size() >= batch_size && min_time == 0;
       }
     }
+    end = start;
   }
 
   if (!msgs.empty()) {
@@ -22,6 +22,7 @@
 
 #include "tools/cabana/commands.h"
 #include "tools/cabana/streamselector.h"
+#include "tools/cabana/streams/livestream.h"
 #include "tools/cabana/tools/findsignal.h"
 #include "tools/cabana/utils/export.h"
 
@@ -291,6 +292,33 @@ void MainWindow::loadFile(const QString &fn, SourceSet s) {
   }
 }
 
+void MainWindow::loadFiles(const QString &files) {
+  std::vector<std::pair<SourceSet, QString>> dbc_files;
+  for (const auto &entry : files.split(',', QString::SkipEmptyParts)) {
+    bool ok = false;
+    const int bus = entry.section(':', 0, 0).toInt(&ok);
+    if (!ok || !entry.contains(':')) {
+      loadFile(files);
+      return;
+    }
+    dbc_files.push_back({{bus, uint8_t(bus + 128), uint8_t(bus + 192)}, entry.section(':', 1)});
+  }
+  if (dbc_files.empty()) return;
+
+  closeFile(SOURCE_ALL);
+  QString error;
+  if (dbc()->open(dbc_files, &error)) {
+    for (const auto &[_, fn] : dbc_files) {
+      updateRecentFiles(fn);
+    }
+    statusBar()->showMessage(tr("%1 DBC files loaded").arg(dbc_files.size()), 2000);
+  } else {
+    QMessageBox msg_box(QMessageBox::Warning, tr("Failed to load DBC file"), tr("Failed to parse DBC files %1").arg(files));
+    msg_box.setDetailedText(error);
+    msg_box.exec();
+  }
+}
+
 void MainWindow::loadDBCFromOpendbc(const QString &name) {
   loadFile(QString("%1/%2").arg(OPENDBC_FILE_PATH, name));
 }
@@ -314,13 +342,15 @@ void MainWindow::openStream(AbstractStream *stream, const QString &dbc_file) {
   center_widget->clear();
   delete messages_widget;
   delete video_splitter;
+  // Searches may still be reading the events of the stream
+  qDeleteAll(findChildren<FindSimilarBitsDlg *>());
 
   delete can;
   can = stream;
   can->setParent(this);  // take ownership
   can->start();
 
-  loadFile(dbc_file);
+  loadFiles(dbc_file);
   statusBar()->showMessage(tr("Stream [%1] started").arg(can->routeName()), 2000);
 
   bool has_stream = dynamic_cast<DummyStream *>(can) == nullptr;
@@ -356,6 +386,9 @@ void MainWindow::openStream(AbstractStream *stream, const QString &dbc_file) {
 }
 
 void MainWindow::eventsMerged() {
+  if (auto live = qobject_cast<LiveStream *>(can); live && live->logging()) {
+    updateStatus();
+  }
   if (!can->liveStreaming() && std::exchange(car_fingerprint, can->carFingerprint()) != car_fingerprint) {
     video_dock->setWindowTitle(tr("ROUTE: %1  FINGERPRINT: %2")
                                     .arg(can->routeName())
@@ -513,7 +546,11 @@ void MainWindow::updateDownloadProgress(uint64_t cur, uint64_t total, bool succe
 }
 
 void MainWindow::updateStatus() {
-  status_label->setText(tr("Cached Minutes:%1 FPS:%2").arg(settings.max_cached_minutes).arg(settings.fps));
+  QString text = tr("Cached Minutes:%1 FPS:%2").arg(settings.max_cached_minutes).arg(settings.fps);
+  if (auto live = qobject_cast<LiveStream *>(can); live && live->logging()) {
+    text += tr(" Log Backlog:%1 Dropped:%2").arg(live->logBacklog()).arg(live->droppedLogFrames());
+  }
+  status_label->setText(text);
 }
 
 bool MainWindow::eventFilter(QObject *obj, QEvent *event) {
@@ -24,6 +24,8 @@ public:
   void toggleChartsDocking();
   void showStatusMessage(const QString &msg, int timeout = 0) { statusBar()->showMessage(msg, timeout); }
   void loadFile(const QString &fn, SourceSet s = SOURCE_ALL);
+  // A single file for all buses, or comma-separated bus:file pairs
+  void loadFiles(const QString &files);
   ChartsWidget *charts_widget = nullptr;
 
 public slots:
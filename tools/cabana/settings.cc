@@ -14,6 +14,8 @@
 
 const int MIN_CACHE_MINIUTES = 30;
 const int MAX_CACHE_MINIUTES = 120;
+const int MIN_CACHE_MB = 256;
+const int MAX_CACHE_MB = 64 * 1024;
 
 Settings settings;
 
@@ -23,6 +25,7 @@ void settings_op(SettingOperation op) {
   op(s, "absolute_time", settings.absolute_time);
   op(s, "fps", settings.fps);
   op(s, "max_cached_minutes", settings.max_cached_minutes);
+  op(s, "max_cached_mb", settings.max_cached_mb);
   op(s, "chart_height", settings.chart_height);
   op(s, "chart_range", settings.chart_range);
   op(s, "chart_column_count", settings.chart_column_count);
@@ -78,6 +81,12 @@ SettingsDlg::SettingsDlg(QWidget *parent) : QDialog(parent) {
   cached_minutes->setRange(MIN_CACHE_MINIUTES, MAX_CACHE_MINIUTES);
   cached_minutes->setSingleStep(1);
   cached_minutes->setValue(settings.max_cached_minutes);
+
+  form_layout->addRow(tr("Max Cached Memory (MB)"), cached_mb = new QSpinBox(this));
+  cached_mb->setToolTip(tr("Live streams drop their oldest events beyond the cached minutes or this much memory"));
+  cached_mb->setRange(MIN_CACHE_MB, MAX_CACHE_MB);
+  cached_mb->setSingleStep(256);
+  cached_mb->setValue(settings.max_cached_mb);
   main_layout->addWidget(groupbox);
 
   groupbox = new QGroupBox("New Signal Settings");
@@ -128,6 +137,7 @@ void SettingsDlg::save() {
   }
   settings.fps = fps->value();
   settings.max_cached_minutes = cached_minutes->value();
+  settings.max_cached_mb = cached_mb->value();
   settings.chart_height = chart_height->value();
   settings.log_livestream = log_livestream->isChecked();
   settings.log_path = log_path->text();
@@ -27,6 +27,7 @@ public:
   bool absolute_time = false;
   int fps = 10;
   int max_cached_minutes = 30;
+  int max_cached_mb = 4096;
   int chart_height = 200;
   int chart_column_count = 1;
   int chart_range = 3 * 60; // 3 minutes
@@ -56,6 +57,7 @@ public:
   void save();
   QSpinBox *fps;
   QSpinBox *cached_minutes;
+  QSpinBox *cached_mb;
   QSpinBox *chart_height;
   QComboBox *chart_series_type;
   QComboBox *theme;
@@ -7,13 +7,10 @@
 #include "common/timing.h"
 #include "tools/cabana/settings.h"
 
-static const int EVENT_NEXT_BUFFER_SIZE = 6 * 1024 * 1024;  // 6MB
-
 AbstractStream *can = nullptr;
 
 AbstractStream::AbstractStream(QObject *parent) : QObject(parent) {
   assert(parent != nullptr);
-  event_buffer_ = std::make_unique<MonotonicBuffer>(EVENT_NEXT_BUFFER_SIZE);
 
   QObject::connect(this, &AbstractStream::privateUpdateLastMsgsSignal, this, &AbstractStream::updateLastMessages, Qt::QueuedConnection);
   QObject::connect(this, &AbstractStream::seekedTo, this, &AbstractStream::updateLastMsgsTo);
@@ -115,8 +112,8 @@ void AbstractStream::updateEvent(const MessageId &id, double sec, const uint8_t
   new_msgs_.insert(id);
 }
 
-const std::vector<const CanEvent *> &AbstractStream::events(const MessageId &id) const {
-  static std::vector<const CanEvent *> empty_events;
+const MessageEvents &AbstractStream::events(const MessageId &id) const {
+  static MessageEvents empty_events;
   auto it = events_.find(id);
   return it != events_.end() ? it->second : empty_events;
 }
@@ -149,7 +146,7 @@ void AbstractStream::updateLastMsgsTo(double sec) {
   msgs.reserve(events_.size());
 
   for (const auto &[id, ev] : events_) {
-    auto it = std::upper_bound(ev.begin(), ev.end(), last_ts, CompareCanEvent());
+    auto it = ev.upperBound(last_ts);
     if (it != ev.begin()) {
       auto &m = msgs[id];
       double freq = 0;
@@ -162,9 +159,9 @@ void AbstractStream::updateLastMsgsTo(double sec) {
                        [](const auto &change) { return CanData::ByteLastChange{.suppressed = change.suppressed}; });
       }
 
-      auto prev = std::prev(it);
-      m.compute(id, (*prev)->dat, (*prev)->size, toSeconds((*prev)->mono_time), getSpeed(), {}, freq);
-      m.count = std::distance(ev.begin(), prev) + 1;
+      const CanEvent prev = *std::prev(it);
+      m.compute(id, prev.dat, prev.size, toSeconds(prev.mono_time), getSpeed(), {}, freq);
+      m.count = it.index();
     }
   }
 
@@ -187,47 +184,206 @@ void AbstractStream::waitForSeekFinshed() {
   seek_finished_ = false;
 }
 
-const CanEvent *AbstractStream::newEvent(uint64_t mono_time, const cereal::CanData::Reader &c) {
+void AbstractStream::addEvent(MessageEventsMap &events, uint64_t mono_time, const cereal::CanData::Reader &c) {
   auto dat = c.getDat();
-  CanEvent *e = (CanEvent *)event_buffer_->allocate(sizeof(CanEvent) + sizeof(uint8_t) * dat.size());
-  e->src = c.getSrc();
-  e->address = c.getAddress();
-  e->mono_time = mono_time;
-  e->size = dat.size();
-  memcpy(e->dat, (uint8_t *)dat.begin(), e->size);
-  return e;
-}
-
-void AbstractStream::mergeEvents(const std::vector<const CanEvent *> &events) {
-  static MessageEventsMap msg_events;
-  std::for_each(msg_events.begin(), msg_events.end(), [](auto &e) { e.second.clear(); });
-
-  // Group events by message ID
-  for (auto e : events) {
-    msg_events[{.source = e->src, .address = e->address}].push_back(e);
+  events[{.source = (uint8_t)c.getSrc(), .address = c.getAddress()}].append(mono_time, (const uint8_t *)dat.begin(), dat.size());
+}
+
+void AbstractStream::mergeEvents(const MessageEventsMap &events) {
+  if (eventsHeld()) {
+    for (const auto &[id, new_e] : events) {
+      if (!new_e.empty()) held_events_[id].merge(new_e);
+    }
+    return;
   }
 
-  if (!events.empty()) {
-    for (const auto &[id, new_e] : msg_events) {
-      if (!new_e.empty()) {
-        auto &e = events_[id];
-        auto pos = std::upper_bound(e.cbegin(), e.cend(), new_e.front()->mono_time, CompareCanEvent());
-        e.insert(pos, new_e.cbegin(), new_e.cend());
-      }
+  bool merged = false;
+  for (const auto &[id, new_e] : events) {
+    if (!new_e.empty()) {
+      events_[id].merge(new_e);
+      merged = true;
     }
-    auto pos = std::upper_bound(all_events_.cbegin(), all_events_.cend(), events.front()->mono_time, CompareCanEvent());
-    all_events_.insert(pos, events.cbegin(), events.cend());
-    emit eventsMerged(msg_events);
   }
+  if (merged) {
+    emit eventsMerged(events);
+  }
+}
+
+void AbstractStream::releaseEvents() {
+  assert(events_held_ > 0);
+  if (--events_held_ == 0 && !held_events_.empty()) {
+    MessageEventsMap events;
+    events.swap(held_events_);
+    mergeEvents(events);
+  }
+}
+
+size_t AbstractStream::dropEventsBefore(uint64_t mono_time) {
+  size_t bytes = 0;
+  for (auto &[_, e] : events_) {
+    const size_t prev_bytes = e.bytes();
+    if (e.eraseBefore(mono_time) > 0) bytes += prev_bytes - e.bytes();
+  }
+  return bytes;
+}
+
+size_t AbstractStream::eventsBytes() const {
+  size_t bytes = 0;
+  for (const auto &[_, e] : events_) bytes += e.bytes();
+  return bytes;
 }
 
 std::pair<CanEventIter, CanEventIter> AbstractStream::eventsInRange(const MessageId &id, std::optional<std::pair<double, double>> time_range) const {
   const auto &events = can->events(id);
   if (!time_range) return {events.begin(), events.end()};
 
-  auto first = std::lower_bound(events.begin(), events.end(), can->toMonoTime(time_range->first), CompareCanEvent());
-  auto last = std::upper_bound(first, events.end(), can->toMonoTime(time_range->second), CompareCanEvent());
-  return {first, last};
+  auto first = events.lowerBound(can->toMonoTime(time_range->first));
+  auto last = events.upperBound(can->toMonoTime(time_range->second));
+  return {first, std::max(first, last)};
+}
+
+void AbstractStream::forEachEvent(const std::function<void(const MessageId &, const CanEvent &)> &callback, uint64_t from,
+                                  uint64_t to, const std::function<bool(const MessageId &)> &filter) const {
+  struct Cursor {
+    const MessageId *id;
+    const MessageEvents *events;
+    size_t idx, end;
+  };
+  std::vector<Cursor> cursors;
+  for (const auto &[id, e] : events_) {
+    if (filter && !filter(id)) continue;
+
+    size_t first = e.upperBound(from).index(), last = e.upperBound(to).index();
+    if (first < last) cursors.push_back({&id, &e, first, last});
+  }
+
+  // k-way merge of the per-message event arrays
+  auto later = [](const Cursor &a, const Cursor &b) {
+    return a.events->monoTimes()[a.idx] > b.events->monoTimes()[b.idx];
+  };
+  std::make_heap(cursors.begin(), cursors.end(), later);
+  while (!cursors.empty()) {
+    std::pop_heap(cursors.begin(), cursors.end(), later);
+    auto &c = cursors.back();
+    callback(*c.id, (*c.events)[c.idx]);
+    if (++c.idx < c.end) {
+      std::push_heap(cursors.begin(), cursors.end(), later);
+    } else {
+      cursors.pop_back();
+    }
+  }
+}
+
+// MessageEvents
+
+MessageEvents::const_iterator MessageEvents::lowerBound(uint64_t mono_time) const {
+  return {this, (size_t)(std::lower_bound(mono_times_.begin(), mono_times_.end(), mono_time) - mono_times_.begin())};
+}
+
+MessageEvents::const_iterator MessageEvents::upperBound(uint64_t mono_time) const {
+  return {this, (size_t)(std::upper_bound(mono_times_.begin(), mono_times_.end(), mono_time) - mono_times_.begin())};
+}
+
+void MessageEvents::setStride(uint8_t stride) {
+  // Rare: a message grew longer than before. Re-layout the payloads with the new stride.
+  std::vector<uint8_t> dat(size() * stride, 0);
+  for (size_t i = 0; i < size(); ++i) {
+    memcpy(dat.data() + i * stride, dat_.data() + i * stride_, sizes_[i]);
+  }
+  dat_ = std::move(dat);
+  stride_ = stride;
+}
+
+void MessageEvents::append(uint64_t mono_time, const uint8_t *dat, uint8_t size) {
+  if (size > stride_) setStride(size);
+
+  mono_times_.push_back(mono_time);
+  sizes_.push_back(size);
+  dat_.resize(dat_.size() + stride_, 0);
+  memcpy(dat_.data() + dat_.size() - stride_, dat, size);
+}
+
+void MessageEvents::merge(const MessageEvents &events) {
+  if (events.empty()) return;
+  if (events.stride_ > stride_) setStride(events.stride_);
+
+  const size_t pos = upperBound(events.mono_times_.front()).index();
+  mono_times_.insert(mono_times_.begin() + pos, events.mono_times_.begin(), events.mono_times_.end());
+  sizes_.insert(sizes_.begin() + pos, events.sizes_.begin(), events.sizes_.end());
+  if (events.stride_ == stride_) {
+    dat_.insert(dat_.begin() + pos * stride_, events.dat_.begin(), events.dat_.end());
+  } else {
+    auto it = dat_.insert(dat_.begin() + pos * stride_, events.size() * stride_, 0);
+    for (size_t i = 0; i < events.size(); ++i) {
+      memcpy(&*(it + i * stride_), events.dat_.data() + i * events.stride_, events.sizes_[i]);
+    }
+  }
+}
+
+void MessageEvents::decode(const cabana::SignalDecoder &decoder, size_t first, size_t last,
+                           std::vector<double> &values, std::vector<uint8_t> &valid) const {
+  last = std::min(last, size());
+  const size_t count = first < last ? last - first : 0;
+  values.resize(count);
+  valid.resize(count);
+  if (count > 0) {
+    decoder.decode(dat_.data() + first * stride_, stride_, sizes_.data() + first, count, values.data(), valid.data());
+  }
+}
+
+std::vector<uint64_t> MessageEvents::bitPlanes(size_t first, size_t last, int bytes) const {
+  // Transposes an 8x8 bit matrix: bit c of byte r moves to bit r of byte c
+  auto transpose8 = [](uint64_t x) {
+    uint64_t t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    return x ^ t ^ (t << 28);
+  };
+
+  last = std::min(last, size());
+  bytes = std::min<int>(bytes, stride_);
+  const size_t count = first < last ? last - first : 0;
+  const size_t words = (count + 63) / 64;
+  std::vector<uint64_t> planes(bytes * 8 * words, 0);
+  // Byte b of 8 consecutive events is one 8x8 matrix, its rows become one byte in each of 8 planes
+  for (size_t i = 0; i < count; i += 8) {
+    const uint8_t *dat = dat_.data() + (first + i) * stride_;
+    const size_t n = std::min<size_t>(8, count - i);
+    for (int b = 0; b < bytes; ++b) {
+      uint64_t x = 0;
+      for (size_t k = 0; k < n; ++k) x |= (uint64_t)dat[k * stride_ + b] << (8 * k);
+      if (!x) continue;
+      x = transpose8(x);
+      for (int c = 0; c < 8; ++c) {
+        planes[(b * 8 + c) * words + i / 64] |= ((x >> (8 * c)) & 0xff) << (i % 64);
+      }
+    }
+  }
+  return planes;
+}
+
+void MessageEvents::reserve(size_t n) {
+  mono_times_.reserve(n);
+  sizes_.reserve(n);
+  dat_.reserve(n * stride_);
+}
+
+void MessageEvents::clear() {
+  mono_times_.clear();
+  sizes_.clear();
+  dat_.clear();
+}
+
+size_t MessageEvents::eraseBefore(uint64_t mono_time) {
+  const size_t n = lowerBound(mono_time).index();
+  if (n > 0) {
+    mono_times_.erase(mono_times_.begin(), mono_times_.begin() + n);
+    sizes_.erase(sizes_.begin(), sizes_.begin() + n);
+    dat_.erase(dat_.begin(), dat_.begin() + n * stride_);
+  }
+  return n;
 }
 
 namespace {
@@ -253,7 +409,7 @@ double calc_freq(const MessageId &msg_id, double current_sec) {
   int count = std::distance(first, last);
   if (count <= 1) return 0.0;
 
-  double duration = ((*std::prev(last))->mono_time - (*first)->mono_time) / 1e9;
+  double duration = (std::prev(last)->mono_time - first->mono_time) / 1e9;
   return duration > std::numeric_limits<double>::epsilon() ? (count - 1) / duration : 0.0;
 }
 
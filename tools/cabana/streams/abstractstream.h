@@ -3,6 +3,9 @@
 #include <algorithm>
 #include <array>
 #include <condition_variable>
+#include <functional>
+#include <iterator>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <optional>
@@ -40,21 +43,108 @@ struct CanData {
   double last_freq_update_ts = 0;
 };
 
+// View of a single CAN frame. `dat` points into the storage of the MessageEvents it came from.
 struct CanEvent {
-  uint8_t src;
-  uint32_t address;
   uint64_t mono_time;
+  const uint8_t *dat;
   uint8_t size;
-  uint8_t dat[];
 };
 
-struct CompareCanEvent {
-  constexpr bool operator()(const CanEvent *const e, uint64_t ts) const { return e->mono_time < ts; }
-  constexpr bool operator()(uint64_t ts, const CanEvent *const e) const { return ts < e->mono_time; }
+// Events of one message, stored column-wise: a contiguous array of timestamps and a payload
+// array with a fixed stride. Time lookups are binary searches over the timestamps only, and
+// scans read both arrays sequentially.
+class MessageEvents {
+public:
+  class const_iterator {
+  public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = CanEvent;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const CanEvent *;
+    using reference = CanEvent;
+
+    struct arrow_proxy {
+      CanEvent e;
+      const CanEvent *operator->() const { return &e; }
+    };
+
+    const_iterator() = default;
+    const_iterator(const MessageEvents *events, size_t idx) : events_(events), idx_(idx) {}
+    CanEvent operator*() const { return (*events_)[idx_]; }
+    arrow_proxy operator->() const { return {(*events_)[idx_]}; }
+    CanEvent operator[](difference_type n) const { return (*events_)[idx_ + n]; }
+    size_t index() const { return idx_; }
+
+    const_iterator &operator++() { ++idx_; return *this; }
+    const_iterator operator++(int) { auto tmp = *this; ++idx_; return tmp; }
+    const_iterator &operator--() { --idx_; return *this; }
+    const_iterator operator--(int) { auto tmp = *this; --idx_; return tmp; }
+    const_iterator &operator+=(difference_type n) { idx_ += n; return *this; }
+    const_iterator &operator-=(difference_type n) { idx_ -= n; return *this; }
+    const_iterator operator+(difference_type n) const { return {events_, idx_ + n}; }
+    const_iterator operator-(difference_type n) const { return {events_, idx_ - n}; }
+    friend const_iterator operator+(difference_type n, const const_iterator &it) { return it + n; }
+    difference_type operator-(const const_iterator &other) const { return (difference_type)idx_ - (difference_type)other.idx_; }
+
+    bool operator==(const const_iterator &other) const { return idx_ == other.idx_; }
+    bool operator!=(const const_iterator &other) const { return idx_ != other.idx_; }
+    bool operator<(const const_iterator &other) const { return idx_ < other.idx_; }
+    bool operator>(const const_iterator &other) const { return idx_ > other.idx_; }
+    bool operator<=(const const_iterator &other) const { return idx_ <= other.idx_; }
+    bool operator>=(const const_iterator &other) const { return idx_ >= other.idx_; }
+
+  private:
+    const MessageEvents *events_ = nullptr;
+    size_t idx_ = 0;
+  };
+
+  inline size_t size() const { return mono_times_.size(); }
+  inline bool empty() const { return mono_times_.empty(); }
+  inline CanEvent operator[](size_t i) const { return {mono_times_[i], dat_.data() + i * stride_, sizes_[i]}; }
+  inline CanEvent front() const { return (*this)[0]; }
+  inline CanEvent back() const { return (*this)[size() - 1]; }
+  inline const_iterator begin() const { return {this, 0}; }
+  inline const_iterator end() const { return {this, size()}; }
+  inline const_iterator cbegin() const { return begin(); }
+  inline const_iterator cend() const { return end(); }
+  inline std::reverse_iterator<const_iterator> rbegin() const { return std::reverse_iterator(end()); }
+  inline std::reverse_iterator<const_iterator> rend() const { return std::reverse_iterator(begin()); }
+
+  // First event at or after mono_time / first event after mono_time
+  const_iterator lowerBound(uint64_t mono_time) const;
+  const_iterator upperBound(uint64_t mono_time) const;
+
+  inline const std::vector<uint64_t> &monoTimes() const { return mono_times_; }
+  inline uint8_t stride() const { return stride_; }
+  // Decodes a signal for events [first, last). valid[i] is 0 where a multiplexed signal is absent.
+  void decode(const cabana::SignalDecoder &decoder, size_t first, size_t last,
+              std::vector<double> &values, std::vector<uint8_t> &valid) const;
+  // Transposes the first `bytes` payload bytes of events [first, last) into bit-planes. Plane
+  // byte * 8 + bit holds that bit of every event, 64 events per word and (last - first + 63) / 64
+  // words per plane. Bytes beyond a frame's size read as 0.
+  std::vector<uint64_t> bitPlanes(size_t first, size_t last, int bytes) const;
+
+  void append(uint64_t mono_time, const uint8_t *dat, uint8_t size);
+  // Inserts a time-ordered batch after the last event that is not later than its first event.
+  void merge(const MessageEvents &events);
+  void reserve(size_t n);
+  void clear();
+  // Removes the events before mono_time and returns how many there were. The capacity is kept
+  // for the events appended next.
+  size_t eraseBefore(uint64_t mono_time);
+  inline size_t bytes() const { return size() * (sizeof(uint64_t) + 1 + stride_); }
+
+private:
+  void setStride(uint8_t stride);
+
+  std::vector<uint64_t> mono_times_;
+  std::vector<uint8_t> sizes_;
+  std::vector<uint8_t> dat_;  // stride_ bytes per event, zero padded
+  uint8_t stride_ = 0;
 };
 
-typedef std::unordered_map<MessageId, std::vector<const CanEvent *>> MessageEventsMap;
-using CanEventIter = std::vector<const CanEvent *>::const_iterator;
+typedef std::unordered_map<MessageId, MessageEvents> MessageEventsMap;
+using CanEventIter = MessageEvents::const_iterator;
 
 class AbstractStream : public QObject {
   Q_OBJECT
@@ -85,10 +175,18 @@ public:
   inline const std::unordered_map<MessageId, CanData> &lastMessages() const { return last_msgs; }
   bool isMessageActive(const MessageId &id) const;
   inline const MessageEventsMap &eventsMap() const { return events_; }
-  inline const std::vector<const CanEvent *> &allEvents() const { return all_events_; }
   const CanData &lastMessage(const MessageId &id) const;
-  const std::vector<const CanEvent *> &events(const MessageId &id) const;
+  const MessageEvents &events(const MessageId &id) const;
   std::pair<CanEventIter, CanEventIter> eventsInRange(const MessageId &id, std::optional<std::pair<double, double>> time_range) const;
+  // Calls callback for the events of all messages accepted by filter with mono_time in (from, to], in time order.
+  void forEachEvent(const std::function<void(const MessageId &, const CanEvent &)> &callback, uint64_t from = 0,
+                    uint64_t to = std::numeric_limits<uint64_t>::max(),
+                    const std::function<bool(const MessageId &)> &filter = nullptr) const;
+
+  // While held, merged events are set aside, so other threads may read the events without
+  // copying them. They are merged when the last hold is released. Called in the GUI thread.
+  void holdEvents() { ++events_held_; }
+  void releaseEvents();
 
   size_t suppressHighlighted();
   void clearSuppressed();
@@ -109,11 +207,14 @@ public:
   SourceSet sources;
 
 protected:
-  void mergeEvents(const std::vector<const CanEvent *> &events);
-  const CanEvent *newEvent(uint64_t mono_time, const cereal::CanData::Reader &c);
+  void mergeEvents(const MessageEventsMap &events);
+  // Drops the events of all messages before mono_time. Returns the bytes they used.
+  size_t dropEventsBefore(uint64_t mono_time);
+  size_t eventsBytes() const;
+  static void addEvent(MessageEventsMap &events, uint64_t mono_time, const cereal::CanData::Reader &c);
   void updateEvent(const MessageId &id, double sec, const uint8_t *data, uint8_t size);
   void waitForSeekFinshed();
-  std::vector<const CanEvent *> all_events_;
+  inline bool eventsHeld() const { return events_held_ > 0; }
   double current_sec_ = 0;
   std::optional<std::pair<double, double>> time_range_;
 
@@ -123,8 +224,9 @@ private:
   void updateMasks();
 
   MessageEventsMap events_;
+  MessageEventsMap held_events_;
+  int events_held_ = 0;
   std::unordered_map<MessageId, CanData> last_msgs;
-  std::unique_ptr<MonotonicBuffer> event_buffer_;
 
   // Members accessed in multiple threads. (mutex protected)
   std::mutex mutex_;
@@ -2,33 +2,67 @@
 
 #include <QThread>
 #include <algorithm>
-#include <fstream>
 #include <memory>
+#include <string>
+#include <thread>
 
+#include "common/spsc_queue.h"
 #include "common/timing.h"
 #include "common/util.h"
+#include "system/loggerd/logger.h"
 
+// Frames waiting to be compressed. The stream thread drops frames when the queue is full.
+const size_t LOG_QUEUE_SIZE = 16384;
+
+// Writes the received events into one rlog.zst per minute, in the format of loggerd so the
+// segments open with LogReader. Compression and disk writes run on a thread of their own,
+// and the stream thread never waits for them.
 struct LiveStream::Logger {
-  Logger() : start_ts(seconds_since_epoch()), segment_num(-1) {}
+  Logger() : start_ts(seconds_since_epoch()), log_path(settings.log_path), queue(LOG_QUEUE_SIZE) {
+    thread = std::thread(&Logger::writeThread, this);
+  }
 
+  ~Logger() {
+    queue.push({});  // an empty frame ends the thread
+    thread.join();
+  }
+
+  // called in streamThread
   void write(kj::ArrayPtr<capnp::word> data) {
-    int n = (seconds_since_epoch() - start_ts) / 60.0;
-    if (std::exchange(segment_num, n) != segment_num) {
-      QString dir = QString("%1/%2--%3")
-                        .arg(settings.log_path)
-                        .arg(QDateTime::fromSecsSinceEpoch(start_ts).toString("yyyy-MM-dd--hh-mm-ss"))
-                        .arg(n);
-      util::create_directories(dir.toStdString(), 0755);
-      fs.reset(new std::ofstream((dir + "/rlog").toStdString(), std::ios::binary | std::ios::out));
+    auto bytes = data.asBytes();
+    if (!queue.try_push(std::string((const char *)bytes.begin(), bytes.size()))) {
+      ++dropped;
     }
+  }
 
-    auto bytes = data.asBytes();
-    fs->write((const char*)bytes.begin(), bytes.size());
+  void writeThread() {
+    int segment_num = -1;
+    std::unique_ptr<ZstdFileWriter> file;
+    for (std::string data = queue.pop(); !data.empty(); data = queue.pop()) {
+      int n = (seconds_since_epoch() - start_ts) / 60.0;
+      if (std::exchange(segment_num, n) != segment_num) {
+        QString dir = QString("%1/%2--%3")
+                          .arg(log_path)
+                          .arg(QDateTime::fromSecsSinceEpoch(start_ts).toString("yyyy-MM-dd--hh-mm-ss"))
+                          .arg(n);
+        file.reset();  // finish the previous segment
+        if (util::create_directories(dir.toStdString(), 0755)) {
+          file = std::make_unique<ZstdFileWriter>((dir + "/rlog.zst").toStdString(), LOG_COMPRESSION_LEVEL);
+        }
+      }
+      if (file) {
+        file->write(data.data(), data.size());
+      } else {
+        ++dropped;
+      }
+    }
   }
 
-  std::unique_ptr<std::ofstream> fs;
-  int segment_num;
-  uint64_t start_ts;
+  const uint64_t start_ts;
+  const QString log_path;
+  SPSCQueue<std::string> queue;
+  std::atomic<uint64_t> dropped = 0;
+  std::thread thread;
 };
 
 LiveStream::LiveStream(QObject *parent) : AbstractStream(parent) {
@@ -46,6 +80,14 @@ LiveStream::~LiveStream() {
   stop();
 }
 
+size_t LiveStream::logBacklog() const {
+  return logger ? logger->queue.size() : 0;
+}
+
+uint64_t LiveStream::droppedLogFrames() const {
+  return logger ? logger->dropped.load() : 0;
+}
+
 void LiveStream::startUpdateTimer() {
   update_timer.stop();
   update_timer.start(1000.0 / settings.fps, this);
@@ -80,23 +122,27 @@ void LiveStream::handleEvent(kj::ArrayPtr<capnp::word> data) {
     const uint64_t mono_time = event.getLogMonoTime();
     std::lock_guard lk(lock);
     for (const auto &c : event.getCan()) {
-      received_events_.push_back(newEvent(mono_time, c));
+      addEvent(received_events_, mono_time, c);
     }
   }
 }
 
 void LiveStream::timerEvent(QTimerEvent *event) {
   if (event->timerId() == timer_id) {
+    dropExpiredEvents();
     {
       // merge events received from live stream thread.
       std::lock_guard lk(lock);
       mergeEvents(received_events_);
-      uint64_t last_received_ts = !received_events_.empty() ? received_events_.back()->mono_time : 0;
-      lastest_event_ts = std::max(lastest_event_ts, last_received_ts);
-      received_events_.clear();
+      for (const auto &[_, e] : received_events_) {
+        if (e.empty()) continue;
+        lastest_event_ts = std::max(lastest_event_ts, e.back().mono_time);
+        begin_event_ts = begin_event_ts ? std::min(begin_event_ts, e.front().mono_time) : e.front().mono_time;
+      }
+      // Keep the per-message arrays allocated, the same ids keep arriving
+      std::for_each(received_events_.begin(), received_events_.end(), [](auto &e) { e.second.clear(); });
     }
-    if (!all_events_.empty()) {
-      begin_event_ts = all_events_.front()->mono_time;
+    if (lastest_event_ts != 0) {
       updateEvents();
       return;
     }
@@ -104,12 +150,33 @@ void LiveStream::timerEvent(QTimerEvent *event) {
   QObject::timerEvent(event);
 }
 
+void LiveStream::dropExpiredEvents() {
+  // Events leave the cache a minute at a time, so the arrays are compacted at most about once a
+  // minute and appending stays cheap however long the session runs. The logger keeps them on disk.
+  const uint64_t chunk = 60 * 1e9;
+  const uint64_t window = settings.max_cached_minutes * chunk;
+  const uint64_t first_ts = std::max(retained_event_ts, begin_event_ts);
+  if (eventsHeld() || lastest_event_ts <= first_ts) return;
+
+  uint64_t drop_before = lastest_event_ts - first_ts > window + chunk ? lastest_event_ts - window : 0;
+  // Over the memory limit: drop the share of the time span that frees the excess, at least a minute
+  const size_t max_bytes = (size_t)settings.max_cached_mb << 20;
+  if (const size_t bytes = eventsBytes(); bytes > max_bytes) {
+    const uint64_t span = lastest_event_ts - first_ts;
+    drop_before = std::max<uint64_t>(drop_before, first_ts + std::max<uint64_t>(chunk, span * (1.0 - (double)max_bytes / bytes)));
+  }
+  if (drop_before > first_ts) {
+    retained_event_ts = std::min(drop_before, lastest_event_ts);
+    dropEventsBefore(retained_event_ts);
+  }
+}
+
 void LiveStream::updateEvents() {
   static double prev_speed = 1.0;
 
   if (first_update_ts == 0) {
     first_update_ts = nanos_since_boot();
-    first_event_ts = current_event_ts = all_events_.back()->mono_time;
+    first_event_ts = current_event_ts = lastest_event_ts;
   }
 
   if (paused_ || prev_speed != speed_) {
@@ -120,24 +187,20 @@ void LiveStream::updateEvents() {
   }
 
   uint64_t last_ts = post_last_event && speed_ == 1.0
-                       ? all_events_.back()->mono_time
+                       ? lastest_event_ts
                        : first_event_ts + (nanos_since_boot() - first_update_ts) * speed_;
-  auto first = std::upper_bound(all_events_.cbegin(), all_events_.cend(), current_event_ts, CompareCanEvent());
-  auto last = std::upper_bound(first, all_events_.cend(), last_ts, CompareCanEvent());
-
-  for (auto it = first; it != last; ++it) {
-    const CanEvent *e = *it;
-    MessageId id = {.source = e->src, .address = e->address};
-    updateEvent(id, (e->mono_time - begin_event_ts) / 1e9, e->dat, e->size);
-    current_event_ts = e->mono_time;
-  }
+  forEachEvent([this](const MessageId &id, const CanEvent &e) {
+    updateEvent(id, (e.mono_time - begin_event_ts) / 1e9, e.dat, e.size);
+    current_event_ts = e.mono_time;
+  }, current_event_ts, last_ts);
   emit privateUpdateLastMsgsSignal();
 }
 
 void LiveStream::seekTo(double sec) {
   sec = std::max(0.0, sec);
   first_update_ts = nanos_since_boot();
-  current_event_ts = first_event_ts = std::min<uint64_t>(sec * 1e9 + begin_event_ts, lastest_event_ts);
+  const uint64_t first_ts = std::max(retained_event_ts, begin_event_ts);
+  current_event_ts = first_event_ts = std::min<uint64_t>(std::max<uint64_t>(sec * 1e9 + begin_event_ts, first_ts), lastest_event_ts);
   post_last_event = (first_event_ts == lastest_event_ts);
   emit seekedTo((current_event_ts - begin_event_ts) / 1e9);
 }
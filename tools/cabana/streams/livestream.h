@@ -18,12 +18,18 @@ public:
   void stop();
   inline QDateTime beginDateTime() const { return begin_date_time; }
   inline uint64_t beginMonoTime() const override { return begin_event_ts; }
+  // Events before it were dropped from the cache
+  double minSeconds() const override { return toSeconds(std::max(retained_event_ts, begin_event_ts)); }
   double maxSeconds() const override { return std::max(1.0, (lastest_event_ts - begin_event_ts) / 1e9); }
   void setSpeed(float speed) override { speed_ = speed; }
   double getSpeed() override { return speed_; }
   bool isPaused() const override { return paused_; }
   void pause(bool pause) override;
   void seekTo(double sec) override;
+  bool logging() const { return logger != nullptr; }
+  // Frames waiting to be written to the log, and frames it lost because the writer fell behind
+  size_t logBacklog() const;
+  uint64_t droppedLogFrames() const;
 
 protected:
   virtual void streamThread() = 0;
@@ -33,10 +39,11 @@ private:
   void startUpdateTimer();
   void timerEvent(QTimerEvent *event) override;
   void updateEvents();
+  void dropExpiredEvents();
 
   std::mutex lock;
   QThread *stream_thread;
-  std::vector<const CanEvent *> received_events_;
+  MessageEventsMap received_events_;
 
   int timer_id;
   QBasicTimer update_timer;
@@ -44,6 +51,7 @@ private:
   QDateTime begin_date_time;
   uint64_t begin_event_ts = 0;
   uint64_t lastest_event_ts = 0;
+  uint64_t retained_event_ts = 0;
   uint64_t current_event_ts = 0;
   uint64_t first_event_ts = 0;
   uint64_t first_update_ts = 0;
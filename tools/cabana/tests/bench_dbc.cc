@@ -0,0 +1,241 @@
+// DBC parsing benchmark on the opendbc corpus. Compares DBCFile with the QRegularExpression parser
+// it used before, and DBCManager opening all files at once. Results are printed as JSON.
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QRegularExpression>
+#include <QTextStream>
+
+#include "tools/cabana/dbc/dbcmanager.h"
+
+namespace {
+
+// The previous QRegularExpression parser, as DBCFile had it before the tokenizer. It builds the same
+// messages and signals, so the two are compared for the same work.
+class LegacyDBCFile {
+public:
+  explicit LegacyDBCFile(const QString &content) { parse(content); }
+  const std::map<uint32_t, cabana::Msg> &getMessages() const { return msgs; }
+
+private:
+  cabana::Signal *signal(uint32_t address, const QString &name) {
+    auto it = msgs.find(address);
+    return it != msgs.end() ? (cabana::Signal *)it->second.sig(name) : nullptr;
+  }
+
+  void parse(const QString &content) {
+    cabana::Msg *current_msg = nullptr;
+    int multiplexor_cnt = 0;
+    QTextStream stream((QString *)&content);
+    while (!stream.atEnd()) {
+      QString raw_line = stream.readLine();
+      QString line = raw_line.trimmed();
+      if (line.startsWith("BO_ ")) {
+        multiplexor_cnt = 0;
+        current_msg = parseBO(line);
+      } else if (line.startsWith("SG_ ")) {
+        parseSG(line, current_msg, multiplexor_cnt);
+      } else if (line.startsWith("VAL_ ")) {
+        parseVAL(line);
+      } else if (line.startsWith("CM_ BO_")) {
+        parseCM_BO(line, content, raw_line, stream);
+      } else if (line.startsWith("CM_ SG_ ")) {
+        parseCM_SG(line, content, raw_line, stream);
+      }
+    }
+    for (auto &[_, m] : msgs) {
+      m.update();
+    }
+  }
+
+  cabana::Msg *parseBO(const QString &line) {
+    static QRegularExpression bo_regexp(R"(^BO_ (?<address>\w+) (?<name>\w+) *: (?<size>\w+) (?<transmitter>\w+))");
+    QRegularExpressionMatch match = bo_regexp.match(line);
+    if (!match.hasMatch()) throw std::runtime_error("Invalid BO_ line format");
+
+    uint32_t address = match.captured("address").toUInt();
+    if (msgs.count(address) > 0) throw std::runtime_error("Duplicate message address");
+
+    cabana::Msg *msg = &msgs[address];
+    msg->address = address;
+    msg->name = match.captured("name");
+    msg->size = match.captured("size").toULong();
+    msg->transmitter = match.captured("transmitter").trimmed();
+    return msg;
+  }
+
+  void parseSG(const QString &line, cabana::Msg *current_msg, int &multiplexor_cnt) {
+    static QRegularExpression sg_regexp(R"(^SG_ (\w+) *: (\d+)\|(\d+)@(\d+)([\+|\-]) \(([0-9.+\-eE]+),([0-9.+\-eE]+)\) \[([0-9.+\-eE]+)\|([0-9.+\-eE]+)\] \"(.*)\" (.*))");
+    static QRegularExpression sgm_regexp(R"(^SG_ (\w+) (\w+) *: (\d+)\|(\d+)@(\d+)([\+|\-]) \(([0-9.+\-eE]+),([0-9.+\-eE]+)\) \[([0-9.+\-eE]+)\|([0-9.+\-eE]+)\] \"(.*)\" (.*))");
+    if (!current_msg) throw std::runtime_error("No Message");
+
+    int offset = 0;
+    auto match = sg_regexp.match(line);
+    if (!match.hasMatch()) {
+      match = sgm_regexp.match(line);
+      offset = 1;
+    }
+    if (!match.hasMatch()) throw std::runtime_error("Invalid SG_ line format");
+
+    QString name = match.captured(1);
+    if (current_msg->sig(name) != nullptr) throw std::runtime_error("Duplicate signal name");
+
+    cabana::Signal s{};
+    if (offset == 1) {
+      auto indicator = match.captured(2);
+      if (indicator == "M") {
+        if (++multiplexor_cnt >= 2) throw std::runtime_error("Multiple multiplexor");
+        s.type = cabana::Signal::Type::Multiplexor;
+      } else {
+        s.type = cabana::Signal::Type::Multiplexed;
+        s.multiplex_value = indicator.mid(1).toInt();
+      }
+    }
+    s.name = name;
+    s.start_bit = match.captured(offset + 2).toInt();
+    s.size = match.captured(offset + 3).toInt();
+    s.is_little_endian = match.captured(offset + 4).toInt() == 1;
+    s.is_signed = match.captured(offset + 5) == "-";
+    s.factor = match.captured(offset + 6).toDouble();
+    s.offset = match.captured(offset + 7).toDouble();
+    s.min = match.captured(8 + offset).toDouble();
+    s.max = match.captured(9 + offset).toDouble();
+    s.unit = match.captured(10 + offset);
+    s.receiver_name = match.captured(11 + offset).trimmed();
+    current_msg->sigs.push_back(new cabana::Signal(s));
+  }
+
+  static QString commentLine(const QString &line, const QString &content, const QString &raw_line, const QTextStream &stream) {
+    if (line.endsWith("\";")) return line;
+    int pos = stream.pos() - raw_line.length() - 1;
+    return content.mid(pos, content.indexOf("\";", pos));
+  }
+
+  void parseCM_BO(const QString &line, const QString &content, const QString &raw_line, const QTextStream &stream) {
+    static QRegularExpression msg_comment_regexp(R"(^CM_ BO_ *(?<address>\w+) *\"(?<comment>(?:[^"\\]|\\.)*)\"\s*;)");
+    auto match = msg_comment_regexp.match(commentLine(line, content, raw_line, stream));
+    if (!match.hasMatch()) throw std::runtime_error("Invalid message comment format");
+
+    if (auto it = msgs.find(match.captured("address").toUInt()); it != msgs.end())
+      it->second.comment = match.captured("comment").trimmed().replace("\\\"", "\"");
+  }
+
+  void parseCM_SG(const QString &line, const QString &content, const QString &raw_line, const QTextStream &stream) {
+    static QRegularExpression sg_comment_regexp(R"(^CM_ SG_ *(\w+) *(\w+) *\"((?:[^"\\]|\\.)*)\"\s*;)");
+    auto match = sg_comment_regexp.match(commentLine(line, content, raw_line, stream));
+    if (!match.hasMatch()) throw std::runtime_error("Invalid CM_ SG_ line format");
+
+    if (auto s = signal(match.captured(1).toUInt(), match.captured(2)))
+      s->comment = match.captured(3).trimmed().replace("\\\"", "\"");
+  }
+
+  void parseVAL(const QString &line) {
+    static QRegularExpression val_regexp(R"(VAL_ (\w+) (\w+) (\s*[-+]?[0-9]+\s+\".+?\"[^;]*))");
+    auto match = val_regexp.match(line);
+    if (!match.hasMatch()) throw std::runtime_error("invalid VAL_ line format");
+
+    if (auto s = signal(match.captured(1).toUInt(), match.captured(2))) {
+      QStringList desc_list = match.captured(3).trimmed().split('"');
+      for (int i = 0; i < desc_list.size(); i += 2) {
+        auto val = desc_list[i].trimmed();
+        if (!val.isEmpty() && (i + 1) < desc_list.size()) {
+          s->val_desc.push_back({val.toDouble(), desc_list[i + 1].trimmed()});
+        }
+      }
+    }
+  }
+
+  std::map<uint32_t, cabana::Msg> msgs;
+};
+
+template <class F>
+double bestOf(int iterations, F f) {
+  double best = 1e9;
+  for (int i = 0; i < iterations; ++i) {
+    QElapsedTimer timer;
+    timer.start();
+    f();
+    best = std::min(best, timer.nsecsElapsed() / 1e6);
+  }
+  return best;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  QCoreApplication app(argc, argv);
+  QCommandLineParser cmd_parser;
+  cmd_parser.addHelpOption();
+  cmd_parser.addOption({"dir", "directory of DBC files", "dir", OPENDBC_FILE_PATH});
+  cmd_parser.addOption({{"n", "iterations"}, "runs of each benchmark, the best is reported", "n", "5"});
+  cmd_parser.process(app);
+
+  QDir dir(cmd_parser.value("dir"));
+  const int iterations = std::max(1, cmd_parser.value("n").toInt());
+  QStringList files;
+  qint64 total_bytes = 0;
+  std::vector<QString> contents;
+  for (const auto &fn : dir.entryList({"*.dbc"}, QDir::Files, QDir::Name)) {
+    QFile file(dir.filePath(fn));
+    if (file.open(QIODevice::ReadOnly)) {
+      files.push_back(dir.filePath(fn));
+      contents.push_back(file.readAll());
+      total_bytes += file.size();
+    }
+  }
+  if (files.isEmpty()) {
+    fprintf(stderr, "no DBC files in %s\n", qPrintable(dir.path()));
+    return 1;
+  }
+
+  size_t messages = 0, signals_count = 0;
+  for (const auto &fn : files) {
+    DBCFile dbc(fn);
+    messages += dbc.getMessages().size();
+    for (const auto &[_, m] : dbc.getMessages()) signals_count += m.sigs.size();
+  }
+
+  size_t legacy_signals = 0;
+  for (const auto &content : contents) {
+    LegacyDBCFile dbc(content);
+    for (const auto &[_, m] : dbc.getMessages()) legacy_signals += m.sigs.size();
+  }
+  if (legacy_signals != signals_count) {
+    fprintf(stderr, "the parsers disagree: %zu signals, %zu with the legacy parser\n", signals_count, legacy_signals);
+    return 1;
+  }
+
+  const double legacy_ms = bestOf(iterations, [&]() {
+    for (const auto &content : contents) LegacyDBCFile dbc(content);
+  });
+  const double parse_ms = bestOf(iterations, [&]() {
+    for (const auto &content : contents) DBCFile("", content);
+  });
+  const double load_ms = bestOf(iterations, [&]() {
+    for (const auto &fn : files) DBCFile dbc(fn);
+  });
+  const double open_ms = bestOf(iterations, [&]() {
+    DBCManager manager(nullptr);
+    std::vector<std::pair<SourceSet, QString>> dbc_files;
+    for (int i = 0; i < files.size(); ++i) dbc_files.push_back({{i}, files[i]});
+    manager.open(dbc_files);
+  });
+
+  printf("{\n");
+  printf("  \"files\": %d, \"bytes\": %lld, \"messages\": %zu, \"signals\": %zu,\n", (int)files.size(), total_bytes, messages, signals_count);
+  printf("  \"legacy_regex_ms\": %.2f,\n", legacy_ms);
+  printf("  \"parse_ms\": %.2f,\n", parse_ms);
+  printf("  \"load_files_ms\": %.2f,\n", load_ms);
+  printf("  \"manager_open_parallel_ms\": %.2f,\n", open_ms);
+  printf("  \"parse_mb_per_s\": %.1f\n", total_bytes / 1e3 / parse_ms);
+  printf("}\n");
+  return 0;
+}
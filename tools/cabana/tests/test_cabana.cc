@@ -1,9 +1,15 @@
 
 #undef INFO
+#include <limits>
+#include <map>
+#include <random>
+
 #include <QDir>
 
 #include "catch2/catch.hpp"
 #include "tools/cabana/dbc/dbcmanager.h"
+#include "tools/cabana/streams/abstractstream.h"
+#include "tools/cabana/tools/findsignal.h"
 
 const std::string TEST_RLOG_URL = "https://commadataci.blob.core.windows.net/openpilotci/0c94aa1e1296d7c6/2021-05-05--19-48-37/0/rlog.bz2";
 
@@ -154,4 +160,292 @@ TEST_CASE("parse_opendbc") {
   }
   INFO(errors.join("\n").toStdString());
   REQUIRE(errors.empty());
+
+  // all files at once, parsed in parallel
+  DBCManager manager(nullptr);
+  std::vector<std::pair<SourceSet, QString>> files;
+  for (auto fn : dir.entryList({"*.dbc"}, QDir::Files, QDir::Name)) {
+    files.push_back({{(int)files.size()}, dir.filePath(fn)});
+  }
+  QString error;
+  REQUIRE(manager.open(files, &error));
+  REQUIRE(manager.dbcCount() == (int)files.size());
+
+  // a file listed twice is parsed once and shared
+  DBCManager shared_manager(nullptr);
+  REQUIRE(shared_manager.open({{{0}, files[0].second}, {{1}, files[0].second}}, &error));
+  REQUIRE(shared_manager.dbcCount() == 1);
+  REQUIRE(shared_manager.findDBCFile(0) == shared_manager.findDBCFile(1));
+}
+
+TEST_CASE("parse_dbc - CRLF and multiple line comments") {
+  QString content = "VERSION \"\"\r\n\r\n"
+                    "BO_ 2147483904 message_1: 64 Vector__XXX\r\n"
+                    " SG_ signal_1 : 7|16@0- (0.01,-1E+2) [-1.5e3|2.5E-3] \"a\"b\" Vector__XXX\r\n"
+                    "CM_ SG_ 2147483904 signal_1 \"two\r\nlines\";\r\n"
+                    "VAL_ 2147483904 signal_1 -1 \"negative\" 3 \"three\" ;\r\n";
+  DBCFile file("", content);
+  auto msg = file.msg(2147483904);
+  REQUIRE(msg != nullptr);
+  REQUIRE(msg->size == 64);
+  auto sig = msg->sigs[0];
+  REQUIRE(sig->is_signed);
+  REQUIRE(!sig->is_little_endian);
+  REQUIRE(sig->factor == 0.01);
+  REQUIRE(sig->offset == -100);
+  REQUIRE(sig->min == -1.5e3);
+  REQUIRE(sig->max == 2.5e-3);
+  REQUIRE(sig->unit == "a\"b");
+  REQUIRE(sig->comment == "two\r\nlines");
+  REQUIRE(sig->val_desc.size() == 2);
+  REQUIRE(sig->val_desc[0] == std::pair<double, QString>{-1, "negative"});
+  REQUIRE(file.generateDBC().startsWith("VERSION \"\"\n\n"));
+
+  // line numbers count the lines of a comment
+  QString error;
+  try {
+    DBCFile("", "CM_ BO_ 1 \"a\nb\";\nBO_ 1 message_1 8 XXX\n");
+  } catch (std::exception &e) {
+    error = e.what();
+  }
+  REQUIRE(error == "[:3]Invalid BO_ line format: BO_ 1 message_1 8 XXX");
+}
+
+TEST_CASE("SignalDecoder") {
+  std::mt19937 rng(0);
+  const int stride = 8, count = 100;
+  std::vector<uint8_t> data(stride * count), sizes(count, stride);
+  for (auto &b : data) b = rng();
+  // some short frames
+  for (int i = 0; i < count; i += 7) {
+    sizes[i] = 3;
+    std::fill_n(data.begin() + i * stride + 3, stride - 3, 0);
+  }
+
+  cabana::Signal mux;
+  mux.start_bit = 0;
+  mux.size = 2;
+  mux.is_signed = false;
+  mux.is_little_endian = true;
+  updateMsbLsb(mux);
+  for (bool little_endian : {true, false}) {
+    for (bool is_signed : {true, false}) {
+      for (int size : {1, 7, 12, 33, 57}) {
+        for (int start_bit = 0; start_bit < stride * 8; start_bit += 5) {
+          cabana::Signal sig;
+          sig.start_bit = start_bit;
+          sig.size = size;
+          sig.factor = 0.5;
+          sig.offset = -3;
+          sig.is_signed = is_signed;
+          sig.is_little_endian = little_endian;
+          updateMsbLsb(sig);
+          if (sig.lsb < 0 || sig.msb < 0 || sig.msb / 8 >= stride || sig.lsb / 8 >= stride) continue;
+          sig.multiplexor = start_bit % 2 ? &mux : nullptr;
+          sig.multiplex_value = 1;
+
+          std::vector<double> values(count);
+          std::vector<uint8_t> valid(count);
+          cabana::SignalDecoder decoder(sig);
+          decoder.decode(data.data(), stride, sizes.data(), count, values.data(), valid.data());
+          for (int i = 0; i < count; ++i) {
+            double expected = 0;
+            bool expected_valid = sig.getValue(&data[i * stride], sizes[i], &expected);
+            REQUIRE(valid[i] == expected_valid);
+            if (expected_valid) REQUIRE(values[i] == expected);
+          }
+        }
+      }
+    }
+  }
+}
+
+// A stream serving a fixed set of events
+class TestStream : public DummyStream {
+public:
+  TestStream(QObject *parent, const MessageEventsMap &events) : DummyStream(parent) {
+    mergeEvents(events);
+    for (const auto &[id, e] : events) updateEvent(id, 0, e.back().dat, e.back().size);
+    emit privateUpdateLastMsgsSignal();
+    QCoreApplication::processEvents();
+  }
+};
+
+TEST_CASE("SignalSearch") {
+  std::mt19937 rng(0);
+  const MessageId id = {.source = 0, .address = 0x100};
+  const int stride = 8, count = 150, min_size = 1, max_size = 16;
+  MessageEventsMap events_map;
+  auto &events = events_map[id];
+  for (int i = 0; i < count; ++i) {
+    uint8_t dat[stride];
+    for (auto &b : dat) b = std::array<uint8_t, 5>{0x00, 0x01, 0x80, 0xff, (uint8_t)rng()}[rng() % 5];
+    // Some frames are shorter than the stride, the last one has all bytes
+    const uint8_t size = (i % 7 == 3) ? rng() % stride : stride;
+    events.append(100 + i * 10, dat, size);
+  }
+  QObject parent;
+  TestStream stream(&parent, events_map);
+  can = &stream;
+
+  // Match times of a candidate in each step, found one event at a time. Empty if it was dropped.
+  auto reference = [&](const cabana::Signal &sig, const std::vector<SignalSearch::Condition> &conds) {
+    std::vector<uint64_t> times;
+    uint64_t prev_time = 0;
+    for (const auto &cond : conds) {
+      auto it = std::find_if(events.upperBound(prev_time), events.end(), [&](const CanEvent &e) {
+        return cond.test(get_raw_value(e.dat, e.size, sig));
+      });
+      if (it == events.end()) return std::vector<uint64_t>{};
+      times.push_back(prev_time = it->mono_time);
+    }
+    return times;
+  };
+  auto check = [&](const SignalSearch &search, const cabana::Signal &sig, const std::vector<SignalSearch::Condition> &conds) {
+    std::map<std::pair<int, int>, std::vector<uint64_t>> found;
+    for (uint32_t c : search.results(std::numeric_limits<size_t>::max())) {
+      REQUIRE(search.id(c) == id);
+      const auto s = search.signal(c);
+      auto &times = found[{s.start_bit, s.size}];
+      for (const auto &[mono_time, _] : search.history(c)) times.push_back(mono_time);
+    }
+    REQUIRE(search.steps() == conds.size());
+    REQUIRE(search.matches() == found.size());
+    for (int size = min_size; size <= max_size; ++size) {
+      for (int start_bit = 0; start_bit <= stride * 8 - size; ++start_bit) {
+        cabana::Signal s = sig;
+        s.start_bit = start_bit;
+        s.size = size;
+        updateMsbLsb(s);
+        const auto expected = reference(s, conds);
+        auto it = found.find({start_bit, size});
+        INFO("start_bit " << start_bit << " size " << size);
+        REQUIRE((it != found.end()) == !expected.empty());
+        if (it != found.end()) REQUIRE(it->second == expected);
+      }
+    }
+  };
+
+  for (bool little_endian : {true, false}) {
+    for (bool is_signed : {true, false}) {
+      for (double factor : {1.0, -0.5}) {
+        cabana::Signal sig;
+        sig.is_little_endian = little_endian;
+        sig.is_signed = is_signed;
+        sig.factor = factor;
+        sig.offset = factor < 0 ? 3 : 0;
+        // Each op in the first step, followed by a random one
+        for (int op = 0; op <= (int)SignalSearch::Op::Between; ++op) {
+          SignalSearch search;
+          search.init({id}, min_size, max_size, sig, 0, std::numeric_limits<uint64_t>::max());
+          std::vector<SignalSearch::Condition> conds;
+          for (int step = 0; step < 2; ++step) {
+            SignalSearch::Condition cond;
+            cond.op = (SignalSearch::Op)(step == 0 ? op : rng() % 7);
+            cond.v1 = ((int)(rng() % 5) - 2) * factor + sig.offset;
+            cond.v2 = cond.v1 + (rng() % 4) * std::abs(factor);
+            conds.push_back(cond);
+            search.search(cond);
+            check(search, sig, conds);
+          }
+          search.undo();
+          conds.pop_back();
+          check(search, sig, conds);
+        }
+      }
+    }
+  }
+  can = nullptr;
+}
+
+TEST_CASE("MessageEvents::eraseBefore") {
+  MessageEvents events;
+  for (uint8_t i = 0; i < 10; ++i) {
+    const uint8_t dat[] = {i, uint8_t(i + 1)};
+    events.append(i * 100, dat, i % 2 ? 2 : 1);
+  }
+  REQUIRE(events.eraseBefore(0) == 0);
+  REQUIRE(events.eraseBefore(350) == 4);
+  REQUIRE(events.size() == 6);
+  REQUIRE(events.bytes() == 6 * (sizeof(uint64_t) + 1 + 2));
+  for (size_t i = 0; i < events.size(); ++i) {
+    const CanEvent e = events[i];
+    REQUIRE(e.mono_time == (i + 4) * 100);
+    REQUIRE(e.size == ((i + 4) % 2 ? 2 : 1));
+    REQUIRE(e.dat[0] == i + 4);
+  }
+  REQUIRE(events.lowerBound(600).index() == 2);
+  REQUIRE(events.eraseBefore(10000) == 6);
+  REQUIRE(events.empty());
+}
+
+TEST_CASE("MinMaxPyramid") {
+  std::mt19937 rng(0);
+  auto random_point = [&](std::vector<QPointF> &pts) {
+    const double y = std::array<double, 4>{0, -1.5, 1e3, double(rng() % 100)}[rng() % 4];
+    pts.emplace_back(pts.empty() ? 0 : pts.back().x() + 1 + rng() % 3, y);
+  };
+  auto check = [&](const std::vector<QPointF> &pts, const MinMaxPyramid &pyramid) {
+    auto brute_minmax = [&](size_t lo, size_t hi) {
+      auto [min, max] = std::minmax_element(pts.begin() + lo, pts.begin() + hi,
+                                            [](auto &a, auto &b) { return a.y() < b.y(); });
+      return std::pair{min->y(), max->y()};
+    };
+    for (int i = 0; i < 50; ++i) {
+      size_t lo = rng() % pts.size(), hi = lo + 1 + rng() % (pts.size() - lo);
+      INFO("size " << pts.size() << " range " << lo << "-" << hi);
+      REQUIRE(pyramid.minmax(pts, lo, hi) == brute_minmax(lo, hi));
+    }
+
+    for (int i = 0; i < 20; ++i) {
+      const double min_x = rng() % (int)(pts.back().x() + 2), max_x = min_x + rng() % (int)(pts.back().x() + 2);
+      const int max_points = 4 + rng() % 60;
+      std::vector<QPointF> out;
+      pyramid.sample(pts, min_x, max_x, max_points, out);
+      INFO("size " << pts.size() << " x " << min_x << "-" << max_x << " max_points " << max_points);
+
+      // The range with one point beyond each end
+      auto x_less = [](const QPointF &p, double x) { return p.x() < x; };
+      size_t lo = std::lower_bound(pts.begin(), pts.end(), min_x, x_less) - pts.begin();
+      size_t hi = std::lower_bound(pts.begin() + lo, pts.end(), max_x, x_less) - pts.begin();
+      lo = lo > 0 ? lo - 1 : 0;
+      hi = std::min(hi + 1, pts.size());
+      if (hi - lo <= max_points) {
+        REQUIRE(out == std::vector<QPointF>(pts.begin() + lo, pts.begin() + hi));
+        continue;
+      }
+
+      // A subset in order that spans the range, with the same envelope as the points it spans
+      REQUIRE(out.size() <= max_points + 8);
+      std::vector<size_t> idx;
+      for (const auto &p : out) {
+        auto it = std::lower_bound(pts.begin(), pts.end(), p.x(), x_less);
+        REQUIRE((it != pts.end() && *it == p));
+        idx.push_back(it - pts.begin());
+      }
+      REQUIRE(std::is_sorted(idx.begin(), idx.end()));
+      REQUIRE(std::adjacent_find(idx.begin(), idx.end()) == idx.end());
+      REQUIRE(idx.front() <= lo);
+      REQUIRE(idx.back() >= hi - 1);
+      auto [min, max] = std::minmax_element(out.begin(), out.end(), [](auto &a, auto &b) { return a.y() < b.y(); });
+      REQUIRE(std::pair{min->y(), max->y()} == brute_minmax(idx.front(), idx.back() + 1));
+    }
+  };
+
+  for (int size : {1, 2, 3, 7, 64, 65, 100, 1000, 1 + (int)(rng() % 5000)}) {
+    std::vector<QPointF> pts;
+    while (pts.size() < size) random_point(pts);
+    MinMaxPyramid pyramid;
+    pyramid.build(pts);
+    check(pts, pyramid);
+
+    // Live updates change the last point and append new ones
+    for (int i = 0; i < 5; ++i) {
+      const size_t prev_size = pts.size();
+      pts.back().setY(std::array<double, 2>{-1e3, 1e4}[rng() % 2]);
+      for (int n = rng() % 70; n > 0; --n) random_point(pts);
+      pyramid.update(pts, prev_size - 1);
+      check(pts, pyramid);
+    }
+  }
 }
@@ -8,6 +8,348 @@
 #include <QTimer>
 #include <QVBoxLayout>
 
+// SignalSearch
+
+namespace {
+
+constexpr size_t MAX_CACHED_PLANES = 256 * 1024 * 1024;
+constexpr uint64_t NO_MATCH = std::numeric_limits<uint64_t>::max();
+
+// Raw values in [lo, hi], or outside of it if negate
+struct RawRange {
+  int64_t lo = std::numeric_limits<int64_t>::min();
+  int64_t hi = std::numeric_limits<int64_t>::max();
+  bool negate = false;
+};
+
+// Narrows `r` to the raw values where `pred` holds. pred must be monotonic in the raw value, which
+// is the case for comparing raw * factor + offset against a constant, as double rounding is monotonic.
+template <class Pred>
+void narrow(RawRange &r, Pred pred) {
+  constexpr int64_t min = std::numeric_limits<int64_t>::min(), max = std::numeric_limits<int64_t>::max();
+  const bool at_min = pred(min), at_max = pred(max);
+  if (at_min && at_max) return;
+  if (!at_min && !at_max) {
+    r.lo = max;
+    r.hi = min;
+    return;
+  }
+  // The first raw value where pred differs from pred(min)
+  int64_t lo = min, hi = max;
+  while (lo < hi) {
+    int64_t mid = (int64_t)((uint64_t)lo + ((uint64_t)hi - (uint64_t)lo) / 2);
+    if (pred(mid) != at_min) hi = mid;
+    else lo = mid + 1;
+  }
+  if (at_max) r.lo = std::max(r.lo, lo);
+  else r.hi = std::min(r.hi, lo - 1);
+}
+
+// The comparison on values turned into one on raw values, so it needs no decoding
+RawRange rawRange(const SignalSearch::Condition &cond, double factor, double offset) {
+  using Op = SignalSearch::Op;
+  auto value = [=](int64_t raw) { return raw * factor + offset; };
+  const double v1 = cond.v1, v2 = cond.v2;
+  RawRange r;
+  switch (cond.op) {
+    case Op::Equal:
+    case Op::NotEqual:
+      narrow(r, [&](int64_t raw) { return value(raw) >= v1; });
+      narrow(r, [&](int64_t raw) { return value(raw) <= v1; });
+      r.negate = cond.op == Op::NotEqual;
+      break;
+    case Op::Greater: narrow(r, [&](int64_t raw) { return value(raw) > v1; }); break;
+    case Op::GreaterEqual: narrow(r, [&](int64_t raw) { return value(raw) >= v1; }); break;
+    case Op::Less: narrow(r, [&](int64_t raw) { return value(raw) < v1; }); break;
+    case Op::LessEqual: narrow(r, [&](int64_t raw) { return value(raw) <= v1; }); break;
+    case Op::Between:
+      narrow(r, [&](int64_t raw) { return value(raw) >= v1; });
+      narrow(r, [&](int64_t raw) { return value(raw) <= v2; });
+      break;
+  }
+  return r;
+}
+
+// Payload bit (byte * 8 + bit) of each bit of the raw value, lsb first.
+// Returns false if the field does not lie within total_bits.
+bool fieldBits(const cabana::Signal &sig, int total_bits, uint16_t *pos) {
+  int p = sig.lsb;
+  for (int i = 0; i < sig.size; ++i) {
+    if (p < 0 || p >= total_bits) return false;
+    pos[i] = p;
+    // Big endian fields continue at bit 0 of the previous byte
+    p += (!sig.is_little_endian && p % 8 == 7) ? -15 : 1;
+  }
+  return true;
+}
+
+// Index of the first event at or after `from` whose field, read msb first from `planes` and
+// biased to unsigned, lies in [lo, hi] (outside of it if negate), or NO_MATCH.
+// Every word of the planes compares 64 events at once. Events without a bit in `full` are too
+// short to hold the whole field, and are checked one at a time with test_short instead.
+// With size 0, every event lies in the range.
+template <class TestShort>
+uint64_t findFirst(const uint64_t *const *planes, int size, bool flip_msb, uint64_t lo, uint64_t hi, bool negate,
+                   const uint64_t *full, TestShort test_short, size_t from, size_t count) {
+  const size_t words = (count + 63) / 64;
+  for (size_t w = from / 64; w < words; ++w) {
+    uint64_t in_range = ~0ULL;
+    if (w == from / 64) in_range &= ~0ULL << (from % 64);
+    if (w == words - 1 && count % 64) in_range &= (1ULL << (count % 64)) - 1;
+
+    uint64_t gt = 0, ge_eq = ~0ULL, lt = 0, le_eq = ~0ULL;
+    for (int i = size - 1; i >= 0 && (ge_eq | le_eq); --i) {
+      const uint64_t x = (i == size - 1 && flip_msb) ? ~planes[i][w] : planes[i][w];
+      if ((lo >> i) & 1) {
+        ge_eq &= x;
+      } else {
+        gt |= ge_eq & x;
+        ge_eq &= ~x;
+      }
+      if ((hi >> i) & 1) {
+        lt |= le_eq & ~x;
+        le_eq &= x;
+      } else {
+        le_eq &= ~x;
+      }
+    }
+    uint64_t m = (gt | ge_eq) & (lt | le_eq);
+    if (negate) m = ~m;
+    m &= in_range;
+    if (full) {
+      m &= full[w];
+      for (uint64_t short_events = ~full[w] & in_range; short_events; short_events &= short_events - 1) {
+        if (test_short(w * 64 + __builtin_ctzll(short_events))) m |= short_events & -short_events;
+      }
+    }
+    if (m) return w * 64 + __builtin_ctzll(m);
+  }
+  return NO_MATCH;
+}
+
+}  // namespace
+
+bool SignalSearch::Condition::test(double v) const {
+  switch (op) {
+    case Op::Equal: return v == v1;
+    case Op::Greater: return v > v1;
+    case Op::GreaterEqual: return v >= v1;
+    case Op::NotEqual: return v != v1;
+    case Op::Less: return v < v1;
+    case Op::LessEqual: return v <= v1;
+    case Op::Between: return v >= v1 && v <= v2;
+  }
+  return false;
+}
+
+uint32_t SignalSearch::Step::indexOf(uint32_t c) const {
+  const size_t w = c / 64;
+  return rank[w] + __builtin_popcountll(alive[w] & ((1ULL << (c % 64)) - 1));
+}
+
+void SignalSearch::init(const std::vector<MessageId> &ids, int min_size, int max_size, const cabana::Signal &sig,
+                        uint64_t first_time, uint64_t last_time) {
+  clear();
+  sig_ = sig;
+  first_time_ = first_time;
+  last_time_ = last_time;
+  for (const auto &id : ids) {
+    const auto &events = can->events(id);
+    if (events.lowerBound(first_time) == events.cend()) continue;
+
+    Message &m = messages_.emplace_back();
+    m.id = id;
+    m.total_bits = std::min<int>(can->lastMessage(id).dat.size(), events.stride()) * 8;
+    m.first_candidate = candidates_.size();
+    for (int size = min_size; size <= max_size; ++size) {
+      for (int start = 0; start <= m.total_bits - size; ++start) {
+        candidates_.push_back({(uint32_t)(messages_.size() - 1), (uint16_t)start, (uint8_t)size});
+      }
+    }
+    m.last_candidate = candidates_.size();
+  }
+
+  // Every candidate starts alive
+  Step &step = steps_.emplace_back();
+  step.count = candidates_.size();
+  step.alive.assign((step.count + 63) / 64, ~0ULL);
+  if (step.count % 64) step.alive.back() = (1ULL << (step.count % 64)) - 1;
+  step.rank.resize(step.alive.size());
+  for (size_t w = 0; w < step.rank.size(); ++w) step.rank[w] = w * 64;
+}
+
+void SignalSearch::search(const Condition &cond) {
+  if (steps_.empty()) return;
+
+  // found[i] is the mono time of the match of the previous step's i-th candidate
+  std::vector<uint64_t> found(steps_.back().count, NO_MATCH);
+  QtConcurrent::blockingMap(messages_, [&](Message &m) { searchMessage(m, cond, found); });
+
+  const Step &prev = steps_.back();
+  Step step;
+  step.alive.assign(prev.alive.size(), 0);
+  step.rank.resize(prev.alive.size());
+  step.match_times.reserve(std::count_if(found.begin(), found.end(), [](auto t) { return t != NO_MATCH; }));
+  for (size_t w = 0, i = 0; w < prev.alive.size(); ++w) {
+    step.rank[w] = step.match_times.size();
+    for (uint64_t bits = prev.alive[w]; bits; bits &= bits - 1, ++i) {
+      if (found[i] != NO_MATCH) {
+        step.alive[w] |= bits & -bits;
+        step.match_times.push_back(found[i]);
+      }
+    }
+  }
+  step.count = step.match_times.size();
+  steps_.push_back(std::move(step));
+}
+
+void SignalSearch::searchMessage(Message &m, const Condition &cond, std::vector<uint64_t> &found) {
+  const Step &prev = steps_.back();
+  const size_t first_word = m.first_candidate / 64, last_word = (m.last_candidate + 63) / 64;
+  auto alive = [&](size_t w) {
+    uint64_t bits = prev.alive[w];
+    if (w == first_word) bits &= ~0ULL << (m.first_candidate % 64);
+    if (w == m.last_candidate / 64) bits &= (1ULL << (m.last_candidate % 64)) - 1;
+    return bits;
+  };
+  bool any_alive = false;
+  for (size_t w = first_word; w < last_word && !any_alive; ++w) any_alive = alive(w) != 0;
+  if (!any_alive) return;
+
+  // Transpose the payloads within the time range into bit-planes, once per message while they fit the cache
+  const auto &events = can->events(m.id);
+  const size_t begin = events.upperBound(first_time_).index();
+  const size_t count = events.upperBound(last_time_).index() - begin;
+  std::shared_ptr<BitPlanes> planes = m.planes;
+  const uint64_t front_time = events.empty() ? 0 : events.front().mono_time;
+  if (!planes || planes->events_size != events.size() || planes->front_time != front_time ||
+      planes->begin != begin || planes->count != count) {
+    planes = std::make_shared<BitPlanes>();
+    planes->events_size = events.size();
+    planes->front_time = front_time;
+    planes->begin = begin;
+    planes->count = count;
+    planes->words = (count + 63) / 64;
+    planes->bits = events.bitPlanes(begin, begin + count, m.total_bits / 8);
+    // Shorter frames read as zero padded in the planes, so mark the bytes each event has
+    const int payload_bytes = m.total_bits / 8;
+    size_t i = 0;
+    while (i < count && events[begin + i].size >= payload_bytes) ++i;
+    if (i < count) {
+      planes->full.assign(payload_bytes * planes->words, 0);
+      for (i = 0; i < count; ++i) {
+        const int size = std::min<int>(events[begin + i].size, payload_bytes);
+        for (int b = 0; b < size; ++b) planes->full[b * planes->words + i / 64] |= 1ULL << (i % 64);
+      }
+    }
+    auto planes_bytes = [](const BitPlanes &p) { return (p.bits.size() + p.full.size()) * sizeof(uint64_t); };
+    const size_t bytes = planes_bytes(*planes);
+    const size_t cached = m.planes ? planes_bytes(*m.planes) : 0;
+    if (cached_bytes_ + bytes - cached <= MAX_CACHED_PLANES) {
+      cached_bytes_ += bytes - cached;
+      m.planes = planes;
+    }
+  }
+
+  const RawRange range = rawRange(cond, sig_.factor, sig_.offset);
+  const auto &mono_times = events.monoTimes();
+  uint16_t pos[64];
+  const uint64_t *bit_planes[64];
+  for (size_t w = first_word; w < last_word; ++w) {
+    for (uint64_t bits = alive(w); bits; bits &= bits - 1) {
+      const uint32_t c = w * 64 + __builtin_ctzll(bits);
+      const uint32_t idx = prev.indexOf(c);
+      const uint64_t prev_time = prev.match_times.empty() ? first_time_ : prev.match_times[idx];
+      const size_t from = events.upperBound(prev_time).index() - begin;
+      const cabana::Signal sig = signal(c);
+
+      uint64_t match = NO_MATCH;
+      if (fieldBits(sig, m.total_bits, pos)) {
+        // Clamp the range to the field's domain, signed fields are compared with their msb flipped
+        const bool as_signed = sig.is_signed || sig.size == 64;
+        const int64_t domain_min = as_signed ? (int64_t)(~0ULL << (sig.size - 1)) : 0;
+        const int64_t domain_max = as_signed ? ~domain_min : (int64_t)(~0ULL >> (64 - sig.size));
+        const int64_t lo = std::max(range.lo, domain_min), hi = std::min(range.hi, domain_max);
+        // The events having the field's last byte have all of it
+        const int last_byte = *std::max_element(pos, pos + sig.size) / 8;
+        const uint64_t *full = planes->full.empty() ? nullptr : planes->full.data() + last_byte * planes->words;
+        auto test_short = [&](size_t i) {
+          const auto e = events[begin + i];
+          return cond.test(get_raw_value(e.dat, e.size, sig));
+        };
+        if (lo > hi || (lo == domain_min && hi == domain_max)) {
+          // All events having the field match, or none does. Short ones may still differ.
+          const bool all = (lo <= hi) != range.negate;
+          if (!full) {
+            match = all && from < count ? from : NO_MATCH;
+          } else {
+            match = findFirst(bit_planes, 0, false, 0, 0, !all, full, test_short, from, count);
+          }
+        } else {
+          for (int i = 0; i < sig.size; ++i) bit_planes[i] = planes->bits.data() + pos[i] * planes->words;
+          match = findFirst(bit_planes, sig.size, as_signed, (uint64_t)lo - (uint64_t)domain_min,
+                            (uint64_t)hi - (uint64_t)domain_min, range.negate, full, test_short, from, count);
+        }
+      } else {
+        // Fields running off the payload are decoded one event at a time
+        for (size_t i = from; i < count && match == NO_MATCH; ++i) {
+          const auto e = events[begin + i];
+          if (cond.test(get_raw_value(e.dat, e.size, sig))) match = i;
+        }
+      }
+      if (match != NO_MATCH) found[idx] = mono_times[begin + match];
+    }
+  }
+}
+
+void SignalSearch::undo() {
+  if (steps_.size() > 2) {
+    steps_.pop_back();
+  } else {
+    clear();
+  }
+}
+
+void SignalSearch::clear() {
+  messages_.clear();
+  candidates_.clear();
+  steps_.clear();
+  cached_bytes_ = 0;
+}
+
+std::vector<uint32_t> SignalSearch::results(size_t max_count) const {
+  std::vector<uint32_t> ret;
+  if (steps() == 0) return ret;
+
+  const auto &alive = steps_.back().alive;
+  for (size_t w = 0; w < alive.size() && ret.size() < max_count; ++w) {
+    for (uint64_t bits = alive[w]; bits && ret.size() < max_count; bits &= bits - 1) {
+      ret.push_back(w * 64 + __builtin_ctzll(bits));
+    }
+  }
+  return ret;
+}
+
+cabana::Signal SignalSearch::signal(uint32_t c) const {
+  cabana::Signal sig = sig_;
+  sig.start_bit = candidates_[c].start_bit;
+  sig.size = candidates_[c].size;
+  updateMsbLsb(sig);
+  return sig;
+}
+
+std::vector<std::pair<uint64_t, double>> SignalSearch::history(uint32_t c) const {
+  std::vector<std::pair<uint64_t, double>> ret;
+  const auto &events = can->events(id(c));
+  const cabana::Signal sig = signal(c);
+  for (size_t i = 1; i < steps_.size(); ++i) {
+    const uint64_t mono_time = steps_[i].match_times[steps_[i].indexOf(c)];
+    auto e = events.lowerBound(mono_time);
+    ret.emplace_back(mono_time, e != events.cend() ? get_raw_value(e->dat, e->size, sig) : 0);
+  }
+  return ret;
+}
+
 // FindSignalModel
 
 QVariant FindSignalModel::headerData(int section, Qt::Orientation orientation, int role) const {
@@ -18,59 +360,45 @@ QVariant FindSignalModel::headerData(int section, Qt::Orientation orientation, i
 
 QVariant FindSignalModel::data(const QModelIndex &index, int role) const {
   if (role == Qt::DisplayRole) {
-    const auto &s = filtered_signals[index.row()];
+    const uint32_t c = rows[index.row()];
     switch (index.column()) {
-      case 0: return s.id.toString();
-      case 1: return QString("%1, %2").arg(s.sig.start_bit).arg(s.sig.size);
-      case 2: return s.values.join(" ");
+      case 0: return engine.id(c).toString();
+      case 1: {
+        const auto sig = engine.signal(c);
+        return QString("%1, %2").arg(sig.start_bit).arg(sig.size);
+      }
+      case 2: {
+        QStringList values;
+        for (const auto &[mono_time, value] : engine.history(c)) {
+          values += QString("(%1, %2)").arg(can->toSeconds(mono_time), 0, 'f', 3).arg(value);
+        }
+        return values.join(" ");
+      }
     }
   }
   return {};
 }
 
-void FindSignalModel::search(std::function<bool(double)> cmp) {
+void FindSignalModel::search(const SignalSearch::Condition &cond) {
   beginResetModel();
-
-  std::mutex lock;
-  const auto prev_sigs = !histories.isEmpty() ? histories.back() : initial_signals;
-  filtered_signals.clear();
-  filtered_signals.reserve(prev_sigs.size());
-  QtConcurrent::blockingMap(prev_sigs, [&](auto &s) {
-    const auto &events = can->events(s.id);
-    auto first = std::upper_bound(events.cbegin(), events.cend(), s.mono_time, CompareCanEvent());
-    auto last = events.cend();
-    if (last_time < std::numeric_limits<uint64_t>::max()) {
-      last = std::upper_bound(events.cbegin(), events.cend(), last_time, CompareCanEvent());
-    }
-
-    auto it = std::find_if(first, last, [&](const CanEvent *e) { return cmp(get_raw_value(e->dat, e->size, s.sig)); });
-    if (it != last) {
-      auto values = s.values;
-      values += QString("(%1, %2)").arg(can->toSeconds((*it)->mono_time), 0, 'f', 3).arg(get_raw_value((*it)->dat, (*it)->size, s.sig));
-      std::lock_guard lk(lock);
-      filtered_signals.push_back({.id = s.id, .mono_time = (*it)->mono_time, .sig = s.sig, .values = values});
-    }
-  });
-  histories.push_back(filtered_signals);
-
+  engine.search(cond);
+  rows = engine.results(300);
   endResetModel();
 }
 
 void FindSignalModel::undo() {
-  if (!histories.isEmpty()) {
+  if (engine.steps() > 0) {
     beginResetModel();
-    histories.pop_back();
-    filtered_signals.clear();
-    if (!histories.isEmpty()) filtered_signals = histories.back();
+    engine.undo();
+    rows = engine.results(300);
     endResetModel();
   }
 }
 
 void FindSignalModel::reset() {
   beginResetModel();
-  histories.clear();
-  filtered_signals.clear();
-  initial_signals.clear();
+  engine.clear();
+  rows.clear();
   endResetModel();
 }
 
@@ -163,7 +491,7 @@ FindSignalDlg::FindSignalDlg(QWidget *parent) : QDialog(parent, Qt::WindowFlags(
   QObject::connect(reset_btn, &QPushButton::clicked, model, &FindSignalModel::reset);
   QObject::connect(view, &QTableView::customContextMenuRequested, this, &FindSignalDlg::customMenuRequested);
   QObject::connect(view, &QTableView::doubleClicked, [this](const QModelIndex &index) {
-    if (index.isValid()) emit openMessage(model->filtered_signals[index.row()].id);
+    if (index.isValid()) emit openMessage(model->engine.id(model->rows[index.row()]));
   });
   QObject::connect(compare_cb, qOverload<int>(&QComboBox::currentIndexChanged), [=](int index) {
     to_label->setVisible(index == compare_cb->count() - 1);
@@ -172,27 +500,19 @@ FindSignalDlg::FindSignalDlg(QWidget *parent) : QDialog(parent, Qt::WindowFlags(
 }
 
 void FindSignalDlg::search() {
-  if (model->histories.isEmpty()) {
+  if (model->engine.steps() == 0) {
     setInitialSignals();
   }
-  auto v1 = value1->text().toDouble();
-  auto v2 = value2->text().toDouble();
-  std::function<bool(double)> cmp = nullptr;
-  switch (compare_cb->currentIndex()) {
-    case 0: cmp = [v1](double v) { return v == v1;}; break;
-    case 1: cmp = [v1](double v) { return v > v1;}; break;
-    case 2: cmp = [v1](double v) { return v >= v1;}; break;
-    case 3: cmp = [v1](double v) { return v != v1;}; break;
-    case 4: cmp = [v1](double v) { return v < v1;}; break;
-    case 5: cmp = [v1](double v) { return v <= v1;}; break;
-    case 6: cmp = [v1, v2](double v) { return v >= v1 && v <= v2;}; break;
-  }
+  SignalSearch::Condition cond;
+  cond.op = (SignalSearch::Op)compare_cb->currentIndex();
+  cond.v1 = value1->text().toDouble();
+  cond.v2 = value2->text().toDouble();
   properties_group->setEnabled(false);
   message_group->setEnabled(false);
   search_btn->setEnabled(false);
   stats_label->setVisible(false);
   search_btn->setText("Finding ....");
-  QTimer::singleShot(0, this, [=]() { model->search(cmp); });
+  QTimer::singleShot(0, this, [=]() { model->search(cond); });
 }
 
 void FindSignalDlg::setInitialSignals() {
@@ -218,42 +538,30 @@ void FindSignalDlg::setInitialSignals() {
   double last_time_val = last_time_edit->text().toDouble();
   auto [first_sec, last_sec] = std::minmax(first_time_val, last_time_val);
   uint64_t first_time = can->toMonoTime(first_sec);
-  model->last_time = std::numeric_limits<uint64_t>::max();
+  uint64_t last_time = std::numeric_limits<uint64_t>::max();
   if (last_sec > 0) {
-    model->last_time = can->toMonoTime(last_sec);
+    last_time = can->toMonoTime(last_sec);
   }
-  model->initial_signals.clear();
 
+  std::vector<MessageId> ids;
   for (const auto &[id, m] : can->lastMessages()) {
     if ((buses.isEmpty() || buses.contains(id.source)) && (addresses.isEmpty() || addresses.contains(id.address))) {
-      const auto &events = can->events(id);
-      auto e = std::lower_bound(events.cbegin(), events.cend(), first_time, CompareCanEvent());
-      if (e != events.cend()) {
-        const int total_size = m.dat.size() * 8;
-        for (int size = min_size->value(); size <= max_size->value(); ++size) {
-          for (int start = 0; start <= total_size - size; ++start) {
-            FindSignalModel::SearchSignal s{.id = id, .mono_time = first_time, .sig = sig};
-            s.sig.start_bit = start;
-            s.sig.size = size;
-            updateMsbLsb(s.sig);
-            s.value = get_raw_value((*e)->dat, (*e)->size, s.sig);
-            model->initial_signals.push_back(s);
-          }
-        }
-      }
+      ids.push_back(id);
     }
   }
+  model->engine.init(ids, min_size->value(), max_size->value(), sig, first_time, last_time);
 }
 
 void FindSignalDlg::modelReset() {
-  properties_group->setEnabled(model->histories.isEmpty());
-  message_group->setEnabled(model->histories.isEmpty());
-  search_btn->setText(model->histories.isEmpty() ? tr("Find") : tr("Find Next"));
-  reset_btn->setEnabled(!model->histories.isEmpty());
-  undo_btn->setEnabled(model->histories.size() > 1);
-  search_btn->setEnabled(model->rowCount() > 0 || model->histories.isEmpty());
+  const size_t steps = model->engine.steps();
+  properties_group->setEnabled(steps == 0);
+  message_group->setEnabled(steps == 0);
+  search_btn->setText(steps == 0 ? tr("Find") : tr("Find Next"));
+  reset_btn->setEnabled(steps > 0);
+  undo_btn->setEnabled(steps > 1);
+  search_btn->setEnabled(model->rowCount() > 0 || steps == 0);
   stats_label->setVisible(true);
-  stats_label->setText(tr("%1 matches. right click on an item to create signal. double click to open message").arg(model->filtered_signals.size()));
+  stats_label->setText(tr("%1 matches. right click on an item to create signal. double click to open message").arg(model->engine.matches()));
 }
 
 void FindSignalDlg::customMenuRequested(const QPoint &pos) {
@@ -261,9 +569,9 @@ void FindSignalDlg::customMenuRequested(const QPoint &pos) {
     QMenu menu(this);
     menu.addAction(tr("Create Signal"));
     if (menu.exec(view->mapToGlobal(pos))) {
-      auto &s = model->filtered_signals[index.row()];
-      UndoStack::push(new AddSigCommand(s.id, s.sig));
-      emit openMessage(s.id);
+      const uint32_t c = model->rows[index.row()];
+      UndoStack::push(new AddSigCommand(model->engine.id(c), model->engine.signal(c)));
+      emit openMessage(model->engine.id(c));
     }
   }
 }
@@ -1,7 +1,11 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include <QAbstractTableModel>
 #include <QCheckBox>
@@ -12,29 +16,82 @@
 #include "tools/cabana/commands.h"
 #include "tools/cabana/settings.h"
 
-class FindSignalModel : public QAbstractTableModel {
+// Brute-force search over every (message, start bit, size) candidate signal. The payloads of a
+// message are transposed into bit-planes, one bitset over the events per payload bit, so a
+// comparison is evaluated for 64 events at a time with a few word operations per signal bit.
+class SignalSearch {
 public:
-  struct SearchSignal {
-    MessageId id = {};
-    uint64_t mono_time = 0;
-    cabana::Signal sig = {};
-    double value = 0.;
-    QStringList values;
+  // In the order of FindSignalDlg's combo box
+  enum class Op { Equal, Greater, GreaterEqual, NotEqual, Less, LessEqual, Between };
+  struct Condition {
+    Op op = Op::Equal;
+    double v1 = 0, v2 = 0;
+    bool test(double v) const;
   };
 
+  void init(const std::vector<MessageId> &ids, int min_size, int max_size, const cabana::Signal &sig, uint64_t first_time, uint64_t last_time);
+  // Keeps the candidates having a value that satisfies `cond` after their previous match
+  void search(const Condition &cond);
+  void undo();
+  void clear();
+  size_t steps() const { return steps_.empty() ? 0 : steps_.size() - 1; }
+  size_t matches() const { return steps() > 0 ? steps_.back().count : 0; }
+  // Up to max_count candidates left by the last step
+  std::vector<uint32_t> results(size_t max_count) const;
+  MessageId id(uint32_t c) const { return messages_[candidates_[c].msg].id; }
+  cabana::Signal signal(uint32_t c) const;
+  // (mono_time, value) of the candidate's match in each step
+  std::vector<std::pair<uint64_t, double>> history(uint32_t c) const;
+
+private:
+  struct BitPlanes {
+    size_t events_size = 0;  // of the message when built, to notice new events
+    uint64_t front_time = 0;  // and events dropped from the front
+    size_t begin = 0, count = 0, words = 0;
+    std::vector<uint64_t> bits;  // plane p is bits[p * words, (p + 1) * words)
+    std::vector<uint64_t> full;  // per byte, the events having it. Empty if all events have every byte.
+  };
+  struct Message {
+    MessageId id;
+    int total_bits = 0;
+    uint32_t first_candidate = 0, last_candidate = 0;
+    std::shared_ptr<BitPlanes> planes;
+  };
+  struct Candidate {
+    uint32_t msg;
+    uint16_t start_bit;
+    uint8_t size;
+  };
+  struct Step {
+    uint32_t indexOf(uint32_t c) const;
+    std::vector<uint64_t> alive;  // one bit per candidate
+    std::vector<uint32_t> rank;   // alive candidates before each word of `alive`
+    std::vector<uint64_t> match_times;  // per alive candidate, empty for the initial step
+    size_t count = 0;
+  };
+  void searchMessage(Message &m, const Condition &cond, std::vector<uint64_t> &found);
+
+  cabana::Signal sig_ = {};
+  uint64_t first_time_ = 0, last_time_ = std::numeric_limits<uint64_t>::max();
+  std::vector<Message> messages_;
+  std::vector<Candidate> candidates_;
+  std::vector<Step> steps_;
+  std::atomic<size_t> cached_bytes_ = 0;
+};
+
+class FindSignalModel : public QAbstractTableModel {
+public:
   FindSignalModel(QObject *parent) : QAbstractTableModel(parent) {}
   QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
   QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
   int columnCount(const QModelIndex &parent = QModelIndex()) const override { return 3; }
-  int rowCount(const QModelIndex &parent = QModelIndex()) const override { return std::min(filtered_signals.size(), 300); }
-  void search(std::function<bool(double)> cmp);
+  int rowCount(const QModelIndex &parent = QModelIndex()) const override { return rows.size(); }
+  void search(const SignalSearch::Condition &cond);
   void reset();
   void undo();
 
-  QList<SearchSignal> filtered_signals;
-  QList<SearchSignal> initial_signals;
-  QList<QList<SearchSignal>> histories;
-  uint64_t last_time = std::numeric_limits<uint64_t>::max();
+  SignalSearch engine;
+  std::vector<uint32_t> rows;  // candidates shown, at most 300
 };
 
 class FindSignalDlg : public QDialog {
@@ -1,6 +1,7 @@
 #include "tools/cabana/tools/findsimilarbits.h"
 
 #include <algorithm>
+#include <cmath>
 
 #include <QGridLayout>
 #include <QHeaderView>
@@ -9,6 +10,7 @@
 #include <QLabel>
 #include <QPushButton>
 #include <QRadioButton>
+#include <QtConcurrent>
 
 #include "tools/cabana/dbc/dbcmanager.h"
 #include "tools/cabana/streams/abstractstream.h"
@@ -27,6 +29,7 @@ FindSimilarBitsDlg::FindSimilarBitsDlg(QWidget *parent) : QDialog(parent, Qt::Wi
       cb->addItem(QString::number(bus), bus);
     }
   }
+  find_bus_combo->addItem(tr("All"), -1);
 
   msg_cb = new QComboBox(this);
   // TODO: update when src_bus_combo changes
@@ -35,6 +38,7 @@ FindSimilarBitsDlg::FindSimilarBitsDlg(QWidget *parent) : QDialog(parent, Qt::Wi
   }
   msg_cb->model()->sort(0);
   msg_cb->setCurrentIndex(0);
+  sig_cb = new QComboBox(this);
 
   byte_idx_sb = new QSpinBox(this);
   byte_idx_sb->setFixedWidth(50);
@@ -47,6 +51,7 @@ FindSimilarBitsDlg::FindSimilarBitsDlg(QWidget *parent) : QDialog(parent, Qt::Wi
   src_layout->addWidget(new QLabel(tr("Bus")));
   src_layout->addWidget(src_bus_combo);
   src_layout->addWidget(msg_cb);
+  src_layout->addWidget(sig_cb);
   src_layout->addWidget(new QLabel(tr("Byte Index")));
   src_layout->addWidget(byte_idx_sb);
   src_layout->addWidget(new QLabel(tr("Bit Index")));
@@ -81,80 +86,174 @@ FindSimilarBitsDlg::FindSimilarBitsDlg(QWidget *parent) : QDialog(parent, Qt::Wi
   table->setSelectionMode(QAbstractItemView::SingleSelection);
   table->setEditTriggers(QAbstractItemView::NoEditTriggers);
   table->horizontalHeader()->setStretchLastSection(true);
+  table->setColumnCount(7);
+  table->setHorizontalHeaderLabels({"bus", "address", "byte idx", "bit idx", "mismatches", "total msgs", "% mismatched"});
   main_layout->addWidget(table);
 
+  watcher = new QFutureWatcher<QList<mismatched_struct>>(this);
+  updateSignals();
+
   setMinimumSize({700, 500});
   QObject::connect(search_btn, &QPushButton::clicked, this, &FindSimilarBitsDlg::find);
+  QObject::connect(msg_cb, qOverload<int>(&QComboBox::currentIndexChanged), this, &FindSimilarBitsDlg::updateSignals);
+  QObject::connect(sig_cb, qOverload<int>(&QComboBox::currentIndexChanged), [this](int index) {
+    byte_idx_sb->setEnabled(index == 0);
+    bit_idx_sb->setEnabled(index == 0);
+  });
+  QObject::connect(watcher, &QFutureWatcher<QList<mismatched_struct>>::resultReadyAt, [this](int i) {
+    addResults(watcher->resultAt(i));
+  });
+  QObject::connect(watcher, &QFutureWatcher<QList<mismatched_struct>>::finished, [this]() {
+    table->setSortingEnabled(true);
+    table->sortByColumn(6, Qt::AscendingOrder);
+    search_btn->setEnabled(true);
+    releaseEvents();
+  });
   QObject::connect(table, &QTableWidget::doubleClicked, [this](const QModelIndex &index) {
     if (index.isValid()) {
-      MessageId msg_id = {.source = (uint8_t)find_bus_combo->currentData().toUInt(), .address = table->item(index.row(), 0)->text().toUInt(0, 16)};
-      emit openMessage(msg_id);
+      emit openMessage(table->item(index.row(), 0)->data(Qt::UserRole).value<MessageId>());
     }
   });
 }
 
+FindSimilarBitsDlg::~FindSimilarBitsDlg() {
+  watcher->cancel();
+  watcher->waitForFinished();
+  releaseEvents();
+}
+
+void FindSimilarBitsDlg::releaseEvents() {
+  if (std::exchange(events_held, false)) {
+    can->releaseEvents();
+  }
+}
+
+void FindSimilarBitsDlg::updateSignals() {
+  sig_cb->clear();
+  sig_cb->addItem(tr("Bit"));
+  const auto &msgs = dbc()->getMessages(-1);
+  if (auto it = msgs.find(msg_cb->currentData().toUInt()); it != msgs.end()) {
+    for (auto sig : it->second.getSignals()) {
+      sig_cb->addItem(sig->name);
+    }
+  }
+}
+
 void FindSimilarBitsDlg::find() {
   search_btn->setEnabled(false);
-  table->clear();
-  uint32_t selected_address = msg_cb->currentData().toUInt();
-  auto msg_mismatched = calcBits(src_bus_combo->currentText().toUInt(), selected_address, byte_idx_sb->value(), bit_idx_sb->value(),
-                                 find_bus_combo->currentText().toUInt(), equal_combo->currentIndex() == 0, min_msgs->text().toInt());
-  table->setRowCount(msg_mismatched.size());
-  table->setColumnCount(6);
-  table->setHorizontalHeaderLabels({"address", "byte idx", "bit idx", "mismatches", "total msgs", "% mismatched"});
-  for (int i = 0; i < msg_mismatched.size(); ++i) {
-    auto &m = msg_mismatched[i];
-    table->setItem(i, 0, new QTableWidgetItem(QString("%1").arg(m.address, 1, 16)));
-    table->setItem(i, 1, new QTableWidgetItem(QString::number(m.byte_idx)));
-    table->setItem(i, 2, new QTableWidgetItem(QString::number(m.bit_idx)));
-    table->setItem(i, 3, new QTableWidgetItem(QString::number(m.mismatches)));
-    table->setItem(i, 4, new QTableWidgetItem(QString::number(m.total)));
-    table->setItem(i, 5, new QTableWidgetItem(QString::number(m.perc, 'f', 2)));
+  table->setSortingEnabled(false);
+  table->setRowCount(0);
+
+  const MessageId src_id = {.source = (uint8_t)src_bus_combo->currentData().toUInt(), .address = msg_cb->currentData().toUInt()};
+  const Reference ref = reference(src_id, sig_cb->currentIndex() > 0 ? sig_cb->currentText() : QString(),
+                                  byte_idx_sb->value(), bit_idx_sb->value());
+  const bool equal = equal_combo->currentIndex() == 0;
+  const int min_msgs_cnt = min_msgs->text().toInt();
+
+  // The search reads the stream's events in place. New events are merged once it finishes.
+  can->holdEvents();
+  events_held = true;
+  const int find_bus = find_bus_combo->currentData().toInt();
+  QList<Job> jobs;
+  for (const auto &[id, _] : can->lastMessages()) {
+    if (find_bus == -1 || id.source == find_bus) {
+      jobs.push_back({id, &can->events(id)});
+    }
   }
-  search_btn->setEnabled(true);
+  std::function<QList<mismatched_struct>(const Job &)> calc = [=](const Job &job) {
+    return calcBits(job, ref, equal, min_msgs_cnt);
+  };
+  watcher->setFuture(QtConcurrent::mapped(jobs, calc));
 }
 
-QList<FindSimilarBitsDlg::mismatched_struct> FindSimilarBitsDlg::calcBits(uint8_t bus, uint32_t selected_address, int byte_idx,
-                                                                          int bit_idx, uint8_t find_bus, bool equal, int min_msgs_cnt) {
-  QHash<uint32_t, QVector<uint32_t>> mismatches;
-  QHash<uint32_t, uint32_t> msg_count;
-  const auto &events = can->allEvents();
-  int bit_to_find = -1;
-  for (const CanEvent *e : events) {
-    if (e->src == bus) {
-      if (e->address == selected_address && e->size > byte_idx) {
-        bit_to_find = ((e->dat[byte_idx] >> (7 - bit_idx)) & 1) != 0;
-      }
+void FindSimilarBitsDlg::addResults(const QList<mismatched_struct> &results) {
+  for (const auto &m : results) {
+    const int row = table->rowCount();
+    table->insertRow(row);
+    auto bus = new QTableWidgetItem(QString::number(m.id.source));
+    bus->setData(Qt::UserRole, QVariant::fromValue(m.id));
+    table->setItem(row, 0, bus);
+    table->setItem(row, 1, new QTableWidgetItem(QString("%1").arg(m.id.address, 1, 16)));
+    // Numbers are stored as such, so the columns sort numerically
+    const QVariant values[] = {m.byte_idx, m.bit_idx, m.mismatches, m.total, std::round(m.perc * 100) / 100};
+    int column = 2;
+    for (const auto &value : values) {
+      auto item = new QTableWidgetItem;
+      item->setData(Qt::DisplayRole, value);
+      table->setItem(row, column++, item);
     }
-    if (e->src == find_bus) {
-      ++msg_count[e->address];
-      if (bit_to_find == -1) continue;
+  }
+}
 
-      auto &mismatched = mismatches[e->address];
-      if (mismatched.size() < e->size * 8) {
-        mismatched.resize(e->size * 8);
+FindSimilarBitsDlg::Reference FindSimilarBitsDlg::reference(const MessageId &id, const QString &sig_name, int byte_idx, int bit_idx) const {
+  Reference ref;
+  const auto &events = can->events(id);
+  const auto &msgs = dbc()->getMessages(-1);
+  const cabana::Signal *sig = nullptr;
+  if (auto it = msgs.find(id.address); it != msgs.end() && !sig_name.isEmpty()) {
+    sig = it->second.sig(sig_name);
+  }
+
+  if (sig) {
+    // A signal is compared by whether it is non-zero
+    std::vector<double> values;
+    std::vector<uint8_t> valid;
+    events.decode(cabana::SignalDecoder(*sig), 0, events.size(), values, valid);
+    for (size_t i = 0; i < values.size(); ++i) {
+      if (valid[i]) {
+        ref.mono_times.push_back(events.monoTimes()[i]);
+        ref.states.push_back(values[i] != 0);
       }
-      for (int i = 0; i < e->size; ++i) {
-        for (int j = 0; j < 8; ++j) {
-          int bit = ((e->dat[i] >> (7 - j)) & 1) != 0;
-          mismatched[i * 8 + j] += equal ? (bit != bit_to_find) : (bit == bit_to_find);
-        }
+    }
+  } else {
+    for (const auto &e : events) {
+      if (e.size > byte_idx) {
+        ref.mono_times.push_back(e.mono_time);
+        ref.states.push_back((e.dat[byte_idx] >> (7 - bit_idx)) & 1);
       }
     }
   }
+  return ref;
+}
+
+QList<FindSimilarBitsDlg::mismatched_struct> FindSimilarBitsDlg::calcBits(const Job &job, const Reference &ref, bool equal, int min_msgs_cnt) {
+  const auto &events = *job.events;
+  const uint32_t cnt = events.size();
+  if ((int)cnt <= min_msgs_cnt) return {};
 
+  // Reference state held at each event, and whether it was known yet, 64 events per word
+  const size_t words = (cnt + 63) / 64;
+  std::vector<uint64_t> ref_bits(words, 0), known(words, 0);
+  const auto &mono_times = events.monoTimes();
+  for (size_t i = 0, j = 0; i < cnt; ++i) {
+    while (j < ref.mono_times.size() && ref.mono_times[j] <= mono_times[i]) ++j;
+    if (j > 0) {
+      known[i / 64] |= 1ULL << (i % 64);
+      ref_bits[i / 64] |= (uint64_t)ref.states[j - 1] << (i % 64);
+    }
+  }
+
+  // Bits of each byte, and the events long enough to have that byte
+  const int bytes = events.stride();
+  const auto planes = events.bitPlanes(0, cnt, bytes);
+  std::vector<uint64_t> has_byte(words);
   QList<mismatched_struct> result;
-  result.reserve(mismatches.size());
-  for (auto it = mismatches.begin(); it != mismatches.end(); ++it) {
-    if (auto cnt = msg_count[it.key()]; cnt > min_msgs_cnt) {
-      auto &mismatched = it.value();
-      for (int i = 0; i < mismatched.size(); ++i) {
-        if (float perc = (mismatched[i] / (double)cnt) * 100; perc < 50) {
-          result.push_back({it.key(), (uint32_t)i / 8, (uint32_t)i % 8, mismatched[i], cnt, perc});
-        }
+  for (int b = 0; b < bytes; ++b) {
+    std::fill(has_byte.begin(), has_byte.end(), 0);
+    for (size_t i = 0; i < cnt; ++i) {
+      if (events[i].size > b) has_byte[i / 64] |= 1ULL << (i % 64);
+    }
+    for (int bit = 0; bit < 8; ++bit) {
+      const uint64_t *plane = planes.data() + (b * 8 + 7 - bit) * words;
+      uint32_t mismatches = 0;
+      for (size_t w = 0; w < words; ++w) {
+        const uint64_t diff = plane[w] ^ ref_bits[w];
+        mismatches += __builtin_popcountll((equal ? diff : ~diff) & known[w] & has_byte[w]);
+      }
+      if (float perc = (mismatches / (double)cnt) * 100; perc < 50) {
+        result.push_back({job.id, (uint32_t)b, (uint32_t)bit, mismatches, cnt, perc});
       }
     }
   }
-  std::sort(result.begin(), result.end(), [](auto &l, auto &r) { return l.perc < r.perc; });
   return result;
 }
@@ -2,33 +2,51 @@
 
 #include <QComboBox>
 #include <QDialog>
+#include <QFutureWatcher>
 #include <QLineEdit>
 #include <QSpinBox>
 #include <QTableWidget>
 
 #include "tools/cabana/dbc/dbcmanager.h"
+#include "tools/cabana/streams/abstractstream.h"
 
 class FindSimilarBitsDlg : public QDialog {
   Q_OBJECT
 
 public:
   FindSimilarBitsDlg(QWidget *parent);
+  ~FindSimilarBitsDlg();
 
 signals:
   void openMessage(const MessageId &msg_id);
 
 private:
   struct mismatched_struct {
-    uint32_t address, byte_idx, bit_idx, mismatches, total;
+    MessageId id;
+    uint32_t byte_idx, bit_idx, mismatches, total;
     float perc;
   };
-  QList<mismatched_struct> calcBits(uint8_t bus, uint32_t selected_address, int byte_idx, int bit_idx, uint8_t find_bus,
-                                    bool equal, int min_msgs_cnt);
+  // State of the bit or signal to compare with, from each event of the source message
+  struct Reference {
+    std::vector<uint64_t> mono_times;
+    std::vector<uint8_t> states;
+  };
+  struct Job {
+    MessageId id;
+    const MessageEvents *events;  // the stream's own, merges are held back during the search
+  };
+  static QList<mismatched_struct> calcBits(const Job &job, const Reference &ref, bool equal, int min_msgs_cnt);
+  Reference reference(const MessageId &id, const QString &sig_name, int byte_idx, int bit_idx) const;
+  void updateSignals();
   void find();
+  void addResults(const QList<mismatched_struct> &results);
+  void releaseEvents();
 
   QTableWidget *table;
-  QComboBox *src_bus_combo, *find_bus_combo, *msg_cb, *equal_combo;
+  QComboBox *src_bus_combo, *find_bus_combo, *msg_cb, *sig_cb, *equal_combo;
   QSpinBox *byte_idx_sb, *bit_idx_sb;
   QPushButton *search_btn;
   QLineEdit *min_msgs;
+  QFutureWatcher<QList<mismatched_struct>> *watcher;
+  bool events_held = false;
 };
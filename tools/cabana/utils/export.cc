@@ -12,11 +12,11 @@ void exportToCSV(const QString &file_name, std::optional<MessageId> msg_id) {
   if (file.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
     QTextStream stream(&file);
     stream << "time,addr,bus,data\n";
-    for (auto e : msg_id ? can->events(*msg_id) : can->allEvents()) {
-      stream << QString::number(can->toSeconds(e->mono_time), 'f', 3) << ","
-             << "0x" << QString::number(e->address, 16) << "," << e->src << ","
-             << "0x" << QByteArray::fromRawData((const char *)e->dat, e->size).toHex().toUpper() << "\n";
-    }
+    can->forEachEvent([&](const MessageId &id, const CanEvent &e) {
+      stream << QString::number(can->toSeconds(e.mono_time), 'f', 3) << ","
+             << "0x" << QString::number(id.address, 16) << "," << id.source << ","
+             << "0x" << QByteArray::fromRawData((const char *)e.dat, e.size).toHex().toUpper() << "\n";
+    }, 0, std::numeric_limits<uint64_t>::max(), [&](const MessageId &id) { return !msg_id || id == *msg_id; });
   }
 }
 
@@ -29,13 +29,18 @@ void exportSignalsToCSV(const QString &file_name, const MessageId &msg_id) {
       stream << "," << s->name;
     stream << "\n";
 
-    for (auto e : can->events(msg_id)) {
-      stream << QString::number(can->toSeconds(e->mono_time), 'f', 3) << ","
-             << "0x" << QString::number(e->address, 16) << "," << e->src;
-      for (auto s : msg->sigs) {
-        double value = 0;
-        s->getValue(e->dat, e->size, &value);
-        stream << "," << QString::number(value, 'f', s->precision);
+    // Decode signal by signal, then write row by row
+    const auto &events = can->events(msg_id);
+    std::vector<std::vector<double>> values(msg->sigs.size());
+    std::vector<std::vector<uint8_t>> valid(msg->sigs.size());
+    for (int i = 0; i < msg->sigs.size(); ++i) {
+      events.decode(cabana::SignalDecoder(*msg->sigs[i]), 0, events.size(), values[i], valid[i]);
+    }
+    for (size_t i = 0; i < events.size(); ++i) {
+      stream << QString::number(can->toSeconds(events.monoTimes()[i]), 'f', 3) << ","
+             << "0x" << QString::number(msg_id.address, 16) << "," << msg_id.source;
+      for (int j = 0; j < msg->sigs.size(); ++j) {
+        stream << "," << QString::number(valid[j][i] ? values[j][i] : 0, 'f', msg->sigs[j]->precision);
       }
       stream << "\n";
     }
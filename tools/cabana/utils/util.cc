@@ -16,37 +16,84 @@
 
 #include "selfdrive/ui/qt/util.h"
 
-// SegmentTree
-
-void SegmentTree::build(const std::vector<QPointF> &arr) {
-  size = arr.size();
-  tree.resize(4 * size);  // size of the tree is 4 times the size of the array
-  if (size > 0) {
-    build_tree(arr, 1, 0, size - 1);
+// MinMaxPyramid
+
+void MinMaxPyramid::update(const std::vector<QPointF> &pts, size_t from) {
+  auto merge = [&](const Bucket &a, const Bucket &b) {
+    return Bucket{a.first, b.last,
+                  pts[b.min].y() < pts[a.min].y() ? b.min : a.min,
+                  pts[b.max].y() > pts[a.max].y() ? b.max : a.max};
+  };
+
+  const size_t n = pts.size();
+  size_t count = n;  // number of items in the level below
+  for (int k = 0; count > 1; ++k) {
+    const size_t bucket_count = (count + 1) / 2;
+    if (levels.size() <= k) levels.emplace_back();
+    auto &level = levels[k];
+    level.resize(bucket_count);
+    for (size_t i = std::min(from >> (k + 1), bucket_count); i < bucket_count; ++i) {
+      const uint32_t l = 2 * i, r = std::min<uint32_t>(2 * i + 1, count - 1);
+      if (k == 0) {
+        level[i] = merge({l, l, l, l}, {r, r, r, r});
+      } else {
+        level[i] = merge(levels[k - 1][l], levels[k - 1][r]);
+      }
+    }
+    count = bucket_count;
   }
+  levels.resize(std::min(levels.size(), n > 1 ? (size_t)std::ceil(std::log2(n)) : 0));
 }
 
-void SegmentTree::build_tree(const std::vector<QPointF> &arr, int n, int left, int right) {
-  if (left == right) {
-    const double y = arr[left].y();
-    tree[n] = {y, y};
-  } else {
-    const int mid = (left + right) >> 1;
-    build_tree(arr, 2 * n, left, mid);
-    build_tree(arr, 2 * n + 1, mid + 1, right);
-    tree[n] = {std::min(tree[2 * n].first, tree[2 * n + 1].first), std::max(tree[2 * n].second, tree[2 * n + 1].second)};
+std::pair<double, double> MinMaxPyramid::minmax(const std::vector<QPointF> &pts, size_t lo, size_t hi) const {
+  double min = std::numeric_limits<double>::max();
+  double max = std::numeric_limits<double>::lowest();
+  // Element i of level k is point i for k == -1, and levels[k][i] otherwise
+  auto add = [&](int k, size_t i) {
+    const double lo_y = k < 0 ? pts[i].y() : pts[levels[k][i].min].y();
+    const double hi_y = k < 0 ? pts[i].y() : pts[levels[k][i].max].y();
+    min = std::min(min, lo_y);
+    max = std::max(max, hi_y);
+  };
+
+  hi = std::min(hi, pts.size());
+  for (int k = -1; lo < hi; ++k) {
+    if (k + 1 == levels.size()) {
+      for (; lo < hi; ++lo) add(k, lo);
+      break;
+    }
+    if (lo & 1) add(k, lo++);
+    if (hi & 1) add(k, --hi);
+    lo >>= 1;
+    hi >>= 1;
   }
+  return {min, max};
 }
 
-std::pair<double, double> SegmentTree::get_minmax(int n, int left, int right, int range_left, int range_right) const {
-  if (range_left > right || range_right < left)
-    return {std::numeric_limits<double>::max(), std::numeric_limits<double>::lowest()};
-  if (range_left <= left && range_right >= right)
-    return tree[n];
-  int mid = (left + right) >> 1;
-  auto l = get_minmax(2 * n, left, mid, range_left, range_right);
-  auto r = get_minmax(2 * n + 1, mid + 1, right, range_left, range_right);
-  return {std::min(l.first, r.first), std::max(l.second, r.second)};
+void MinMaxPyramid::sample(const std::vector<QPointF> &pts, double min_x, double max_x, int max_points,
+                           std::vector<QPointF> &out) const {
+  // One point beyond each end of the range, so lines run to the edges of the plot
+  auto x_less = [](const QPointF &p, double x) { return p.x() < x; };
+  size_t lo = std::lower_bound(pts.begin(), pts.end(), min_x, x_less) - pts.begin();
+  size_t hi = std::lower_bound(pts.begin() + lo, pts.end(), max_x, x_less) - pts.begin();
+  lo = lo > 0 ? lo - 1 : 0;
+  hi = std::min(hi + 1, pts.size());
+  if (hi - lo <= max_points || levels.empty()) {
+    out.insert(out.end(), pts.begin() + lo, pts.begin() + hi);
+    return;
+  }
+
+  // Up to four points per bucket
+  int k = 0;
+  while (k + 1 < levels.size() && ((hi - lo) >> (k + 1)) > max_points / 4) ++k;
+  const auto &level = levels[k];
+  for (size_t b = lo >> (k + 1); b <= (hi - 1) >> (k + 1); ++b) {
+    std::array<uint32_t, 4> idx = {level[b].first, level[b].min, level[b].max, level[b].last};
+    std::sort(idx.begin(), idx.end());
+    for (int i = 0; i < idx.size(); ++i) {
+      if (i == 0 || idx[i] != idx[i - 1]) out.push_back(pts[idx[i]]);
+    }
+  }
 }
 
 // MessageBytesDelegate
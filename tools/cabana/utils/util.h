@@ -52,17 +52,24 @@ enum {
   BytesRole = Qt::UserRole + 2
 };
 
-class SegmentTree {
+// Min/max summary of a time series at power of two resolutions, so that a long series can be
+// drawn with a bounded number of points. Level k holds buckets of 2^(k+1) points.
+class MinMaxPyramid {
 public:
-  SegmentTree() = default;
-  void build(const std::vector<QPointF> &arr);
-  inline std::pair<double, double> minmax(int left, int right) const { return get_minmax(1, 0, size - 1, left, right); }
+  void build(const std::vector<QPointF> &pts) { update(pts, 0); }
+  // Recomputes the buckets covering pts[from:], after points were appended or changed at the end
+  void update(const std::vector<QPointF> &pts, size_t from);
+  // Min and max y of pts[lo:hi]
+  std::pair<double, double> minmax(const std::vector<QPointF> &pts, size_t lo, size_t hi) const;
+  // Appends the points of pts around [min_x, max_x] to out. If there are more than max_points,
+  // only the first, last, min and max point of each bucket is kept.
+  void sample(const std::vector<QPointF> &pts, double min_x, double max_x, int max_points, std::vector<QPointF> &out) const;
 
 private:
-  std::pair<double, double> get_minmax(int n, int left, int right, int range_left, int range_right) const;
-  void build_tree(const std::vector<QPointF> &arr, int n, int left, int right);
-  std::vector<std::pair<double, double>> tree;
-  int size = 0;
+  struct Bucket {
+    uint32_t first, last, min, max;  // indices into the series
+  };
+  std::vector<std::vector<Bucket>> levels;
 };
 
 class MessageBytesDelegate : public QStyledItemDelegate {
@@ -27,14 +27,10 @@ CameraServer::CameraServer(std::pair<int, int> camera_size[MAX_CAMERAS]) {
 }
 
 CameraServer::~CameraServer() {
+  // Pending frames are dropped by the camera threads, the queues only have one consumer
+  exit_ = true;
   for (auto &cam : cameras_) {
     if (cam.thread.joinable()) {
-      // Clear the queue
-      std::pair<FrameReader*, const Event *> item;
-      while (cam.queue.try_pop(item)) {
-        --publishing_;
-      }
-
       // Signal termination and join the thread
       cam.queue.push({});
       cam.thread.join();
@@ -65,6 +61,10 @@ void CameraServer::cameraThread(Camera &cam) {
   while (true) {
     const auto [fr, event] = cam.queue.pop();
     if (!fr) break;
+    if (exit_) {
+      frameSent();
+      continue;
+    }
 
     capnp::FlatArrayMessageReader reader(event->data);
     auto evt = reader.getRoot<cereal::Event>();
@@ -83,10 +83,13 @@ void CameraServer::cameraThread(Camera &cam) {
       rError("camera[%d] failed to get frame: %lu", cam.type, segment_id);
     }
 
-    // Prefetch the next frame
-    getFrame(cam, fr, segment_id + 1, frame_id + 1);
+    frameSent();
+  }
+}
 
-    --publishing_;
+void CameraServer::frameSent() {
+  if (--publishing_ == 0) {
+    futex::wake(publishing_);
   }
 }
 
@@ -119,7 +122,7 @@ void CameraServer::pushFrame(CameraType type, FrameReader *fr, const Event *even
 }
 
 void CameraServer::waitForSent() {
-  while (publishing_ > 0) {
-    std::this_thread::yield();
+  while (uint32_t pending = publishing_) {
+    futex::wait(publishing_, pending);
   }
 }
@@ -1,12 +1,13 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <set>
 #include <tuple>
 #include <utility>
 
 #include "msgq/visionipc/visionipc_server.h"
-#include "common/queue.h"
+#include "common/spsc_queue.h"
 #include "tools/replay/framereader.h"
 #include "tools/replay/logreader.h"
 
@@ -26,11 +27,12 @@ protected:
     int width;
     int height;
     std::thread thread;
-    SafeQueue<std::pair<FrameReader*, const Event *>> queue;
+    SPSCQueue<std::pair<FrameReader*, const Event *>> queue{64};
     std::set<VisionBuf *> cached_buf;
   };
   void startVipcServer();
   void cameraThread(Camera &cam);
+  void frameSent();
   VisionBuf *getFrame(Camera &cam, FrameReader *fr, int32_t segment_id, uint32_t frame_id);
 
   Camera cameras_[MAX_CAMERAS] = {
@@ -38,6 +40,7 @@ protected:
       {.type = DriverCam, .stream_type = VISION_STREAM_DRIVER},
       {.type = WideRoadCam, .stream_type = VISION_STREAM_WIDE_ROAD},
   };
-  std::atomic<int> publishing_ = 0;
+  std::atomic<uint32_t> publishing_ = 0;
+  std::atomic<bool> exit_ = false;
   std::unique_ptr<VisionIpcServer> vipc_server_;
 };
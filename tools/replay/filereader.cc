@@ -1,36 +1,198 @@
 #include "tools/replay/filereader.h"
 
-#include <fstream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
 
 #include "common/util.h"
 #include "system/hardware/hw.h"
 #include "tools/replay/util.h"
 
+// Temporary files of interrupted writes are removed once they are this old
+const int STALE_TMP_FILE_SECONDS = 3600;
+
 std::string cacheFilePath(const std::string &url) {
-  static std::string cache_path = [] {
-    const std::string comma_cache = Path::download_cache_root();
-    util::create_directories(comma_cache, 0755);
-    return comma_cache.back() == '/' ? comma_cache : comma_cache + "/";
-  }();
+  return DownloadCache::instance().root() + sha256(getUrlWithoutQuery(url));
+}
+
+// DownloadCache
+
+DownloadCache &DownloadCache::instance() {
+  static DownloadCache cache;
+  return cache;
+}
+
+DownloadCache::DownloadCache() {
+  const std::string comma_cache = Path::download_cache_root();
+  util::create_directories(comma_cache, 0755);
+  root_ = comma_cache.back() == '/' ? comma_cache : comma_cache + "/";
+  thread_ = std::thread(&DownloadCache::writerThread, this);
+}
+
+DownloadCache::~DownloadCache() {
+  {
+    std::lock_guard lk(lock_);
+    exit_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+void DownloadCache::setBudget(size_t bytes) {
+  {
+    std::lock_guard lk(lock_);
+    budget_ = bytes;
+    evict_requested_ = true;
+  }
+  cv_.notify_all();
+}
 
-  return cache_path + sha256(getUrlWithoutQuery(url));
+std::shared_ptr<const std::string> DownloadCache::pending(const std::string &file) {
+  std::lock_guard lk(lock_);
+  auto it = pending_.find(file);
+  return it != pending_.end() ? it->second : nullptr;
 }
 
-std::string FileReader::read(const std::string &file, std::atomic<bool> *abort) {
+void DownloadCache::writeAsync(const std::string &file, std::shared_ptr<const std::string> data) {
+  {
+    std::lock_guard lk(lock_);
+    if (pending_.count(file)) return;
+
+    pending_[file] = std::move(data);
+    write_queue_.push_back(file);
+  }
+  cv_.notify_all();
+}
+
+bool DownloadCache::write(const std::string &file, const void *data, size_t size) {
+  struct stat st = {};
+  const size_t replaced_size = stat(file.c_str(), &st) == 0 ? st.st_size : 0;
+  if (!writeFileAtomic(file, data, size)) {
+    rWarning("failed to write cache file %s", file.c_str());
+    return false;
+  }
+
+  {
+    std::lock_guard lk(lock_);
+    // The replaced file was already counted
+    total_size_ += size;
+    total_size_ -= std::min(total_size_, replaced_size);
+    evict_requested_ |= total_size_ > budget_;
+  }
+  cv_.notify_all();
+  return true;
+}
+
+void DownloadCache::wait(const std::string &file) {
+  std::unique_lock lk(lock_);
+  cv_.wait(lk, [&]() { return pending_.count(file) == 0; });
+}
+
+void DownloadCache::touch(const std::string &file) {
+  // Record the access in mtime, atime is unreliable with relatime/noatime mounts
+  utimensat(AT_FDCWD, file.c_str(), nullptr, 0);
+}
+
+void DownloadCache::writerThread() {
+  std::unique_lock lk(lock_);
+  while (true) {
+    cv_.wait(lk, [this]() { return exit_ || evict_requested_ || !write_queue_.empty(); });
+
+    if (!write_queue_.empty()) {
+      // Pending writes are flushed before exiting
+      const std::string file = write_queue_.front();
+      auto data = pending_.at(file);
+      lk.unlock();
+      write(file, data->data(), data->size());
+      lk.lock();
+      write_queue_.pop_front();
+      pending_.erase(file);
+      cv_.notify_all();
+    } else if (evict_requested_) {
+      evict_requested_ = false;
+      lk.unlock();
+      evict();
+      lk.lock();
+    } else if (exit_) {
+      break;
+    }
+  }
+}
+
+void DownloadCache::evict() {
+  // Rescan the directory on every pass, other processes may share the cache
+  std::vector<std::tuple<int64_t, size_t, std::string>> files;
+  size_t total = 0;
+  const int64_t now = std::time(nullptr);
+  if (DIR *d = opendir(root_.c_str())) {
+    while (struct dirent *de = readdir(d)) {
+      struct stat st = {};
+      const std::string file = root_ + de->d_name;
+      if (de->d_name[0] == '.' || stat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+
+      if (file.size() > 4 && file.compare(file.size() - 4, 4, ".tmp") == 0) {
+        if (now - st.st_mtime > STALE_TMP_FILE_SECONDS) std::remove(file.c_str());
+        continue;
+      }
+      files.emplace_back(st.st_mtime, st.st_size, file);
+      total += st.st_size;
+    }
+    closedir(d);
+  }
+
+  std::unique_lock lk(lock_);
+  const size_t target = budget_ / 10 * 9;  // Leave some headroom so eviction doesn't run on every write
+  if (total > budget_) {
+    std::unordered_set<std::string> in_use;
+    for (auto &[file, _] : pending_) in_use.insert(file);
+    lk.unlock();
+
+    std::sort(files.begin(), files.end());
+    size_t evicted = 0;
+    for (auto it = files.begin(); it != files.end() && total > target; ++it) {
+      const auto &[_, size, file] = *it;
+      if (in_use.count(file) == 0 && std::remove(file.c_str()) == 0) {
+        total -= size;
+        ++evicted;
+      }
+    }
+    rInfo("download cache: evicted %zu files, %.1f MB in use", evicted, total / (1024.0 * 1024.0));
+    lk.lock();
+  }
+  total_size_ = total;
+}
+
+std::shared_ptr<const std::string> FileReader::read(const std::string &file, std::atomic<bool> *abort) {
   const bool is_remote = file.find("https://") == 0;
   const std::string local_file = is_remote ? cacheFilePath(file) : file;
   std::string result;
 
+  if (is_remote && cache_to_local_) {
+    if (auto data = DownloadCache::instance().pending(local_file)) {
+      return data;
+    }
+  }
+
   if ((!is_remote || cache_to_local_) && util::file_exists(local_file)) {
     result = util::read_file(local_file);
-  } else if (is_remote) {
-    result = download(file, abort);
-    if (cache_to_local_ && !result.empty()) {
-      std::ofstream fs(local_file, std::ios::binary | std::ios::out);
-      fs.write(result.data(), result.size());
+    if (is_remote) DownloadCache::instance().touch(local_file);
+  }
+  // An empty cache file is left over from an interrupted write, download it again
+  if (result.empty() && is_remote) {
+    auto data = std::make_shared<const std::string>(download(file, abort));
+    if (cache_to_local_ && !data->empty()) {
+      DownloadCache::instance().writeAsync(local_file, data);
     }
+    return data;
   }
-  return result;
+  return std::make_shared<const std::string>(std::move(result));
 }
 
 std::string FileReader::download(const std::string &url, std::atomic<bool> *abort) {
@@ -47,3 +209,31 @@ std::string FileReader::download(const std::string &url, std::atomic<bool> *abor
   }
   return {};
 }
+
+bool FileReader::stream(const std::string &url, std::atomic<bool> *abort, const std::function<void(const char *data, size_t size)> &on_data,
+                        const std::function<void()> &on_restart) {
+  std::string content;  // only kept for the download cache
+  for (int i = 0; i <= max_retries_ && !(abort && *abort); ++i) {
+    if (i > 0) {
+      rWarning("download failed, retrying %d", i);
+      util::sleep_for(3000);
+      content.clear();
+      on_restart();
+    }
+
+    bool success = httpStream(url, [&](const char *data, size_t size, size_t file_size) {
+      if (cache_to_local_) {
+        content.reserve(file_size);
+        content.append(data, size);
+      }
+      on_data(data, size);
+    }, abort);
+    if (success) {
+      if (cache_to_local_) {
+        DownloadCache::instance().writeAsync(cacheFilePath(url), std::make_shared<const std::string>(std::move(content)));
+      }
+      return true;
+    }
+  }
+  return false;
+}
@@ -1,14 +1,27 @@
 #pragma once
 
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 
 class FileReader {
 public:
   FileReader(bool cache_to_local, size_t chunk_size = 0, int retries = 3)
       : cache_to_local_(cache_to_local), chunk_size_(chunk_size), max_retries_(retries) {}
   virtual ~FileReader() {}
-  std::string read(const std::string &file, std::atomic<bool> *abort = nullptr);
+  // The content is shared with the cache writer rather than copied. Never null, empty on failure.
+  std::shared_ptr<const std::string> read(const std::string &file, std::atomic<bool> *abort = nullptr);
+  // Downloads a remote file and passes it to `on_data` as it arrives, without looking in the cache.
+  // A failed download is retried from the start after calling `on_restart`. The whole file is
+  // only held in memory to be written to the cache.
+  bool stream(const std::string &url, std::atomic<bool> *abort, const std::function<void(const char *data, size_t size)> &on_data,
+              const std::function<void()> &on_restart);
 
 private:
   std::string download(const std::string &url, std::atomic<bool> *abort);
@@ -17,4 +30,39 @@ private:
   bool cache_to_local_;
 };
 
+// Keeps the download cache within a byte budget. Files are written atomically on a background
+// thread and the least recently used ones are evicted first. The last access time is stored in
+// the file's mtime, so processes sharing the cache directory see each other's accesses.
+class DownloadCache {
+public:
+  static DownloadCache &instance();
+  ~DownloadCache();
+  const std::string &root() const { return root_; }
+  void setBudget(size_t bytes);
+
+  // Content of a file whose background write has not finished yet, nullptr otherwise
+  std::shared_ptr<const std::string> pending(const std::string &file);
+  void writeAsync(const std::string &file, std::shared_ptr<const std::string> data);
+  bool write(const std::string &file, const void *data, size_t size);
+  // Blocks until a pending write of the file has finished
+  void wait(const std::string &file);
+  void touch(const std::string &file);
+
+private:
+  DownloadCache();
+  void writerThread();
+  void evict();
+
+  std::string root_;
+  std::mutex lock_;
+  std::condition_variable cv_;
+  size_t budget_ = 20ULL * 1024 * 1024 * 1024;  // 20GB
+  size_t total_size_ = 0;
+  bool evict_requested_ = true;  // the initial scan measures the existing cache
+  bool exit_ = false;
+  std::deque<std::string> write_queue_;
+  std::unordered_map<std::string, std::shared_ptr<const std::string>> pending_;
+  std::thread thread_;
+};
+
 std::string cacheFilePath(const std::string &url);
@@ -1,24 +1,44 @@
 #include "tools/replay/framereader.h"
 
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <list>
 #include <map>
 #include <memory>
 #include <tuple>
 #include <utility>
 
+#include "common/timing.h"
 #include "common/util.h"
 #include "third_party/libyuv/include/libyuv.h"
+#include "tools/replay/logreader.h"
 #include "tools/replay/util.h"
 
 #ifdef __APPLE__
 #define HW_DEVICE_TYPE AV_HWDEVICE_TYPE_VIDEOTOOLBOX
-#define HW_PIX_FMT AV_PIX_FMT_VIDEOTOOLBOX
 #else
 #define HW_DEVICE_TYPE AV_HWDEVICE_TYPE_CUDA
-#define HW_PIX_FMT AV_PIX_FMT_CUDA
 #endif
 
 namespace {
 
+// Sidecar index of the packets in a video file, stored in the download cache
+constexpr char FRAME_INDEX_MAGIC[4] = {'R', 'F', 'I', 'X'};
+constexpr uint32_t FRAME_INDEX_VERSION = 1;
+
+struct FrameIndexHeader {
+  char magic[4];
+  uint32_t version;
+  char fingerprint[64];  // see dataFingerprint()
+  uint64_t count;
+};
+
+// Both are written to disk as they are in memory, with no implicit padding
+static_assert(sizeof(FrameIndexHeader) == 80 && sizeof(FrameReader::PacketInfo) == 16);
+
 enum AVPixelFormat get_hw_format(AVCodecContext *ctx, const enum AVPixelFormat *pix_fmts) {
   enum AVPixelFormat *hw_pix_fmt = reinterpret_cast<enum AVPixelFormat *>(ctx->opaque);
   for (const enum AVPixelFormat *p = pix_fmts; *p != -1; p++) {
@@ -29,28 +49,138 @@ enum AVPixelFormat get_hw_format(AVCodecContext *ctx, const enum AVPixelFormat *
   return AV_PIX_FMT_YUV420P;
 }
 
+// Decoders per (camera, width, height): enough for the segment being played, its prefetcher,
+// and a segment being seeked to
+const int MAX_DECODERS_PER_CAMERA = 3;
+
+// One decoder pool per (camera, width, height), shared by the readers of that camera and freed with its last reader
 struct DecoderManager {
-  VideoDecoder *acquire(CameraType type, AVCodecParameters *codecpar, bool hw_decoder) {
+  DecoderPool *acquire(CameraType type, AVCodecParameters *codecpar, bool hw_decoder) {
     auto key = std::tuple(type, codecpar->width, codecpar->height);
     std::unique_lock lock(mutex_);
-    if (auto it = decoders_.find(key); it != decoders_.end()) {
-      return it->second.get();
+    auto &[pool, readers] = pools_[key];
+    if (!pool) {
+      pool = std::make_unique<DecoderPool>(hw_decoder);
+      if (!pool->open(codecpar)) {
+        pools_.erase(key);
+        return nullptr;
+      }
     }
+    ++readers;
+    return pool.get();
+  }
 
-    auto decoder = std::make_unique<VideoDecoder>();
-    if (!decoder->open(codecpar, hw_decoder)) {
-      decoder.reset(nullptr);
+  void release(DecoderPool *pool) {
+    std::unique_lock lock(mutex_);
+    auto it = std::find_if(pools_.begin(), pools_.end(), [=](auto &p) { return p.second.first.get() == pool; });
+    assert(it != pools_.end());
+    if (--it->second.second == 0) {
+      pools_.erase(it);
     }
-    decoders_[key] = std::move(decoder);
-    return decoders_[key].get();
   }
 
   std::mutex mutex_;
-  std::map<std::tuple<CameraType, int, int>, std::unique_ptr<VideoDecoder>> decoders_;
+  std::map<std::tuple<CameraType, int, int>, std::pair<std::unique_ptr<DecoderPool>, int>> pools_;
 };
 
 DecoderManager decoder_manager;
 
+// LRU cache of decoded frames in compact NV12 (stride == width), shared by all readers under one memory budget
+class FrameCache {
+public:
+  void setBudget(size_t bytes) {
+    std::lock_guard lock(mutex_);
+    budget_ = bytes;
+    evict();
+  }
+
+  size_t budget() {
+    std::lock_guard lock(mutex_);
+    return budget_;
+  }
+
+  bool contains(const FrameReader *fr, int idx) {
+    std::lock_guard lock(mutex_);
+    return frames_.count({fr, idx}) > 0;
+  }
+
+  bool get(const FrameReader *fr, int idx, VisionBuf *buf) {
+    std::lock_guard lock(mutex_);
+    auto it = frames_.find({fr, idx});
+    if (it == frames_.end()) return false;
+
+    lru_.splice(lru_.begin(), lru_, it->second.first);
+    const uint8_t *data = it->second.second.data();
+    libyuv::CopyPlane(data, fr->width, buf->y, buf->stride, fr->width, fr->height);
+    libyuv::CopyPlane(data + fr->width * fr->height, fr->width, buf->uv, buf->stride, fr->width, fr->height / 2);
+    return true;
+  }
+
+  // Reuses the memory of evicted frames to avoid page faulting a fresh multi-MB buffer per frame
+  std::vector<uint8_t> allocate(size_t size) {
+    std::lock_guard lock(mutex_);
+    auto it = std::find_if(free_.begin(), free_.end(), [size](auto &buf) { return buf.size() == size; });
+    if (it == free_.end()) return std::vector<uint8_t>(size);
+
+    std::vector<uint8_t> buf = std::move(*it);
+    free_.erase(it);
+    return buf;
+  }
+
+  void put(const FrameReader *fr, int idx, std::vector<uint8_t> &&frame) {
+    std::lock_guard lock(mutex_);
+    Key key = {fr, idx};
+    if (auto it = frames_.find(key); it != frames_.end()) {
+      lru_.splice(lru_.begin(), lru_, it->second.first);
+      return;
+    }
+    size_ += frame.size();
+    lru_.push_front(key);
+    frames_.emplace(key, std::make_pair(lru_.begin(), std::move(frame)));
+    evict();
+  }
+
+  void remove(const FrameReader *fr) {
+    std::lock_guard lock(mutex_);
+    for (auto it = frames_.lower_bound({fr, INT_MIN}); it != frames_.end() && it->first.first == fr;) {
+      size_ -= it->second.second.size();
+      lru_.erase(it->second.first);
+      it = frames_.erase(it);
+    }
+  }
+
+private:
+  using Key = std::pair<const FrameReader *, int>;
+
+  void evict() {
+    while (size_ > budget_ && !lru_.empty()) {
+      auto it = frames_.find(lru_.back());
+      size_ -= it->second.second.size();
+      if (free_.size() < MAX_FREE_BUFFERS) free_.push_back(std::move(it->second.second));
+      frames_.erase(it);
+      lru_.pop_back();
+    }
+  }
+
+  static constexpr size_t MAX_FREE_BUFFERS = 8;
+  std::mutex mutex_;
+  std::list<Key> lru_;  // Most recently used first
+  std::map<Key, std::pair<std::list<Key>::iterator, std::vector<uint8_t>>> frames_;
+  std::vector<std::vector<uint8_t>> free_;
+  size_t size_ = 0;
+  size_t budget_ = 512 * 1024 * 1024;
+};
+
+FrameCache frame_cache;
+
+// The prefetcher looks this far ahead of the playback position
+const double PREFETCH_SECONDS = 0.5;
+const int MAX_PREFETCH_FRAMES = 40;
+// A prefetch thread exits after this long without requests, so only the readers being played keep one
+const auto PREFETCH_IDLE_TIMEOUT = std::chrono::seconds(2);
+// Readers with a running prefetch thread, which share the cache
+std::atomic<int> prefetching_readers = 0;
+
 }  // namespace
 
 FrameReader::FrameReader() {
@@ -58,27 +188,56 @@ FrameReader::FrameReader() {
 }
 
 FrameReader::~FrameReader() {
-  if (input_ctx) avformat_close_input(&input_ctx);
+  {
+    std::lock_guard lock(prefetch_lock_);
+    exit_ = true;
+  }
+  prefetch_cv_.notify_one();
+  if (prefetch_thread_.joinable()) prefetch_thread_.join();
+
+  frame_cache.remove(this);
+  if (decoders_) {
+    // A new reader may get the same address, so its streams must not look like continuations
+    decoders_->detach(&playback_);
+    decoders_->detach(&prefetch_);
+    decoder_manager.release(decoders_);
+  }
+  if (playback_.input_ctx) avformat_close_input(&playback_.input_ctx);
+  if (prefetch_.input_ctx) avformat_close_input(&prefetch_.input_ctx);
+}
+
+void FrameReader::setCacheBudget(size_t bytes) {
+  frame_cache.setBudget(bytes);
 }
 
 bool FrameReader::load(CameraType type, const std::string &url, bool no_hw_decoder, std::atomic<bool> *abort, bool local_cache, int chunk_size, int retries) {
-  auto local_file_path = url.find("https://") == 0 ? cacheFilePath(url) : url;
+  const bool is_remote = url.find("https://") == 0;
+  auto local_file_path = is_remote ? cacheFilePath(url) : url;
   if (!util::file_exists(local_file_path)) {
     FileReader f(local_cache, chunk_size, retries);
-    if (f.read(url, abort).empty()) {
+    if (f.read(url, abort)->empty()) {
       return false;
     }
+    // The decoder reads from disk, wait for the background cache write
+    DownloadCache::instance().wait(local_file_path);
+  } else if (is_remote) {
+    DownloadCache::instance().touch(local_file_path);
   }
-  return loadFromFile(type, local_file_path, no_hw_decoder, abort);
+  return loadFromFile(type, local_file_path, no_hw_decoder, abort, local_cache);
 }
 
-bool FrameReader::loadFromFile(CameraType type, const std::string &file, bool no_hw_decoder, std::atomic<bool> *abort) {
+bool FrameReader::loadFromFile(CameraType type, const std::string &file, bool no_hw_decoder, std::atomic<bool> *abort,
+                               bool cache_index) {
+  AVFormatContext *&input_ctx = playback_.input_ctx;
   if (avformat_open_input(&input_ctx, file.c_str(), nullptr, nullptr) != 0 ||
       avformat_find_stream_info(input_ctx, nullptr) < 0) {
     rError("Failed to open input file or find video stream");
     return false;
   }
   input_ctx->probesize = 10 * 1024 * 1024;  // 10MB
+  file_ = file;
+  type_ = type;
+  hw_decoder_ = !no_hw_decoder;
 
   video_stream_idx_ = av_find_best_stream(input_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
   if (video_stream_idx_ < 0) {
@@ -86,12 +245,24 @@ bool FrameReader::loadFromFile(CameraType type, const std::string &file, bool no
     return false;
   }
 
-  decoder_ = decoder_manager.acquire(type, input_ctx->streams[video_stream_idx_]->codecpar, !no_hw_decoder);
-  if (!decoder_) {
+  decoders_ = decoder_manager.acquire(type, input_ctx->streams[video_stream_idx_]->codecpar, hw_decoder_);
+  if (!decoders_) {
     return false;
   }
-  width = decoder_->width;
-  height = decoder_->height;
+  width = decoders_->width;
+  height = decoders_->height;
+
+  std::string index_file, fingerprint;
+  if (cache_index) {
+    MappedFile mapped;
+    if (mapped.open(file)) {
+      index_file = cacheFilePath(file) + ".fidx";
+      fingerprint = dataFingerprint(mapped.data(), mapped.size());
+      if (loadIndex(index_file, fingerprint)) {
+        return true;
+      }
+    }
+  }
 
   AVPacket pkt;
   packets_info.reserve(60 * 20);  // 20fps, one minute
@@ -102,14 +273,215 @@ bool FrameReader::loadFromFile(CameraType type, const std::string &file, bool no
     av_packet_unref(&pkt);
   }
   avio_seek(input_ctx->pb, 0, SEEK_SET);
+  if (abort && *abort) {
+    return false;
+  }
+  if (!index_file.empty() && !packets_info.empty()) {
+    writeIndex(index_file, fingerprint);
+  }
   return !packets_info.empty();
 }
 
+bool FrameReader::loadIndex(const std::string &index_file, const std::string &fingerprint) {
+  MappedFile index;
+  if (!index.open(index_file) || index.size() < sizeof(FrameIndexHeader)) return false;
+
+  const FrameIndexHeader *header = (const FrameIndexHeader *)index.data();
+  if (memcmp(header->magic, FRAME_INDEX_MAGIC, sizeof(FRAME_INDEX_MAGIC)) != 0 || header->version != FRAME_INDEX_VERSION ||
+      index.size() != sizeof(FrameIndexHeader) + header->count * sizeof(PacketInfo) || header->count == 0 ||
+      std::string(header->fingerprint, sizeof(header->fingerprint)) != fingerprint) {
+    rWarning("ignoring outdated frame index %s", index_file.c_str());
+    return false;
+  }
+
+  const PacketInfo *begin = (const PacketInfo *)(index.data() + sizeof(FrameIndexHeader));
+  packets_info.assign(begin, begin + header->count);
+  DownloadCache::instance().touch(index_file);
+  return true;
+}
+
+void FrameReader::writeIndex(const std::string &index_file, const std::string &fingerprint) {
+  FrameIndexHeader header = {.version = FRAME_INDEX_VERSION, .count = packets_info.size()};
+  memcpy(header.magic, FRAME_INDEX_MAGIC, sizeof(FRAME_INDEX_MAGIC));
+  memcpy(header.fingerprint, fingerprint.data(), sizeof(header.fingerprint));
+
+  std::string content((const char *)&header, sizeof(header));
+  content.append((const char *)packets_info.data(), packets_info.size() * sizeof(PacketInfo));
+  DownloadCache::instance().write(index_file, content.data(), content.size());
+}
+
 bool FrameReader::get(int idx, VisionBuf *buf) {
   if (!buf || idx < 0 || idx >= packets_info.size()) {
     return false;
   }
-  return decoder_->decode(this, idx, buf);
+  bool success = frame_cache.get(this, idx, buf) || decoders_->decode(this, &playback_, idx, buf);
+  if (success) {
+    schedulePrefetch(idx);
+  }
+  return success;
+}
+
+void FrameReader::schedulePrefetch(int idx) {
+  {
+    std::lock_guard lock(prefetch_lock_);
+    // Follow the playback direction, and look further ahead the faster frames are requested
+    double ts = millis_since_boot();
+    if (last_get_ts_ > 0) {
+      double interval = ts - last_get_ts_;
+      get_interval_ = get_interval_ > 0 ? 0.8 * get_interval_ + 0.2 * interval : interval;
+    }
+    prefetch_step_ = (last_get_idx_ >= 0 && idx < last_get_idx_) ? -1 : 1;
+    prefetch_depth_ = get_interval_ > 0 ? std::clamp<int>(PREFETCH_SECONDS * 1000 / get_interval_, 1, MAX_PREFETCH_FRAMES) : 1;
+    last_get_ts_ = ts;
+    last_get_idx_ = idx;
+
+    // Prefetched frames must stay cached until they are played, or every get() decodes from the key frame again.
+    // The prefetching readers share half of the cache, the other half holds the GOP and played frames.
+    const size_t frame_size = width * height * 3 / 2;
+    const int readers = prefetching_readers + !prefetch_running_;
+    prefetch_depth_ = std::min<size_t>(prefetch_depth_, frame_cache.budget() / 2 / readers / frame_size);
+    if (prefetch_depth_ < 1 || prefetch_failed_) return;
+
+    prefetch_idx_ = idx;
+    if (!prefetch_running_) {
+      if (prefetch_thread_.joinable()) prefetch_thread_.join();
+      prefetch_running_ = true;
+      ++prefetching_readers;
+      prefetch_thread_ = std::thread(&FrameReader::prefetchThread, this);
+    }
+  }
+  prefetch_cv_.notify_one();
+}
+
+void FrameReader::prefetchThread() {
+  std::unique_lock lock(prefetch_lock_);
+  while (prefetch_cv_.wait_for(lock, PREFETCH_IDLE_TIMEOUT, [this]() { return exit_ || prefetch_idx_ >= 0; }) && !exit_) {
+    const int idx = prefetch_idx_.exchange(-1);
+    const int step = prefetch_step_;
+    const int depth = prefetch_depth_;
+    lock.unlock();
+
+    if (!openPrefetchInput()) {
+      lock.lock();
+      prefetch_failed_ = true;
+      break;
+    }
+    // Stop early when a newer request arrives, so the prefetcher always follows the latest position
+    for (int i = 1; i <= depth && !exit_ && prefetch_idx_ < 0; ++i) {
+      int n = idx + i * step;
+      if (n < 0 || n >= packets_info.size()) break;
+      if (!frame_cache.contains(this, n) && !decoders_->decode(this, &prefetch_, n, nullptr)) break;
+    }
+    lock.lock();
+  }
+  prefetch_running_ = false;
+  --prefetching_readers;
+}
+
+bool FrameReader::openPrefetchInput() {
+  if (prefetch_.input_ctx) return true;
+
+  if (avformat_open_input(&prefetch_.input_ctx, file_.c_str(), nullptr, nullptr) != 0 ||
+      avformat_find_stream_info(prefetch_.input_ctx, nullptr) < 0) {
+    rWarning("Failed to open input file for prefetching");
+    if (prefetch_.input_ctx) avformat_close_input(&prefetch_.input_ctx);
+    return false;
+  }
+  return true;
+}
+
+// class DecoderPool
+
+DecoderPool::DecoderPool(bool hw_decoder) : max_decoders_(MAX_DECODERS_PER_CAMERA), hw_decoder_(hw_decoder) {
+  slots_.reserve(MAX_DECODERS_PER_CAMERA);
+}
+
+DecoderPool::~DecoderPool() {
+  if (codecpar_) avcodec_parameters_free(&codecpar_);
+}
+
+bool DecoderPool::open(AVCodecParameters *codecpar) {
+  auto decoder = std::make_unique<VideoDecoder>();
+  codecpar_ = avcodec_parameters_alloc();
+  if (!codecpar_ || avcodec_parameters_copy(codecpar_, codecpar) < 0 || !decoder->open(codecpar_, hw_decoder_)) {
+    return false;
+  }
+  width = decoder->width;
+  height = decoder->height;
+  slots_.push_back({.decoder = std::move(decoder)});
+  return true;
+}
+
+bool DecoderPool::decode(FrameReader *reader, FrameReader::DecodeState *state, int idx, VisionBuf *buf) {
+  VideoDecoder *decoder = checkout(state);
+  bool ret = decoder->decode(reader, state, idx, buf);
+  // After a failure the decoder may be anywhere in the stream
+  if (!ret) decoder->detach(state);
+  checkin(decoder, state);
+  return ret;
+}
+
+// Prefers the idle decoder continuing `state`, then an unused one, then opening another while under the limit,
+// so streams don't take each other's decoders and seek back to the key frame. Then the least recently used idle
+// decoder. When all decoders are busy, waits for one.
+VideoDecoder *DecoderPool::checkout(const FrameReader::DecodeState *state) {
+  std::unique_lock lock(mutex_);
+  while (true) {
+    Slot *continuing = nullptr, *unused = nullptr, *lru = nullptr;
+    for (auto &slot : slots_) {
+      if (slot.busy) continue;
+      if (slot.decoder->lastState() == state) continuing = &slot;
+      if (!slot.decoder->lastState()) unused = &slot;
+      if (!lru || slot.last_used < lru->last_used) lru = &slot;
+    }
+    const bool can_open = (int)slots_.size() + opening_ < max_decoders_;
+    if (Slot *slot = continuing ? continuing : unused ? unused : can_open ? nullptr : lru) {
+      slot->busy = true;
+      return slot->decoder.get();
+    }
+
+    if (can_open) {
+      ++opening_;
+      lock.unlock();
+      auto decoder = std::make_unique<VideoDecoder>();
+      bool opened = decoder->open(codecpar_, hw_decoder_);
+      lock.lock();
+      --opening_;
+      if (opened) {
+        slots_.push_back({.decoder = std::move(decoder), .busy = true});
+        return slots_.back().decoder.get();
+      }
+      // Make do with the decoders there are. The first one opened in open().
+      rWarning("Failed to open another decoder, sharing %zu", slots_.size());
+      max_decoders_ = slots_.size();
+      continue;
+    }
+    cv_.wait(lock);
+  }
+}
+
+void DecoderPool::checkin(VideoDecoder *decoder, const FrameReader::DecodeState *state) {
+  {
+    std::lock_guard lock(mutex_);
+    for (auto &slot : slots_) {
+      if (slot.decoder.get() == decoder) {
+        slot.busy = false;
+        slot.last_used = ++uses_;
+      } else if (!slot.busy) {
+        // Another decoder that had `state` no longer continues it
+        slot.decoder->detach(state);
+      }
+    }
+  }
+  cv_.notify_one();
+}
+
+void DecoderPool::detach(const FrameReader::DecodeState *state) {
+  std::lock_guard lock(mutex_);
+  // Busy decoders are decoding another stream, which replaces `state` as the one they continue
+  for (auto &slot : slots_) {
+    if (!slot.busy) slot.decoder->detach(state);
+  }
 }
 
 // class VideoDecoder
@@ -142,6 +514,13 @@ bool VideoDecoder::open(AVCodecParameters *codecpar, bool hw_decoder) {
     rWarning("No device with hardware decoder found. fallback to CPU decoding.");
   }
 
+  if (hw_pix_fmt == AV_PIX_FMT_NONE) {
+    // Software decoding: decode frames and slices in parallel. While the prefetcher keeps up, playback is served
+    // from the cache and only one decoder per camera is busy, so the cores are split between the cameras.
+    decoder_ctx->thread_count = std::clamp<int>(std::thread::hardware_concurrency() / MAX_CAMERAS, 1, 8);
+    decoder_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  }
+
   if (avcodec_open2(decoder_ctx, decoder, nullptr) < 0) {
     rError("Failed to open codec");
     return false;
@@ -175,83 +554,129 @@ bool VideoDecoder::initHardwareDecoder(AVHWDeviceType hw_device_type) {
   return true;
 }
 
-bool VideoDecoder::decode(FrameReader *reader, int idx, VisionBuf *buf) {
-  int current_idx = idx;
-  if (idx != reader->prev_idx + 1) {
-    // seeking to the nearest key frame
-    for (int i = idx; i >= 0; --i) {
-      if (reader->packets_info[i].flags & AV_PKT_FLAG_KEY) {
-        current_idx = i;
-        break;
-      }
+bool VideoDecoder::decode(FrameReader *reader, FrameReader::DecodeState *state, int idx, VisionBuf *buf) {
+  int key_idx = idx;
+  for (int i = idx; i >= 0; --i) {
+    if (reader->packets_info[i].flags & AV_PKT_FLAG_KEY) {
+      key_idx = i;
+      break;
     }
+  }
 
+  int current_idx = state->prev_idx + 1;
+  // The decoder is shared by the readers of a camera, so its state only continues the last stream.
+  // Within a GOP, decoding on from the previous frame is cheaper than going back to the key frame.
+  if (state != last_state_ || idx < current_idx || key_idx > current_idx) {
+    // seeking to the nearest key frame
+    current_idx = key_idx;
     auto pos = reader->packets_info[current_idx].pos;
-    int ret = avformat_seek_file(reader->input_ctx, 0, pos, pos, pos, AVSEEK_FLAG_BYTE);
+    int ret = avformat_seek_file(state->input_ctx, 0, pos, pos, pos, AVSEEK_FLAG_BYTE);
     if (ret < 0) {
       rError("Failed to seek to byte position %lld: %d", pos, AVERROR(ret));
+      last_state_ = nullptr;
       return false;
     }
     avcodec_flush_buffers(decoder_ctx);
   }
-  reader->prev_idx = idx;
+  state->prev_idx = idx;
+  last_state_ = state;
 
   AVPacket pkt;
-  while (av_read_frame(reader->input_ctx, &pkt) >= 0) {
-    // Skip non-video packets
-    if (pkt.stream_index != reader->video_stream_idx_) {
-      av_packet_unref(&pkt);
-      continue;
-    }
+  bool draining = false;
+  while (true) {
+    // Take every frame the decoder has ready before feeding more input. With frame threading,
+    // frames come out several packets after they went in.
+    bool error = false;
+    while (AVFrame *frame = receiveFrame(&error)) {
+      const int frame_idx = current_idx++;
+      if (frame_idx == idx && buf) {
+        // The requested frame goes straight into the VisionIPC buffer only
+        return copyBuffer(frame, buf->y, buf->uv, buf->stride, buf->len);
+      }
 
-    AVFrame *frame = decodeFrame(&pkt);
-    av_packet_unref(&pkt);
-    if (!frame) {
+      // Cache the frames decoded on the way to the requested one, so stepping backwards
+      // through the GOP doesn't decode it again. Without `buf`, the requested frame is cached too.
+      if (!frame_cache.contains(reader, frame_idx)) {
+        std::vector<uint8_t> nv12 = frame_cache.allocate(width * height * 3 / 2);
+        if (!copyBuffer(frame, nv12.data(), nv12.data() + width * height, width, nv12.size())) return false;
+        frame_cache.put(reader, frame_idx, std::move(nv12));
+      }
+      if (frame_idx == idx) return true;
+    }
+    if (error) {
       rError("Failed to decode frame at index %d", current_idx);
       return false;
     }
+    if (draining) break;
 
-    if (current_idx++ == idx) {
-      return copyBuffer(frame, buf);
+    int ret = av_read_frame(state->input_ctx, &pkt);
+    if (ret >= 0 && pkt.stream_index != reader->video_stream_idx_) {
+      av_packet_unref(&pkt);  // Skip non-video packets
+      continue;
+    }
+    if (ret < 0) {
+      // End of file: drain the frames still in flight. A drained decoder must be flushed before reuse.
+      draining = true;
+      last_state_ = nullptr;
+    }
+    ret = avcodec_send_packet(decoder_ctx, draining ? nullptr : &pkt);
+    if (!draining) av_packet_unref(&pkt);
+    if (ret < 0) {
+      rError("Error sending a packet for decoding: %d", ret);
+      return false;
     }
   }
   rError("Failed to find frame at index %d", idx);
   return false;
 }
 
-AVFrame *VideoDecoder::decodeFrame(AVPacket *pkt) {
-  int ret = avcodec_send_packet(decoder_ctx, pkt);
-  if (ret < 0) {
-    rError("Error sending a packet for decoding: %d", ret);
-    return nullptr;
+void VideoDecoder::detach(const FrameReader::DecodeState *state) {
+  // A new reader may get the same address, so its stream must not look like a continuation
+  if (last_state_ == state) {
+    avcodec_flush_buffers(decoder_ctx);
+    last_state_ = nullptr;
   }
+}
 
-  ret = avcodec_receive_frame(decoder_ctx, av_frame_);
+AVFrame *VideoDecoder::receiveFrame(bool *error) {
+  int ret = avcodec_receive_frame(decoder_ctx, av_frame_);
+  if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+    return nullptr;  // Needs more input
+  }
   if (ret != 0) {
     rError("avcodec_receive_frame error: %d", ret);
+    *error = true;
     return nullptr;
   }
 
-  if (av_frame_->format == hw_pix_fmt && av_hwframe_transfer_data(hw_frame_, av_frame_, 0) < 0) {
-    rError("error transferring frame data from GPU to CPU");
-    return nullptr;
-  }
-  return (av_frame_->format == hw_pix_fmt) ? hw_frame_ : av_frame_;
+  return av_frame_;
 }
 
-bool VideoDecoder::copyBuffer(AVFrame *f, VisionBuf *buf) {
-  if (hw_pix_fmt == HW_PIX_FMT) {
-    for (int i = 0; i < height/2; i++) {
-      memcpy(buf->y + (i*2 + 0)*buf->stride, f->data[0] + (i*2 + 0)*f->linesize[0], width);
-      memcpy(buf->y + (i*2 + 1)*buf->stride, f->data[0] + (i*2 + 1)*f->linesize[0], width);
-      memcpy(buf->uv + i*buf->stride, f->data[1] + i*f->linesize[1], width);
+bool VideoDecoder::copyBuffer(AVFrame *f, uint8_t *y, uint8_t *uv, int stride, size_t size) {
+  if (hw_pix_fmt != AV_PIX_FMT_NONE && f->format == hw_pix_fmt) {
+    // Download from the GPU straight into the destination planes, without a staging frame.
+    // The planes are wrapped in a buffer that doesn't own them. A VisionBuf may pad the rows
+    // and place the UV plane at its own offset, so the whole buffer of `size` bytes is wrapped.
+    av_frame_unref(hw_frame_);
+    hw_frame_->format = AV_PIX_FMT_NV12;
+    hw_frame_->width = f->width;
+    hw_frame_->height = f->height;
+    hw_frame_->data[0] = y;
+    hw_frame_->data[1] = uv;
+    hw_frame_->linesize[0] = hw_frame_->linesize[1] = stride;
+    hw_frame_->buf[0] = av_buffer_create(y, size, [](void *, uint8_t *) {}, nullptr, 0);
+    int ret = hw_frame_->buf[0] ? av_hwframe_transfer_data(hw_frame_, f, 0) : AVERROR(ENOMEM);
+    av_frame_unref(hw_frame_);
+    if (ret < 0) {
+      rError("error transferring frame data from GPU to CPU");
+      return false;
     }
   } else {
     libyuv::I420ToNV12(f->data[0], f->linesize[0],
                        f->data[1], f->linesize[1],
                        f->data[2], f->linesize[2],
-                       buf->y, buf->stride,
-                       buf->uv, buf->stride,
+                       y, stride,
+                       uv, stride,
                        width, height);
   }
   return true;
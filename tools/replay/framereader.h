@@ -1,6 +1,11 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "msgq/visionipc/visionbuf.h"
@@ -12,7 +17,7 @@ extern "C" {
 #include <libavformat/avformat.h>
 }
 
-class VideoDecoder;
+class DecoderPool;
 
 class FrameReader {
 public:
@@ -20,21 +25,58 @@ public:
   ~FrameReader();
   bool load(CameraType type, const std::string &url, bool no_hw_decoder = false, std::atomic<bool> *abort = nullptr, bool local_cache = false,
             int chunk_size = -1, int retries = 0);
-  bool loadFromFile(CameraType type, const std::string &file, bool no_hw_decoder = false, std::atomic<bool> *abort = nullptr);
+  // With `cache_index`, the packet index is kept in a sidecar file in the download cache,
+  // so later loads don't have to demux the whole file
+  bool loadFromFile(CameraType type, const std::string &file, bool no_hw_decoder = false, std::atomic<bool> *abort = nullptr,
+                    bool cache_index = false);
   bool get(int idx, VisionBuf *buf);
   size_t getFrameCount() const { return packets_info.size(); }
+  // Memory budget of the decoded frame cache shared by all readers
+  static void setCacheBudget(size_t bytes);
 
   int width = 0, height = 0;
 
-  VideoDecoder *decoder_ = nullptr;
-  AVFormatContext *input_ctx = nullptr;
+  // A decoding position in the file. Playback and the prefetcher decode with their own,
+  // so prefetching doesn't move the playback position.
+  struct DecodeState {
+    AVFormatContext *input_ctx = nullptr;
+    int prev_idx = -1;
+  };
+
+  DecoderPool *decoders_ = nullptr;
+  DecodeState playback_;
   int video_stream_idx_ = -1;
-  int prev_idx = -1;
   struct PacketInfo {
-    int flags;
+    int32_t flags;
+    int32_t reserved = 0;  // explicit padding, the index file is a copy of packets_info
     int64_t pos;
   };
   std::vector<PacketInfo> packets_info;
+
+private:
+  bool loadIndex(const std::string &index_file, const std::string &fingerprint);
+  void writeIndex(const std::string &index_file, const std::string &fingerprint);
+  void schedulePrefetch(int idx);
+  void prefetchThread();
+  bool openPrefetchInput();
+
+  std::string file_;
+  CameraType type_;
+  bool hw_decoder_ = false;
+
+  DecodeState prefetch_;
+  std::mutex prefetch_lock_;
+  std::condition_variable prefetch_cv_;
+  std::thread prefetch_thread_;
+  bool prefetch_running_ = false;
+  bool prefetch_failed_ = false;
+  std::atomic<bool> exit_ = false;
+  std::atomic<int> prefetch_idx_ = -1;
+  int prefetch_step_ = 1;
+  int prefetch_depth_ = 1;
+  int last_get_idx_ = -1;
+  double last_get_ts_ = 0;
+  double get_interval_ = 0;
 };
 
 
@@ -43,16 +85,54 @@ public:
   VideoDecoder();
   ~VideoDecoder();
   bool open(AVCodecParameters *codecpar, bool hw_decoder);
-  bool decode(FrameReader *reader, int idx, VisionBuf *buf);
+  // Decodes frame `idx` into `buf`, or only into the frame cache if `buf` is null
+  bool decode(FrameReader *reader, FrameReader::DecodeState *state, int idx, VisionBuf *buf);
+  // Called when `state` goes away while other readers still use the decoder
+  void detach(const FrameReader::DecodeState *state);
+  // The stream the decoder can continue without seeking
+  const FrameReader::DecodeState *lastState() const { return last_state_; }
   int width = 0, height = 0;
 
 private:
   bool initHardwareDecoder(AVHWDeviceType hw_device_type);
-  AVFrame *decodeFrame(AVPacket *pkt);
-  bool copyBuffer(AVFrame *f, VisionBuf *buf);
+  AVFrame *receiveFrame(bool *error);
+  bool copyBuffer(AVFrame *f, uint8_t *y, uint8_t *uv, int stride, size_t size);
+
+  const FrameReader::DecodeState *last_state_ = nullptr;
 
   AVFrame *av_frame_, *hw_frame_;
   AVCodecContext *decoder_ctx = nullptr;
   AVPixelFormat hw_pix_fmt = AV_PIX_FMT_NONE;
   AVBufferRef *hw_device_ctx = nullptr;
 };
+
+// The decoders of one (camera, width, height), shared by the readers of that camera and their prefetchers.
+// A decode checks out an idle decoder for its duration, so different readers decode concurrently.
+class DecoderPool {
+public:
+  DecoderPool(bool hw_decoder);
+  ~DecoderPool();
+  // Opens the first decoder
+  bool open(AVCodecParameters *codecpar);
+  bool decode(FrameReader *reader, FrameReader::DecodeState *state, int idx, VisionBuf *buf);
+  void detach(const FrameReader::DecodeState *state);
+  int width = 0, height = 0;
+
+private:
+  VideoDecoder *checkout(const FrameReader::DecodeState *state);
+  void checkin(VideoDecoder *decoder, const FrameReader::DecodeState *state);
+
+  struct Slot {
+    std::unique_ptr<VideoDecoder> decoder;
+    bool busy = false;
+    uint64_t last_used = 0;
+  };
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<Slot> slots_;
+  int opening_ = 0;
+  int max_decoders_;  // lowered when a decoder fails to open
+  uint64_t uses_ = 0;
+  AVCodecParameters *codecpar_ = nullptr;
+  const bool hw_decoder_;
+};
@@ -1,66 +1,456 @@
 #include "tools/replay/logreader.h"
 
 #include <algorithm>
+#include <capnp/schema.h>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <thread>
 #include <utility>
 #include "tools/replay/filereader.h"
 #include "tools/replay/util.h"
+#include "common/spsc_queue.h"
 #include "common/util.h"
 
+namespace {
+
+bool isBZ2(const std::string &url, const char *data, size_t size) {
+  return url.find(".bz2") != std::string::npos || (size >= 4 && memcmp(data, "BZh9", 4) == 0);
+}
+
+bool isZST(const std::string &url, const char *data, size_t size) {
+  return url.find(".zst") != std::string::npos || (size >= 4 && memcmp(data, "\x28\xB5\x2F\xFD", 4) == 0);
+}
+
+// Sidecar index of the events in a mapped log, stored next to the download cache entry
+constexpr char INDEX_MAGIC[4] = {'R', 'I', 'D', 'X'};
+constexpr uint32_t INDEX_VERSION = 1;
+
+struct IndexHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t data_size;
+  char fingerprint[64];  // sha256 of the source data, see dataFingerprint()
+  uint64_t count;
+};
+
+struct IndexEntry {
+  uint64_t mono_time;
+  uint64_t offset;  // in words from the beginning of the log
+  uint32_t length;  // in words
+  int32_t eidx_segnum;
+  uint16_t which;
+  uint16_t reserved[3];  // explicit padding, zero initialized so equal logs give equal files
+};
+
+// Both are written to disk as they are in memory, with no implicit padding
+static_assert(sizeof(IndexHeader) == 88 && sizeof(IndexEntry) == 32);
+
+// Maps local files and downloads remote ones. Returns a view over the raw, possibly compressed, content.
+std::string_view readContent(const std::string &url, MappedFile &file, std::shared_ptr<const std::string> &data,
+                             std::atomic<bool> *abort, bool local_cache, int chunk_size, int retries) {
+  if (url.find("https://") != 0 && file.open(url)) {
+    return {file.data(), file.size()};
+  }
+  data = FileReader(local_cache, chunk_size, retries).read(url, abort);
+  return *data;
+}
+
+// Collects decompressed bytes and hands out complete capnp messages. Only the trailing
+// partial message is kept between chunks, so memory is bounded by the largest message.
+class MessageScanner {
+public:
+  // Larger messages can't be read anyway. A corrupt size prefix would otherwise buffer the rest of the log.
+  static inline const size_t MAX_MESSAGE_WORDS = capnp::ReaderOptions().traversalLimitInWords;
+
+  template <typename Callback>
+  void feed(const char *data, size_t size, Callback &&callback) {
+    if (head_ > 0) {
+      memmove(buf_.data(), (char *)buf_.data() + head_, tail_ - head_);
+      tail_ -= head_;
+      head_ = 0;
+    }
+    size_t words_needed = (tail_ + size + sizeof(capnp::word) - 1) / sizeof(capnp::word);
+    if (buf_.size() < words_needed) {
+      buf_.resize(std::max(words_needed, buf_.size() * 2));
+    }
+    memcpy((char *)buf_.data() + tail_, data, size);
+    tail_ += size;
+
+    while (true) {
+      kj::ArrayPtr<const capnp::word> words((const capnp::word *)buf_.data() + head_ / sizeof(capnp::word),
+                                            (tail_ - head_) / sizeof(capnp::word));
+      if (words.size() == 0) break;
+      size_t message_size = capnp::expectedSizeInWordsFromPrefix(words);
+      KJ_REQUIRE(message_size <= MAX_MESSAGE_WORDS, "message too large", message_size);
+      if (message_size > words.size()) break;
+
+      callback(words.slice(0, message_size));
+      head_ += message_size * sizeof(capnp::word);
+    }
+  }
+
+  // Bytes of an incomplete message, which make the log corrupt if the input ends here
+  size_t pending() const { return tail_ - head_; }
+
+private:
+  std::vector<uint64_t> buf_;
+  size_t head_ = 0;
+  size_t tail_ = 0;
+};
+
+// Decompresses `content` through a bounded window and passes each complete message to `callback`
+template <typename Callback>
+bool streamMessages(const std::string &url, std::string_view content, std::atomic<bool> *abort, Callback &&callback) {
+  auto format = StreamDecompressor::Format::None;
+  if (isBZ2(url, content.data(), content.size())) {
+    format = StreamDecompressor::Format::BZ2;
+  } else if (isZST(url, content.data(), content.size())) {
+    format = StreamDecompressor::Format::ZST;
+  }
+
+  MessageScanner scanner;
+  StreamDecompressor decompressor(format, [&](const char *data, size_t size) { scanner.feed(data, size, callback); });
+  if (!decompressor.decompress(content.data(), content.size(), abort)) return false;
+  if (scanner.pending() > 0) {
+    rWarning("%s ends with %zu bytes of an incomplete message", url.c_str(), scanner.pending());
+    return false;
+  }
+  return true;
+}
+
+// Number of downloaded pieces that may wait for the decompressor before the download stalls.
+// Pieces are at most CURL_MAX_WRITE_SIZE (16KB), so this bounds the buffered download to a few MB.
+const int PIPELINE_QUEUE_SIZE = 256;
+
+// Content of a remote log in the download cache, either mapped or still waiting to be written
+std::string_view cachedContent(const std::string &url, MappedFile &file, std::shared_ptr<const std::string> &pending) {
+  const std::string local_file = cacheFilePath(url);
+  if ((pending = DownloadCache::instance().pending(local_file))) {
+    return *pending;
+  }
+  if (file.open(local_file) && file.size() > 0) {
+    DownloadCache::instance().touch(local_file);
+    return {file.data(), file.size()};
+  }
+  return {};
+}
+
+// Downloads a remote log on a separate thread while the calling thread decompresses and parses
+// the data that has already arrived. Each complete message is passed to `callback`.
+// Returns false if the download failed. `parsed` is set to false if the content is corrupt.
+template <typename Callback>
+bool pipelineMessages(const std::string &url, std::atomic<bool> *abort, bool local_cache, int chunk_size, int retries,
+                      bool *parsed, Callback &&callback) {
+  if (local_cache) {
+    MappedFile file;
+    std::shared_ptr<const std::string> pending;
+    if (std::string_view content = cachedContent(url, file, pending); !content.empty()) {
+      try {
+        *parsed = streamMessages(url, content, abort, callback);
+      } catch (const kj::Exception &e) {
+        rWarning("Failed to parse log : %s", e.getDescription().cStr());
+        *parsed = false;
+      }
+      return true;
+    }
+  }
+
+  // An empty piece restarts the file after a failed download, std::nullopt ends it
+  SPSCQueue<std::optional<std::string>> pieces(PIPELINE_QUEUE_SIZE);
+  bool downloaded = false;
+  std::thread downloader([&]() {
+    downloaded = FileReader(local_cache, chunk_size, retries).stream(url, abort,
+        [&](const char *data, size_t size) { pieces.push(std::string(data, size)); },
+        [&]() { pieces.push(std::string()); });
+    pieces.push(std::nullopt);
+  });
+
+  MessageScanner scanner;
+  std::unique_ptr<StreamDecompressor> decompressor;
+  bool success = true;
+  size_t messages = 0, skip = 0;
+  auto on_message = [&](auto words) {
+    if (messages++ >= skip) callback(words);
+  };
+  for (std::optional<std::string> piece = pieces.pop(); piece; piece = pieces.pop()) {
+    if (piece->empty()) {
+      // Only successful responses are passed on, so the failed download was a prefix of the same file.
+      // Start over and skip the messages that were already handed out.
+      skip = std::max(skip, messages);
+      messages = 0;
+      scanner = MessageScanner();
+      decompressor.reset();
+      success = true;
+      continue;
+    }
+    if (!success) continue;  // Keep draining so the downloader can finish
+
+    if (!decompressor) {
+      auto format = StreamDecompressor::Format::None;
+      if (isBZ2(url, piece->data(), piece->size())) {
+        format = StreamDecompressor::Format::BZ2;
+      } else if (isZST(url, piece->data(), piece->size())) {
+        format = StreamDecompressor::Format::ZST;
+      }
+      decompressor = std::make_unique<StreamDecompressor>(format, [&](const char *data, size_t size) {
+        scanner.feed(data, size, on_message);
+      });
+    }
+    try {
+      success = decompressor->decompress(piece->data(), piece->size(), abort);
+    } catch (const kj::Exception &e) {
+      rWarning("Failed to parse log : %s", e.getDescription().cStr());
+      success = false;
+    }
+  }
+  downloader.join();
+  if (success && downloaded && scanner.pending() > 0) {
+    rWarning("%s ends with %zu bytes of an incomplete message", url.c_str(), scanner.pending());
+    success = false;
+  }
+  *parsed = success;
+  return downloaded;
+}
+
+}  // namespace
+
 bool LogReader::load(const std::string &url, std::atomic<bool> *abort, bool local_cache, int chunk_size, int retries) {
-  std::string data = FileReader(local_cache, chunk_size, retries).read(url, abort);
-  if (!data.empty()) {
-    if (url.find(".bz2") != std::string::npos || util::starts_with(data, "BZh9")) {
-      data = decompressBZ2(data, abort);
-    } else if (url.find(".zst") != std::string::npos || util::starts_with(data, "\x28\xB5\x2F\xFD")) {
-      data = decompressZST(data, abort);
+  const std::string decompressed_file = (cache_decompressed_ && local_cache) ? cacheFilePath(url) + ".raw" : "";
+  const std::string index_file = local_cache ? cacheFilePath(url) + ".idx" : "";
+  if (!decompressed_file.empty() && mapped_.open(decompressed_file)) {
+    DownloadCache::instance().touch(decompressed_file);
+    return loadMapped(index_file, abort);
+  }
+
+  if (url.find("https://") == 0 && decompressed_file.empty()) {
+    // Decompress and parse while the log is still downloading. Events are copied out of the
+    // bounded decompression window as they are parsed.
+    bool parsed = false;
+    if (!pipelineMessages(url, abort, local_cache, chunk_size, retries, &parsed, [this](auto words) {
+          capnp::FlatArrayMessageReader reader(words);
+          addEvent(reader, words, true);
+        })) {
+      return false;
+    }
+    if (!parsed) {
+      rWarning("Retrieved %zu events from corrupt log %s", events.size(), url.c_str());
+    }
+    return finishLoad(abort);
+  }
+
+  std::shared_ptr<const std::string> downloaded;
+  std::string_view content = readContent(url, mapped_, downloaded, abort, local_cache, chunk_size, retries);
+  if (content.empty()) return false;
+
+  const bool bz2 = isBZ2(url, content.data(), content.size());
+  const bool zst = !bz2 && isZST(url, content.data(), content.size());
+  if (!bz2 && !zst && mapped_.isOpen()) {
+    // Uncompressed local log: build the events directly over the mapping
+    return loadMapped(index_file, abort);
+  }
+
+  if (!filters_.empty() && decompressed_file.empty()) {
+    // Only the filtered events are kept, so there is no need to hold the whole decompressed log
+    try {
+      if (!streamMessages(url, content, abort, [this](auto words) {
+            capnp::FlatArrayMessageReader reader(words);
+            addEvent(reader, words, true);
+          })) {
+        rWarning("Retrieved %zu events from corrupt log %s", events.size(), url.c_str());
+      }
+    } catch (const kj::Exception &e) {
+      rWarning("Failed to parse log : %s.\nRetrieved %zu events from corrupt log", e.getDescription().cStr(), events.size());
     }
+    mapped_.close();
+    return finishLoad(abort);
   }
 
-  bool success = !data.empty() && load(data.data(), data.size(), abort);
+  std::string data;
+  if (bz2) {
+    data = decompressBZ2((const std::byte *)content.data(), content.size(), abort);
+  } else if (zst) {
+    data = decompressZST((const std::byte *)content.data(), content.size(), abort);
+  }
+  mapped_.close();
+
+  // Keep the decompressed log on disk and map it, so the memory comes from the page cache
+  if ((bz2 || zst) && !data.empty() && !decompressed_file.empty() &&
+      DownloadCache::instance().write(decompressed_file, data.data(), data.size()) && mapped_.open(decompressed_file)) {
+    std::string().swap(data);
+    return loadMapped(index_file, abort);
+  }
+
+  // An uncompressed download is parsed in place, it may still be shared with the cache writer
+  auto raw = (bz2 || zst) ? std::make_shared<const std::string>(std::move(data)) : downloaded;
+  bool success = !raw->empty() && load(raw->data(), raw->size(), abort);
   if (filters_.empty())
-    raw_ = std::move(data);
+    raw_ = std::move(raw);
   return success;
 }
 
+bool LogReader::loadMapped(const std::string &index_file, std::atomic<bool> *abort) {
+  if (!index_file.empty() && loadIndex(index_file)) {
+    DownloadCache::instance().touch(index_file);
+    return true;
+  }
+
+  bool success = load(mapped_.data(), mapped_.size(), abort);
+  if (success && filters_.empty() && !index_file.empty()) {
+    writeIndex(index_file);
+  }
+  return success;
+}
+
+bool LogReader::loadIndex(const std::string &index_file) {
+  MappedFile index;
+  if (!index.open(index_file) || index.size() < sizeof(IndexHeader)) return false;
+
+  const IndexHeader *header = (const IndexHeader *)index.data();
+  if (memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || header->version != INDEX_VERSION ||
+      header->data_size != mapped_.size() || index.size() != sizeof(IndexHeader) + header->count * sizeof(IndexEntry) ||
+      std::string(header->fingerprint, sizeof(header->fingerprint)) != dataFingerprint(mapped_.data(), mapped_.size())) {
+    rWarning("ignoring outdated event index %s", index_file.c_str());
+    return false;
+  }
+
+  static const size_t event_types = capnp::Schema::from<cereal::Event>().asStruct().getUnionFields().size();
+  const capnp::word *words = (const capnp::word *)mapped_.data();
+  const size_t total_words = mapped_.size() / sizeof(capnp::word);
+  const IndexEntry *entries = (const IndexEntry *)(index.data() + sizeof(IndexHeader));
+  events.reserve(header->count);
+  for (const IndexEntry *entry = entries; entry != entries + header->count; ++entry) {
+    // The fingerprint only samples the log, so each entry must also frame a whole message of a known type
+    if (entry->offset >= total_words || entry->length > total_words - entry->offset || entry->which >= event_types ||
+        capnp::expectedSizeInWordsFromPrefix(kj::arrayPtr(words + entry->offset, total_words - entry->offset)) != entry->length) {
+      rWarning("ignoring invalid event index %s", index_file.c_str());
+      events.clear();
+      requires_migration = true;
+      return false;
+    }
+    if (entry->which == cereal::Event::Which::SELFDRIVE_STATE) {
+      requires_migration = false;
+    }
+    if (filters_.empty() || (entry->which < filters_.size() && filters_[entry->which])) {
+      events.emplace_back((cereal::Event::Which)entry->which, entry->mono_time,
+                          kj::arrayPtr(words + entry->offset, entry->length), entry->eidx_segnum);
+    }
+  }
+
+  // The index is already sorted. Only migrated events need to be merged in.
+  if (requires_migration) {
+    migrateOldEvents();
+    std::sort(events.begin(), events.end());
+  }
+  return !events.empty();
+}
+
+void LogReader::writeIndex(const std::string &index_file) {
+  const capnp::word *begin = (const capnp::word *)mapped_.data();
+  const capnp::word *end = begin + mapped_.size() / sizeof(capnp::word);
+
+  IndexHeader header = {.version = INDEX_VERSION, .data_size = mapped_.size()};
+  memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  std::string fingerprint = dataFingerprint(mapped_.data(), mapped_.size());
+  memcpy(header.fingerprint, fingerprint.data(), sizeof(header.fingerprint));
+
+  std::string content(sizeof(IndexHeader), '\0');
+  content.reserve(sizeof(IndexHeader) + events.size() * sizeof(IndexEntry));
+  for (const Event &e : events) {
+    // Migrated events live outside of the mapping and are rebuilt when the index is loaded
+    if (e.data.begin() < begin || e.data.end() > end) continue;
+
+    IndexEntry entry = {
+        .mono_time = e.mono_time,
+        .offset = (uint64_t)(e.data.begin() - begin),
+        .length = (uint32_t)e.data.size(),
+        .eidx_segnum = e.eidx_segnum,
+        .which = (uint16_t)e.which,
+    };
+    content.append((const char *)&entry, sizeof(entry));
+    ++header.count;
+  }
+  memcpy(content.data(), &header, sizeof(header));
+
+  DownloadCache::instance().write(index_file, content.data(), content.size());
+}
+
+bool LogReader::stream(const std::string &url, const std::function<void(const Event &)> &callback,
+                       std::atomic<bool> *abort, bool local_cache, int chunk_size, int retries) {
+  auto on_message = [&](auto words) {
+    capnp::FlatArrayMessageReader reader(words);
+    auto event = reader.getRoot<cereal::Event>();
+    if (filters_.empty() || (event.which() < filters_.size() && filters_[event.which()])) {
+      callback(Event(event.which(), event.getLogMonoTime(), words));
+    }
+  };
+  if (url.find("https://") == 0) {
+    bool parsed = false;
+    return pipelineMessages(url, abort, local_cache, chunk_size, retries, &parsed, on_message) && parsed;
+  }
+
+  MappedFile file;
+  std::shared_ptr<const std::string> data;
+  std::string_view content = readContent(url, file, data, abort, local_cache, chunk_size, retries);
+  if (content.empty()) return false;
+
+  try {
+    return streamMessages(url, content, abort, on_message);
+  } catch (const kj::Exception &e) {
+    rWarning("Failed to parse log : %s", e.getDescription().cStr());
+  }
+  return false;
+}
+
 bool LogReader::load(const char *data, size_t size, std::atomic<bool> *abort) {
+  // Filtered events are copied out unless the data is backed by the mapping, which outlives the events
+  const bool copy_filtered = !filters_.empty() && (!mapped_.isOpen() || data != mapped_.data());
   try {
     events.reserve(65000);
     kj::ArrayPtr<const capnp::word> words((const capnp::word *)data, size / sizeof(capnp::word));
     while (words.size() > 0 && !(abort && *abort)) {
       capnp::FlatArrayMessageReader reader(words);
-      auto event = reader.getRoot<cereal::Event>();
-      auto which = event.which();
       auto event_data = kj::arrayPtr(words.begin(), reader.getEnd());
       words = kj::arrayPtr(reader.getEnd(), words.end());
-      if (which == cereal::Event::Which::SELFDRIVE_STATE) {
-        requires_migration = false;
-      }
-
-      if (!filters_.empty()) {
-        if (which >= filters_.size() || !filters_[which])
-          continue;
-        auto buf = buffer_.allocate(event_data.size() * sizeof(capnp::word));
-        memcpy(buf, event_data.begin(), event_data.size() * sizeof(capnp::word));
-        event_data = kj::arrayPtr((const capnp::word *)buf, event_data.size());
-      }
-
-      uint64_t mono_time = event.getLogMonoTime();
-      const Event &evt = events.emplace_back(which, mono_time, event_data);
-      // Add encodeIdx packet again as a frame packet for the video stream
-      if (evt.which == cereal::Event::ROAD_ENCODE_IDX ||
-          evt.which == cereal::Event::DRIVER_ENCODE_IDX ||
-          evt.which == cereal::Event::WIDE_ROAD_ENCODE_IDX) {
-        auto idx = capnp::AnyStruct::Reader(event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
-        if (idx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C) {
-          uint64_t sof = idx.getTimestampSof();
-          events.emplace_back(which, sof ? sof : mono_time, event_data, idx.getSegmentNum());
-        }
-      }
+      addEvent(reader, event_data, copy_filtered);
     }
   } catch (const kj::Exception &e) {
     rWarning("Failed to parse log : %s.\nRetrieved %zu events from corrupt log", e.getDescription().cStr(), events.size());
   }
+  return finishLoad(abort);
+}
+
+void LogReader::addEvent(capnp::MessageReader &reader, kj::ArrayPtr<const capnp::word> event_data, bool copy) {
+  auto event = reader.getRoot<cereal::Event>();
+  auto which = event.which();
+  if (which == cereal::Event::Which::SELFDRIVE_STATE) {
+    requires_migration = false;
+  }
+
+  if (!filters_.empty() && (which >= filters_.size() || !filters_[which])) {
+    return;
+  }
+  if (copy) {
+    auto buf = buffer_.allocate(event_data.size() * sizeof(capnp::word));
+    memcpy(buf, event_data.begin(), event_data.size() * sizeof(capnp::word));
+    event_data = kj::arrayPtr((const capnp::word *)buf, event_data.size());
+  }
+
+  uint64_t mono_time = event.getLogMonoTime();
+  const Event &evt = events.emplace_back(which, mono_time, event_data);
+  // Add encodeIdx packet again as a frame packet for the video stream
+  if (evt.which == cereal::Event::ROAD_ENCODE_IDX ||
+      evt.which == cereal::Event::DRIVER_ENCODE_IDX ||
+      evt.which == cereal::Event::WIDE_ROAD_ENCODE_IDX) {
+    auto idx = capnp::AnyStruct::Reader(event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
+    if (idx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C) {
+      uint64_t sof = idx.getTimestampSof();
+      events.emplace_back(which, sof ? sof : mono_time, event_data, idx.getSegmentNum());
+    }
+  }
+}
 
+bool LogReader::finishLoad(std::atomic<bool> *abort) {
   if (requires_migration) {
     migrateOldEvents();
   }
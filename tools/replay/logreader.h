@@ -1,5 +1,7 @@
 #pragma once
 
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -26,17 +28,29 @@ public:
 
 class LogReader {
 public:
-  LogReader(const std::vector<bool> &filters = {}) { filters_ = filters; }
+  LogReader(const std::vector<bool> &filters = {}, bool cache_decompressed = false)
+      : filters_(filters), cache_decompressed_(cache_decompressed) {}
   bool load(const std::string &url, std::atomic<bool> *abort = nullptr,
             bool local_cache = false, int chunk_size = -1, int retries = 0);
   bool load(const char *data, size_t size, std::atomic<bool> *abort = nullptr);
+  // Decompresses and parses the log in a bounded window, passing each (filtered) event to the callback
+  // as soon as it is available. Event::data is only valid during the callback and no events are kept.
+  bool stream(const std::string &url, const std::function<void(const Event &)> &callback, std::atomic<bool> *abort = nullptr,
+              bool local_cache = false, int chunk_size = -1, int retries = 0);
   std::vector<Event> events;
 
 private:
+  bool loadMapped(const std::string &index_file, std::atomic<bool> *abort);
+  bool loadIndex(const std::string &index_file);
+  void writeIndex(const std::string &index_file);
+  void addEvent(capnp::MessageReader &reader, kj::ArrayPtr<const capnp::word> event_data, bool copy);
+  bool finishLoad(std::atomic<bool> *abort);
   void migrateOldEvents();
 
-  std::string raw_;
+  std::shared_ptr<const std::string> raw_;
+  MappedFile mapped_;
   bool requires_migration = true;
   std::vector<bool> filters_;
+  bool cache_decompressed_ = false;
   MonotonicBuffer buffer_{1024 * 1024};
 };
@@ -3,10 +3,12 @@
 #include <iostream>
 #include <map>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "common/prefix.h"
 #include "tools/replay/consoleui.h"
+#include "tools/replay/filereader.h"
 #include "tools/replay/replay.h"
 #include "tools/replay/util.h"
 
@@ -16,8 +18,15 @@ Options:
   -a, --allow        Whitelist of services to send (comma-separated)
   -b, --block        Blacklist of services to send (comma-separated)
   -c, --cache        Cache <n> segments in memory. Default is 5
+      --loader-threads Load segments with <n> worker threads
   -s, --start        Start from <seconds>
   -x, --playback     Playback <speed>
+      --full-speed   Publish as fast as the subscribers can take messages, without real-time pacing
+      --lockstep     Publish one message or frame at a time, until the <consumers> acknowledge it.
+                     Comma-separated <name>[:<service>+<service>...], without services a consumer
+                     subscribes to all of them. Each step is announced as "<step> <service>" on the
+                     replayStep socket, and waits for "<name> <step>" on the replayAck socket from
+                     every consumer subscribed to <service>. Other acks are ignored
       --demo         Use a demo route instead of providing your own
       --auto         Auto load the route from the best available source (no video):
                      internal, openpilotci, comma_api, car_segments, testing_closet
@@ -27,6 +36,8 @@ Options:
       --ecam         Load wide road camera
       --no-loop      Stop at the end of the route
       --no-cache     Turn off local cache
+      --disk-cache   Limit the download cache to <MB> megabytes, least recently used files are removed first
+      --decompressed-cache Cache decompressed logs on disk and mmap them
       --qcam         Load qcamera
       --no-hw-decoder Disable HW video decoding
       --no-vipc      Do not output video
@@ -38,22 +49,38 @@ struct ReplayConfig {
   std::string route;
   std::vector<std::string> allow;
   std::vector<std::string> block;
+  std::unordered_map<std::string, std::vector<std::string>> lockstep;  // consumer, services
   std::string data_dir;
   std::string prefix;
   uint32_t flags = REPLAY_FLAG_NONE;
   bool auto_source = false;
   int start_seconds = 0;
   int cache_segments = -1;
+  int loader_threads = -1;
+  int disk_cache_mb = -1;
   float playback_speed = -1;
 };
 
+// <name>[:<service>+<service>...],...
+std::unordered_map<std::string, std::vector<std::string>> parseLockstep(const std::string &arg) {
+  std::unordered_map<std::string, std::vector<std::string>> consumers;
+  for (const auto &consumer : split(arg, ',')) {
+    size_t pos = consumer.find(':');
+    consumers[consumer.substr(0, pos)] = pos == std::string::npos ? std::vector<std::string>{} : split(consumer.substr(pos + 1), '+');
+  }
+  return consumers;
+}
+
 bool parseArgs(int argc, char *argv[], ReplayConfig &config) {
   const struct option cli_options[] = {
       {"allow", required_argument, nullptr, 'a'},
       {"block", required_argument, nullptr, 'b'},
       {"cache", required_argument, nullptr, 'c'},
+      {"loader-threads", required_argument, nullptr, 0},
       {"start", required_argument, nullptr, 's'},
       {"playback", required_argument, nullptr, 'x'},
+      {"full-speed", no_argument, nullptr, 0},
+      {"lockstep", required_argument, nullptr, 0},
       {"demo", no_argument, nullptr, 0},
       {"auto", no_argument, nullptr, 0},
       {"data_dir", required_argument, nullptr, 'd'},
@@ -62,6 +89,8 @@ bool parseArgs(int argc, char *argv[], ReplayConfig &config) {
       {"ecam", no_argument, nullptr, 0},
       {"no-loop", no_argument, nullptr, 0},
       {"no-cache", no_argument, nullptr, 0},
+      {"disk-cache", required_argument, nullptr, 0},
+      {"decompressed-cache", no_argument, nullptr, 0},
       {"qcam", no_argument, nullptr, 0},
       {"no-hw-decoder", no_argument, nullptr, 0},
       {"no-vipc", no_argument, nullptr, 0},
@@ -75,10 +104,12 @@ bool parseArgs(int argc, char *argv[], ReplayConfig &config) {
       {"ecam", REPLAY_FLAG_ECAM},
       {"no-loop", REPLAY_FLAG_NO_LOOP},
       {"no-cache", REPLAY_FLAG_NO_FILE_CACHE},
+      {"decompressed-cache", REPLAY_FLAG_DECOMPRESSED_CACHE},
       {"qcam", REPLAY_FLAG_QCAMERA},
       {"no-hw-decoder", REPLAY_FLAG_NO_HW_DECODER},
       {"no-vipc", REPLAY_FLAG_NO_VIPC},
       {"all", REPLAY_FLAG_ALL_SERVICES},
+      {"full-speed", REPLAY_FLAG_FULL_SPEED},
   };
 
   if (argc == 1) {
@@ -100,6 +131,9 @@ bool parseArgs(int argc, char *argv[], ReplayConfig &config) {
         std::string name = cli_options[option_index].name;
         if (name == "demo") config.route = DEMO_ROUTE;
         else if (name == "auto") config.auto_source = true;
+        else if (name == "loader-threads") config.loader_threads = std::atoi(optarg);
+        else if (name == "disk-cache") config.disk_cache_mb = std::atoi(optarg);
+        else if (name == "lockstep") config.lockstep = parseLockstep(optarg);
         else config.flags |= flag_map.at(name);
         break;
       }
@@ -138,16 +172,26 @@ int main(int argc, char *argv[]) {
     op_prefix = std::make_unique<OpenpilotPrefix>(config.prefix);
   }
 
+  if (config.disk_cache_mb > 0) {
+    DownloadCache::instance().setBudget((size_t)config.disk_cache_mb * 1024 * 1024);
+  }
+
   Replay replay(config.route, config.allow, config.block, nullptr, config.flags, config.data_dir, config.auto_source);
   if (config.cache_segments > 0) {
     replay.setSegmentCacheLimit(config.cache_segments);
   }
+  if (config.loader_threads > 0) {
+    replay.setLoaderThreads(config.loader_threads);
+  }
   if (config.playback_speed > 0) {
     replay.setSpeed(std::clamp(config.playback_speed, ConsoleUI::speed_array.front(), ConsoleUI::speed_array.back()));
   }
   if (!replay.load()) {
     return 1;
   }
+  if (!config.lockstep.empty()) {
+    replay.setLockstep(config.lockstep);
+  }
 
   ConsoleUI console_ui(&replay);
   replay.start(config.start_seconds);
@@ -1,13 +1,19 @@
 #include "tools/replay/replay.h"
 
 #include <capnp/dynamic.h>
+#include <cassert>
 #include <csignal>
+#include <cstdlib>
 #include "cereal/services.h"
 #include "common/params.h"
 #include "tools/replay/util.h"
 
 static void interrupt_sleep_handler(int signal) {}
 
+// In full speed mode, wait for the subscribers once a socket has this much unread data
+const size_t MAX_PENDING_BYTES = 1024 * 1024;
+const int64_t MAX_SUBSCRIBER_WAIT_NS = 100 * 1e6;
+
 // Helper function to notify events with safety checks
 template <typename Callback, typename... Args>
 void notifyEvent(Callback &callback, Args &&...args) {
@@ -29,6 +35,7 @@ Replay::Replay(const std::string &route, std::vector<std::string> allow, std::ve
 void Replay::setupServices(const std::vector<std::string> &allow, const std::vector<std::string> &block) {
   auto event_schema = capnp::Schema::from<cereal::Event>().asStruct();
   sockets_.resize(event_schema.getUnionFields().size(), nullptr);
+  pending_bytes_.resize(sockets_.size(), 0);
 
   std::vector<const char *> active_services;
   for (const auto &[name, _] : services) {
@@ -69,6 +76,10 @@ Replay::~Replay() {
     stream_thread_.join();
     rInfo("shutdown: done");
   }
+  exit_ = true;
+  if (ack_thread_.joinable()) {
+    ack_thread_.join();
+  }
   camera_server_.reset();
 }
 
@@ -86,7 +97,11 @@ void Replay::interruptStream(const std::function<bool()> &update_fn) {
     pthread_kill(stream_thread_id, SIGUSR1);  // Interrupt sleep in stream thread
   }
   {
+    std::lock_guard lock(ack_lock_);
     interrupt_requested_ = true;
+  }
+  ack_cv_.notify_all();  // Wake up the stream thread waiting for acknowledgements
+  {
     std::unique_lock lock(stream_lock_);
     events_ready_ = update_fn();
     interrupt_requested_ = user_paused_;
@@ -212,41 +227,183 @@ void Replay::startStream(const std::shared_ptr<Segment> segment) {
   stream_thread_ = std::thread(&Replay::streamThread, this);
 }
 
-void Replay::publishMessage(const Event *e) {
-  if (event_filter_ && event_filter_(e)) return;
+bool Replay::publishMessage(const Event *e) {
+  if (event_filter_ && event_filter_(e)) return false;
 
   if (!sm_) {
     auto bytes = e->data.asBytes();
+    if (hasFlag(REPLAY_FLAG_FULL_SPEED)) {
+      waitForSubscribers(e->which, bytes.size());
+    }
     int ret = pm_->send(sockets_[e->which], (capnp::byte *)bytes.begin(), bytes.size());
     if (ret == -1) {
       rWarning("stop publishing %s due to multiple publishers error", sockets_[e->which]);
       sockets_[e->which] = nullptr;
+      return false;
     }
   } else {
     capnp::FlatArrayMessageReader reader(e->data);
     auto event = reader.getRoot<cereal::Event>();
     sm_->update_msgs(nanos_since_boot(), {{sockets_[e->which], event}});
   }
+  return true;
+}
+
+void Replay::waitForSubscribers(int which, size_t bytes) {
+  // Without pacing, a publisher can overrun the subscriber queues. Wait until every reader has
+  // caught up, but not forever, so a subscriber that never reads doesn't stall the replay.
+  if (pending_bytes_[which] + bytes > MAX_PENDING_BYTES) {
+    for (int64_t waited = 0; waited < MAX_SUBSCRIBER_WAIT_NS && !interrupt_requested_; waited += 100000) {
+      if (pm_->allReadersUpdated(sockets_[which])) break;
+      precise_nano_sleep(100000, interrupt_requested_);
+    }
+    pending_bytes_[which] = 0;
+  }
+  pending_bytes_[which] += bytes;
 }
 
-void Replay::publishFrame(const Event *e) {
+void Replay::logThroughput(bool force) {
+  const uint64_t current_nanos = nanos_since_boot();
+  if (throughput_start_ts_ == 0) {
+    throughput_start_ts_ = current_nanos;
+    return;
+  }
+
+  const double elapsed = (current_nanos - throughput_start_ts_) / 1e9;
+  if ((force && elapsed > 0) || elapsed >= 5.0) {
+    rInfo("published %.0f events/s, %.2f MB/s", published_events_ / elapsed, published_bytes_ / elapsed / (1024 * 1024));
+    published_events_ = published_bytes_ = 0;
+    throughput_start_ts_ = current_nanos;
+  }
+}
+
+bool Replay::publishFrame(const Event *e) {
   CameraType cam;
   switch (e->which) {
     case cereal::Event::ROAD_ENCODE_IDX: cam = RoadCam; break;
     case cereal::Event::DRIVER_ENCODE_IDX: cam = DriverCam; break;
     case cereal::Event::WIDE_ROAD_ENCODE_IDX: cam = WideRoadCam; break;
-    default: return;  // Invalid event type
+    default: return false;  // Invalid event type
   }
 
   if ((cam == DriverCam && !hasFlag(REPLAY_FLAG_DCAM)) || (cam == WideRoadCam && !hasFlag(REPLAY_FLAG_ECAM)))
-    return;  // Camera isdisabled
+    return false;  // Camera isdisabled
 
   auto seg_it = event_data_->segments.find(e->eidx_segnum);
   if (seg_it != event_data_->segments.end()) {
     if (auto &frame = seg_it->second->frames[cam]; frame) {
       camera_server_->pushFrame(cam, frame.get(), e);
+      return true;
+    }
+  }
+  return false;
+}
+
+void Replay::setLockstep(const std::unordered_map<std::string, std::vector<std::string>> &consumers) {
+  for (const auto &[consumer, subscriptions] : consumers) {
+    for (const auto &service : subscriptions) {
+      if (services.count(service) == 0) {
+        rWarning("lockstep: consumer '%s' subscribes to unknown service '%s'", consumer.c_str(), service.c_str());
+      }
+    }
+  }
+  if (!consumers.empty() && !step_socket_) {
+    step_context_.reset(Context::create());
+    // Not cereal services, the messages are raw text
+    step_socket_.reset(PubSocket::create(step_context_.get(), LOCKSTEP_STEP_ENDPOINT, false));
+    assert(step_socket_ != nullptr);
+  }
+  interruptStream([&]() {
+    std::lock_guard lock(ack_lock_);
+    lockstep_consumers_.clear();
+    for (const auto &[consumer, subscriptions] : consumers) {
+      lockstep_consumers_[consumer].services.insert(subscriptions.begin(), subscriptions.end());
+    }
+    return !user_paused_;
+  });
+  if (!consumers.empty() && !ack_thread_.joinable()) {
+    ack_thread_ = std::thread(&Replay::ackThread, this);
+  }
+}
+
+void Replay::ack(const std::string &consumer, uint64_t step) {
+  {
+    std::lock_guard lock(ack_lock_);
+    auto it = lockstep_consumers_.find(consumer);
+    if (it == lockstep_consumers_.end()) {
+      rWarning("lockstep: ignoring ack from unknown consumer '%s'", consumer.c_str());
+      return;
+    }
+    auto &c = it->second;
+    if (step != waiting_step_ || step == 0) {
+      rWarning("lockstep: ignoring %s ack of step %lu from '%s'", step <= last_step_ ? "stale" : "unknown", step, consumer.c_str());
+      return;
+    }
+    if (!c.services.empty() && c.services.count(waiting_service_) == 0) {
+      rWarning("lockstep: ignoring ack of step %lu from '%s', which is not subscribed to %s", step, consumer.c_str(),
+               waiting_service_.c_str());
+      return;
     }
+    if (c.acked_step == step) {
+      rWarning("lockstep: ignoring duplicate ack of step %lu from '%s'", step, consumer.c_str());
+      return;
+    }
+    c.acked_step = step;
   }
+  ack_cv_.notify_one();
+}
+
+void Replay::ackThread() {
+  std::unique_ptr<Context> context(Context::create());
+  // Not a cereal service, the messages are raw text
+  std::unique_ptr<SubSocket> socket(SubSocket::create(context.get(), LOCKSTEP_ACK_ENDPOINT, "127.0.0.1", false, false));
+  assert(socket != nullptr);
+  socket->setTimeout(100);
+
+  while (!exit_) {
+    std::unique_ptr<Message> msg(socket->receive());
+    if (!msg) continue;
+
+    std::string ack_msg(msg->getData(), msg->getSize());
+    size_t pos = ack_msg.rfind(' ');
+    char *end = nullptr;
+    uint64_t step = pos != std::string::npos ? std::strtoull(ack_msg.c_str() + pos + 1, &end, 10) : 0;
+    if (pos == std::string::npos || pos == 0 || end == ack_msg.c_str() + pos + 1 || *end != '\0') {
+      rWarning("lockstep: ignoring malformed ack '%s', expected '<consumer> <step>'", ack_msg.c_str());
+      continue;
+    }
+    ack(ack_msg.substr(0, pos), step);
+  }
+}
+
+void Replay::waitForAcks(const std::string &service) {
+  // Frames are acknowledged after they are delivered
+  if (camera_server_) {
+    camera_server_->waitForSent();
+  }
+
+  auto subscribed = [&](const auto &c) { return c.second.services.empty() || c.second.services.count(service) > 0; };
+  uint64_t step;
+  {
+    std::lock_guard lock(ack_lock_);
+    if (std::none_of(lockstep_consumers_.begin(), lockstep_consumers_.end(), subscribed)) return;
+
+    step = waiting_step_ = ++last_step_;
+    waiting_service_ = service;
+  }
+  // Announced without the lock, so in-process consumers can ack from the callback
+  std::string announcement = std::to_string(step) + " " + service;
+  step_socket_->send(announcement.data(), announcement.size());
+  notifyEvent(onLockstepStep, step, service);
+
+  std::unique_lock lock(ack_lock_);
+  ack_cv_.wait(lock, [&]() {
+    return interrupt_requested_ || std::all_of(lockstep_consumers_.begin(), lockstep_consumers_.end(), [&](const auto &c) {
+      return !subscribed(c) || c.second.acked_step == step;
+    });
+  });
+  // An interrupted step is over too, its late acks are stale
+  waiting_step_ = 0;
 }
 
 void Replay::streamThread() {
@@ -259,21 +416,25 @@ void Replay::streamThread() {
 
     event_data_ = seg_mgr_->getEventData();
     const auto &events = event_data_->events;
-    auto first = std::upper_bound(events.cbegin(), events.cend(), Event(cur_which_, cur_mono_time_, {}));
-    if (first == events.cend()) {
+    auto first = events.upper_bound(Event(cur_which_, cur_mono_time_, {}));
+    if (first == events.end()) {
       rInfo("waiting for events...");
       events_ready_ = false;
       continue;
     }
 
-    auto it = publishEvents(first, events.cend());
+    auto it = publishEvents(first, events.end());
 
     // Ensure frames are sent before unlocking to prevent race conditions
     if (camera_server_) {
       camera_server_->waitForSent();
     }
 
-    if (it == events.cend() && !hasFlag(REPLAY_FLAG_NO_LOOP)) {
+    if (it == events.end() && hasFlag(REPLAY_FLAG_FULL_SPEED)) {
+      logThroughput(true);
+    }
+
+    if (it == events.end() && !hasFlag(REPLAY_FLAG_NO_LOOP)) {
       int last_segment = seg_mgr_->route_.segments().rbegin()->first;
       if (event_data_->isSegmentLoaded(last_segment)) {
         rInfo("reaches the end of route, restart from beginning");
@@ -285,11 +446,13 @@ void Replay::streamThread() {
   }
 }
 
-std::vector<Event>::const_iterator Replay::publishEvents(std::vector<Event>::const_iterator first,
-                                                         std::vector<Event>::const_iterator last) {
+SegmentedEvents::const_iterator Replay::publishEvents(SegmentedEvents::const_iterator first,
+                                                      SegmentedEvents::const_iterator last) {
   uint64_t evt_start_ts = cur_mono_time_;
   uint64_t loop_start_ts = nanos_since_boot();
   double prev_replay_speed = speed_;
+  const bool full_speed = hasFlag(REPLAY_FLAG_FULL_SPEED);
+  const bool lockstep = !lockstep_consumers_.empty();
 
   for (; !interrupt_requested_ && first != last; ++first) {
     const Event &evt = *first;
@@ -306,29 +469,40 @@ std::vector<Event>::const_iterator Replay::publishEvents(std::vector<Event>::con
     // Skip events if socket is not present
     if (!sockets_[evt.which]) continue;
 
-    const uint64_t current_nanos = nanos_since_boot();
-    const int64_t time_diff = (evt.mono_time - evt_start_ts) / speed_ - (current_nanos - loop_start_ts);
-
-    // Reset timestamps for potential synchronization issues:
-    // - A negative time_diff may indicate slow execution or system wake-up,
-    // - A time_diff exceeding 1 second suggests a skipped segment.
-    if ((time_diff < -1e9 || time_diff >= 1e9) || speed_ != prev_replay_speed) {
-      evt_start_ts = evt.mono_time;
-      loop_start_ts = current_nanos;
-      prev_replay_speed = speed_;
-    } else if (time_diff > 0) {
-      precise_nano_sleep(time_diff, interrupt_requested_);
+    if (full_speed || lockstep) {
+      logThroughput(false);
+    } else {
+      const uint64_t current_nanos = nanos_since_boot();
+      const int64_t time_diff = (evt.mono_time - evt_start_ts) / speed_ - (current_nanos - loop_start_ts);
+
+      // Reset timestamps for potential synchronization issues:
+      // - A negative time_diff may indicate slow execution or system wake-up,
+      // - A time_diff exceeding 1 second suggests a skipped segment.
+      if ((time_diff < -1e9 || time_diff >= 1e9) || speed_ != prev_replay_speed) {
+        evt_start_ts = evt.mono_time;
+        loop_start_ts = current_nanos;
+        prev_replay_speed = speed_;
+      } else if (time_diff > 0) {
+        precise_nano_sleep(time_diff, interrupt_requested_);
+      }
     }
 
     if (interrupt_requested_) break;
 
+    bool published = false;
     if (evt.eidx_segnum == -1) {
-      publishMessage(&evt);
+      published = publishMessage(&evt);
+      ++published_events_;
+      published_bytes_ += evt.data.size() * sizeof(capnp::word);
     } else if (camera_server_) {
-      if (speed_ > 1.0) {
+      if (speed_ > 1.0 || full_speed) {
         camera_server_->waitForSent();
       }
-      publishFrame(&evt);
+      published = publishFrame(&evt);
+    }
+
+    if (lockstep && published) {
+      waitForAcks(sockets_[evt.which]);
     }
   }
 
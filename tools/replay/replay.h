@@ -5,7 +5,10 @@
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <set>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "tools/replay/camera.h"
@@ -13,6 +16,10 @@
 #include "tools/replay/timeline.h"
 
 #define DEMO_ROUTE "a2a0ccea32023010|2023-07-27--13-01-19"
+// Raw msgq sockets of the lockstep protocol. Each published step is announced on LOCKSTEP_STEP_ENDPOINT
+// as "<step> <service>", and consumers acknowledge it on LOCKSTEP_ACK_ENDPOINT as "<consumer> <step>".
+#define LOCKSTEP_STEP_ENDPOINT "replayStep"
+#define LOCKSTEP_ACK_ENDPOINT "replayAck"
 
 enum REPLAY_FLAGS {
   REPLAY_FLAG_NONE = 0x0000,
@@ -24,6 +31,8 @@ enum REPLAY_FLAGS {
   REPLAY_FLAG_NO_HW_DECODER = 0x0100,
   REPLAY_FLAG_NO_VIPC = 0x0400,
   REPLAY_FLAG_ALL_SERVICES = 0x0800,
+  REPLAY_FLAG_DECOMPRESSED_CACHE = 0x1000,
+  REPLAY_FLAG_FULL_SPEED = 0x2000,
 };
 
 class Replay {
@@ -40,6 +49,7 @@ public:
   inline bool isPaused() const { return user_paused_; }
   inline int segmentCacheLimit() const { return seg_mgr_->segment_cache_limit_; }
   inline void setSegmentCacheLimit(int n) { seg_mgr_->segment_cache_limit_ = std::max(MIN_SEGMENTS_CACHE, n); }
+  inline void setLoaderThreads(int n) { seg_mgr_->loader_threads_ = std::max(1, n); }
   inline bool hasFlag(REPLAY_FLAGS flag) const { return flags_ & flag; }
   void setLoop(bool loop) { loop ? flags_ &= ~REPLAY_FLAG_NO_LOOP : flags_ |= REPLAY_FLAG_NO_LOOP; }
   bool loop() const { return !(flags_ & REPLAY_FLAG_NO_LOOP); }
@@ -57,12 +67,19 @@ public:
   inline const std::optional<Timeline::Entry> findAlertAtTime(double sec) const { return timeline_.findAlertAtTime(sec); }
   const std::shared_ptr<SegmentManager::EventData> getEventData() const { return seg_mgr_->getEventData(); }
   void installEventFilter(std::function<bool(const Event *)> filter) { event_filter_ = filter; }
+  // Lockstep mode: each published message or frame is a step, numbered from 1. The stream announces the step
+  // and waits until every consumer subscribed to its service acknowledges that step number, with no wall-clock
+  // pacing. `consumers` maps each consumer to its services, an empty list subscribes it to all of them.
+  // Frames are steps of their encodeIdx service. Acks of other steps are ignored. An empty map disables it.
+  void setLockstep(const std::unordered_map<std::string, std::vector<std::string>> &consumers);
+  void ack(const std::string &consumer, uint64_t step);
 
   // Event callback functions
   std::function<void()> onSegmentsMerged = nullptr;
   std::function<void(double)> onSeeking = nullptr;
   std::function<void(double)> onSeekedTo = nullptr;
   std::function<void(std::shared_ptr<LogReader>)> onQLogLoaded = nullptr;
+  std::function<void(uint64_t step, const std::string &service)> onLockstepStep = nullptr;
 
 private:
   void setupServices(const std::vector<std::string> &allow, const std::vector<std::string> &block);
@@ -71,10 +88,14 @@ private:
   void streamThread();
   void handleSegmentMerge();
   void interruptStream(const std::function<bool()>& update_fn);
-  std::vector<Event>::const_iterator publishEvents(std::vector<Event>::const_iterator first,
-                                                   std::vector<Event>::const_iterator last);
-  void publishMessage(const Event *e);
-  void publishFrame(const Event *e);
+  SegmentedEvents::const_iterator publishEvents(SegmentedEvents::const_iterator first,
+                                                SegmentedEvents::const_iterator last);
+  bool publishMessage(const Event *e);
+  bool publishFrame(const Event *e);
+  void waitForAcks(const std::string &service);
+  void ackThread();
+  void waitForSubscribers(int which, size_t bytes);
+  void logThroughput(bool force);
   void checkSeekProgress();
 
   std::unique_ptr<SegmentManager> seg_mgr_;
@@ -99,6 +120,7 @@ private:
   SubMaster *sm_ = nullptr;
   std::unique_ptr<PubMaster> pm_;
   std::vector<const char*> sockets_;
+  std::vector<size_t> pending_bytes_;
   std::unique_ptr<CameraServer> camera_server_;
   std::atomic<uint32_t> flags_ = REPLAY_FLAG_NONE;
 
@@ -106,5 +128,24 @@ private:
   std::atomic<float> speed_ = 1.0;
   std::function<bool(const Event *)> event_filter_ = nullptr;
 
+  struct LockstepConsumer {
+    std::set<std::string> services;  // Empty for all services
+    uint64_t acked_step = 0;
+  };
+  std::mutex ack_lock_;
+  std::condition_variable ack_cv_;
+  std::unordered_map<std::string, LockstepConsumer> lockstep_consumers_;
+  uint64_t last_step_ = 0;
+  uint64_t waiting_step_ = 0;  // The step being acknowledged, 0 if none
+  std::string waiting_service_;
+  std::unique_ptr<Context> step_context_;
+  std::unique_ptr<PubSocket> step_socket_;
+  std::thread ack_thread_;
+
+  // Throughput of full speed replay
+  uint64_t published_events_ = 0;
+  uint64_t published_bytes_ = 0;
+  uint64_t throughput_start_ts_ = 0;
+
   std::shared_ptr<SegmentManager::EventData> event_data_ = std::make_shared<SegmentManager::EventData>();
 };
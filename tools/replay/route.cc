@@ -192,8 +192,8 @@ void Route::addFileToSegment(int n, const std::string &file) {
 // class Segment
 
 Segment::Segment(int n, const SegmentFile &files, uint32_t flags, const std::vector<bool> &filters,
-                 std::function<void(int, bool)> callback)
-    : seg_num(n), flags(flags), filters_(filters), on_load_finished_(callback) {
+                 std::function<void(int, bool)> callback, std::shared_ptr<WorkerPool> pool, int priority)
+    : seg_num(n), flags(flags), filters_(filters), on_load_finished_(callback), pool_(pool) {
   // [RoadCam, DriverCam, WideRoadCam, log]. fallback to qcamera/qlog
   const std::array file_list = {
       (flags & REPLAY_FLAG_QCAMERA) || files.road_cam.empty() ? files.qcamera : files.road_cam,
@@ -201,10 +201,11 @@ Segment::Segment(int n, const SegmentFile &files, uint32_t flags, const std::vec
       flags & REPLAY_FLAG_ECAM ? files.wide_road_cam : "",
       files.rlog.empty() ? files.qlog : files.rlog,
   };
+  std::lock_guard lock(mutex_);
   for (int i = 0; i < file_list.size(); ++i) {
     if (!file_list[i].empty() && (!(flags & REPLAY_FLAG_NO_VIPC) || i >= MAX_CAMERAS)) {
       ++loading_;
-      threads_.emplace_back(&Segment::loadFile, this, i, file_list[i]);
+      pool_->submit(this, priority, [this, i, file = file_list[i]]() { loadFile(i, file); });
     }
   }
 }
@@ -215,9 +216,12 @@ Segment::~Segment() {
     on_load_finished_ = nullptr;  // Prevent callback after destruction
   }
   abort_ = true;
-  for (auto &thread : threads_) {
-    if (thread.joinable()) thread.join();
-  }
+
+  // Drop the jobs that haven't started yet and wait for the running ones
+  size_t cancelled = pool_->cancel(this);
+  std::unique_lock lock(mutex_);
+  loading_ -= cancelled;
+  cv_.wait(lock, [this]() { return loading_ == 0; });
 }
 
 void Segment::loadFile(int id, const std::string file) {
@@ -227,7 +231,7 @@ void Segment::loadFile(int id, const std::string file) {
     frames[id] = std::make_unique<FrameReader>();
     success = frames[id]->load((CameraType)id, file, flags & REPLAY_FLAG_NO_HW_DECODER, &abort_, local_cache, 20 * 1024 * 1024, 3);
   } else {
-    log = std::make_unique<LogReader>(filters_);
+    log = std::make_unique<LogReader>(filters_, flags & REPLAY_FLAG_DECOMPRESSED_CACHE);
     success = log->load(file, &abort_, local_cache, 0, 3);
   }
 
@@ -236,13 +240,14 @@ void Segment::loadFile(int id, const std::string file) {
     abort_ = true;
   }
 
+  std::lock_guard lock(mutex_);
   if (--loading_ == 0) {
-    std::lock_guard lock(mutex_);
     load_state_ = !abort_ ? LoadState::Loaded : LoadState::Failed;
     if (on_load_finished_) {
       on_load_finished_(seg_num, !abort_);
     }
   }
+  cv_.notify_all();
 }
 
 Segment::LoadState Segment::getState() {
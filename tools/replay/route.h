@@ -1,11 +1,11 @@
 #pragma once
 
+#include <condition_variable>
 #include <ctime>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <string>
-#include <thread>
 #include <vector>
 
 #include "tools/replay/framereader.h"
@@ -72,7 +72,7 @@ public:
   enum class LoadState {Loading, Loaded, Failed};
 
   Segment(int n, const SegmentFile &files, uint32_t flags, const std::vector<bool> &filters,
-          std::function<void(int, bool)> callback);
+          std::function<void(int, bool)> callback, std::shared_ptr<WorkerPool> pool, int priority = 0);
   ~Segment();
   LoadState getState();
 
@@ -84,9 +84,10 @@ protected:
   void loadFile(int id, const std::string file);
 
   std::atomic<bool> abort_ = false;
-  std::atomic<int> loading_ = 0;
+  int loading_ = 0;
   std::mutex mutex_;
-  std::vector<std::thread> threads_;
+  std::condition_variable cv_;
+  std::shared_ptr<WorkerPool> pool_;
   std::function<void(int, bool)> on_load_finished_ = nullptr;
   uint32_t flags;
   std::vector<bool> filters_;
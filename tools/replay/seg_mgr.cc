@@ -29,6 +29,7 @@ bool SegmentManager::load() {
   }
 
   rInfo("loaded route %s with %zu valid segments", route_.name().c_str(), segments_.size());
+  pool_ = std::make_shared<WorkerPool>(loader_threads_);
   thread_ = std::thread(&SegmentManager::manageSegmentCache, this);
   return true;
 }
@@ -76,33 +77,24 @@ void SegmentManager::manageSegmentCache() {
 
 bool SegmentManager::mergeSegments(const SegmentMap::iterator &begin, const SegmentMap::iterator &end) {
   std::set<int> segments_to_merge;
-  size_t total_event_count = 0;
   for (auto it = begin; it != end; ++it) {
     const auto &segment = it->second;
     if (segment && segment->getState() == Segment::LoadState::Loaded) {
       segments_to_merge.insert(segment->seg_num);
-      total_event_count += segment->log->events.size();
     }
   }
 
   if (segments_to_merge == merged_segments_) return false;
 
-  auto merged_event_data = std::make_shared<EventData>();
-  auto &merged_events = merged_event_data->events;
-  merged_events.reserve(total_event_count);
-
   rDebug("merging segments: %s", join(segments_to_merge, ", ").c_str());
+  auto merged_event_data = std::make_shared<EventData>();
   for (int n : segments_to_merge) {
     const auto &events = segments_.at(n)->log->events;
     if (events.empty()) continue;
 
     // Skip INIT_DATA if present
     auto events_begin = (events.front().which == cereal::Event::Which::INIT_DATA) ? std::next(events.begin()) : events.begin();
-
-    size_t previous_size = merged_events.size();
-    merged_events.insert(merged_events.end(), events_begin, events.end());
-    std::inplace_merge(merged_events.begin(), merged_events.begin() + previous_size, merged_events.end());
-
+    merged_event_data->events.addRun(&*events_begin, events.data() + events.size());
     merged_event_data->segments[n] = segments_.at(n);
   }
 
@@ -113,28 +105,65 @@ bool SegmentManager::mergeSegments(const SegmentMap::iterator &begin, const Segm
 }
 
 void SegmentManager::loadSegmentsInRange(SegmentMap::iterator begin, SegmentMap::iterator cur, SegmentMap::iterator end) {
-  auto tryLoadSegment = [this](auto first, auto last) {
-    for (auto it = first; it != last; ++it) {
-      auto &segment_ptr = it->second;
-      if (!segment_ptr) {
-        segment_ptr = std::make_shared<Segment>(
-            it->first, route_.at(it->first), flags_, filters_,
-            [this](int seg_num, bool success) {
-              std::unique_lock lock(mutex_);
-              needs_update_ = true;
-              cv_.notify_one();
-            });
-      }
-
-      if (segment_ptr->getState() == Segment::LoadState::Loading) {
-        return true;  // Segment is still loading
-      }
+  // Queue every segment in range at once. The pool runs them by distance from the current segment,
+  // preferring forward on ties, so the segment being played always wins and the rest prefetch on idle workers.
+  for (auto it = begin; it != end; ++it) {
+    int distance = it->first - cur->first;
+    int priority = distance >= 0 ? distance * 2 : -distance * 2 + 1;
+
+    auto &segment_ptr = it->second;
+    if (!segment_ptr) {
+      segment_ptr = std::make_shared<Segment>(
+          it->first, route_.at(it->first), flags_, filters_,
+          [this](int seg_num, bool success) {
+            std::unique_lock lock(mutex_);
+            needs_update_ = true;
+            cv_.notify_one();
+          },
+          pool_, priority);
+    } else if (segment_ptr->getState() == Segment::LoadState::Loading) {
+      pool_->setPriority(segment_ptr.get(), priority);
     }
-    return false;  // No segments need loading
-  };
+  }
+}
+
+// class SegmentedEvents
+
+void SegmentedEvents::addRun(const Event *begin, const Event *end) {
+  if (begin != end) {
+    runs_.emplace_back(begin, end);
+    size_ += end - begin;
+  }
+}
+
+SegmentedEvents::const_iterator SegmentedEvents::upper_bound(const Event &e) const {
+  std::vector<Run> cursors;
+  cursors.reserve(runs_.size());
+  for (const auto &[first, last] : runs_) {
+    cursors.emplace_back(std::upper_bound(first, last, e), last);
+  }
+  return const_iterator(cursors);
+}
+
+SegmentedEvents::const_iterator::const_iterator(const std::vector<Run> &runs) {
+  cursors_.reserve(runs.size());
+  std::copy_if(runs.begin(), runs.end(), std::back_inserter(cursors_), [](auto &r) { return r.first != r.second; });
+  findMin();
+}
+
+SegmentedEvents::const_iterator &SegmentedEvents::const_iterator::operator++() {
+  if (++cursors_[min_].first == cursors_[min_].second) {
+    cursors_.erase(cursors_.begin() + min_);
+  }
+  findMin();
+  return *this;
+}
 
-  // Try forward loading, then reverse if necessary
-  if (!tryLoadSegment(cur, end)) {
-    tryLoadSegment(std::make_reverse_iterator(cur), std::make_reverse_iterator(begin));
+void SegmentedEvents::const_iterator::findMin() {
+  // Only a handful of runs are cached, and they rarely overlap, so a linear scan beats a heap.
+  // Strict comparison keeps the earlier segment first on ties, like a stable merge.
+  min_ = 0;
+  for (size_t i = 1; i < cursors_.size(); ++i) {
+    if (*cursors_[i].first < *cursors_[min_].first) min_ = i;
   }
 }
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <algorithm>
 #include <condition_variable>
+#include <iterator>
 #include <map>
 #include <mutex>
 #include <set>
+#include <utility>
+#include <thread>
 #include <vector>
 
 #include "tools/replay/route.h"
@@ -12,10 +16,57 @@ constexpr int MIN_SEGMENTS_CACHE = 5;
 
 using SegmentMap = std::map<int, std::shared_ptr<Segment>>;
 
+// Events of several segments kept as one sorted run per segment and merged lazily while iterating,
+// so adding or dropping a segment never copies its events.
+class SegmentedEvents {
+public:
+  using Run = std::pair<const Event *, const Event *>;
+
+  class const_iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Event;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Event *;
+    using reference = const Event &;
+
+    const_iterator() = default;
+    inline reference operator*() const { return *cursors_[min_].first; }
+    inline pointer operator->() const { return cursors_[min_].first; }
+    const_iterator &operator++();
+    const_iterator operator++(int) {
+      const_iterator tmp = *this;
+      ++*this;
+      return tmp;
+    }
+    inline bool operator==(const const_iterator &other) const { return cursors_ == other.cursors_; }
+    inline bool operator!=(const const_iterator &other) const { return !(*this == other); }
+
+  private:
+    friend class SegmentedEvents;
+    explicit const_iterator(const std::vector<Run> &runs);
+    void findMin();
+
+    std::vector<Run> cursors_;  // Remaining range of each non-exhausted run, in segment order
+    size_t min_ = 0;
+  };
+
+  void addRun(const Event *begin, const Event *end);
+  const_iterator begin() const { return const_iterator(runs_); }
+  const_iterator end() const { return const_iterator(); }
+  const_iterator upper_bound(const Event &e) const;
+  inline size_t size() const { return size_; }
+  inline bool empty() const { return size_ == 0; }
+
+private:
+  std::vector<Run> runs_;
+  size_t size_ = 0;
+};
+
 class SegmentManager {
 public:
   struct EventData {
-    std::vector<Event> events;  //  Events extracted from the segments
+    SegmentedEvents events;     //  Events extracted from the segments
     SegmentMap segments;        // Associated segments that contributed to these events
     bool isSegmentLoaded(int n) const { return segments.find(n) != segments.end(); }
   };
@@ -33,6 +84,7 @@ public:
 
   Route route_;
   int segment_cache_limit_ = MIN_SEGMENTS_CACHE;
+  int loader_threads_ = std::max(4, (int)std::thread::hardware_concurrency());
 
 private:
   void manageSegmentCache();
@@ -49,6 +101,7 @@ private:
   bool needs_update_ = false;
   bool exit_ = false;
 
+  std::shared_ptr<WorkerPool> pool_;
   SegmentMap segments_;
   std::shared_ptr<EventData> event_data_;
   std::function<void()> onSegmentMergedCallback_ = nullptr;
@@ -0,0 +1,462 @@
+// Replay benchmark on synthetic routes. Generates segments locally (no network) and measures
+// log parsing, segment merging, video seek/decode and publish timing. Results are printed as JSON.
+#include <getopt.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <capnp/dynamic.h>
+#include <capnp/schema.h>
+#include <zstd.h>
+
+extern "C" {
+#include <libavutil/opt.h>
+}
+
+#include "cereal/messaging/messaging.h"
+#include "common/timing.h"
+#include "common/util.h"
+#include "tools/replay/replay.h"
+
+namespace {
+
+const std::string BENCH_TIMESTAMP = "2000-01-01--00-00-00";
+const std::string BENCH_ROUTE = "0000000000000000|" + BENCH_TIMESTAMP;
+const std::string DEFAULT_SERVICES = "can:100,carState:100,carControl:100,selfdriveState:100,controlsState:100,"
+                                     "modelV2:20,liveCalibration:4,deviceState:2";
+const int VIDEO_FPS = 20;
+
+struct BenchConfig {
+  std::string dir;
+  std::string output;
+  int segments = 3;
+  int segment_seconds = 60;
+  int can_messages = 40;  // CAN frames per can event
+  std::vector<std::pair<std::string, int>> services;  // name, hz
+  bool compress = true;
+  int video_frames = 100;
+  int video_width = 1928;
+  int video_height = 1208;
+  double publish_seconds = 5;
+  uint32_t seed = 0;
+  bool keep = false;
+};
+
+struct Stats {
+  double p50 = 0, p99 = 0, max = 0;
+};
+
+Stats percentiles(std::vector<double> values) {
+  Stats stats;
+  if (values.empty()) return stats;
+  std::sort(values.begin(), values.end());
+  stats.p50 = values[values.size() / 2];
+  stats.p99 = values[std::min(values.size() - 1, values.size() * 99 / 100)];
+  stats.max = values.back();
+  return stats;
+}
+
+std::string segmentDir(const BenchConfig &config, int n) {
+  return config.dir + "/" + BENCH_TIMESTAMP + "--" + std::to_string(n);
+}
+
+// Builds one segment's log. Every service is sent at its own rate, with random CAN payloads.
+std::string generateLog(const BenchConfig &config, int seg_num, std::mt19937 &rng) {
+  auto event_schema = capnp::Schema::from<cereal::Event>().asStruct();
+  const uint64_t start_ns = 1e9 + seg_num * config.segment_seconds * 1e9;
+  std::uniform_int_distribution<int> byte_dist(0, 255);
+
+  std::vector<std::pair<uint64_t, std::string>> messages;
+  auto add_message = [&](MessageBuilder &msg, uint64_t mono_time) {
+    auto bytes = msg.toBytes();
+    messages.emplace_back(mono_time, std::string((const char *)bytes.begin(), bytes.size()));
+  };
+
+  for (auto name : {"initData", "carParams"}) {
+    MessageBuilder msg;
+    auto event = msg.initEvent();
+    event.setLogMonoTime(start_ns);
+    capnp::DynamicStruct::Builder(event).init(event_schema.getFieldByName(name));
+    add_message(msg, start_ns);
+  }
+
+  for (const auto &[name, hz] : config.services) {
+    auto field = event_schema.getFieldByName(name);
+    const uint64_t interval = 1e9 / hz;
+    for (uint64_t t = start_ns; t < start_ns + config.segment_seconds * 1e9; t += interval) {
+      MessageBuilder msg;
+      auto event = msg.initEvent();
+      event.setLogMonoTime(t);
+      if (name == "can" || name == "sendcan") {
+        auto can = name == "can" ? event.initCan(config.can_messages) : event.initSendcan(config.can_messages);
+        for (int i = 0; i < config.can_messages; ++i) {
+          uint8_t dat[8];
+          for (auto &b : dat) b = byte_dist(rng);
+          can[i].setAddress(0x100 + i);
+          can[i].setSrc(i % 3);
+          can[i].setDat(kj::arrayPtr(dat, sizeof(dat)));
+        }
+      } else if (field.getType().isList()) {
+        capnp::DynamicStruct::Builder(event).init(field, 1);
+      } else {
+        capnp::DynamicStruct::Builder(event).init(field);
+      }
+      add_message(msg, t);
+    }
+  }
+
+  std::stable_sort(messages.begin(), messages.end(), [](auto &a, auto &b) { return a.first < b.first; });
+  std::string log;
+  for (const auto &[_, data] : messages) log += data;
+  return log;
+}
+
+// Encodes a moving gradient with the HEVC encoder, if ffmpeg has one
+bool generateVideo(const BenchConfig &config, const std::string &file) {
+  const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_HEVC);
+  if (!codec) return false;
+
+  AVCodecContext *ctx = avcodec_alloc_context3(codec);
+  ctx->width = config.video_width;
+  ctx->height = config.video_height;
+  ctx->time_base = {1, VIDEO_FPS};
+  ctx->framerate = {VIDEO_FPS, 1};
+  ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+  ctx->gop_size = VIDEO_FPS;
+  ctx->max_b_frames = 0;
+  av_opt_set(ctx->priv_data, "preset", "ultrafast", 0);
+  if (avcodec_open2(ctx, codec, nullptr) < 0) {
+    avcodec_free_context(&ctx);
+    return false;
+  }
+
+  std::ofstream out(file, std::ios::binary);
+  AVFrame *frame = av_frame_alloc();
+  frame->format = ctx->pix_fmt;
+  frame->width = ctx->width;
+  frame->height = ctx->height;
+  av_frame_get_buffer(frame, 0);
+  AVPacket *pkt = av_packet_alloc();
+
+  auto write_packets = [&]() {
+    while (avcodec_receive_packet(ctx, pkt) == 0) {
+      out.write((const char *)pkt->data, pkt->size);
+      av_packet_unref(pkt);
+    }
+  };
+  for (int i = 0; i < config.video_frames; ++i) {
+    av_frame_make_writable(frame);
+    for (int y = 0; y < ctx->height; ++y) {
+      for (int x = 0; x < ctx->width; ++x) {
+        frame->data[0][y * frame->linesize[0] + x] = (x + y + i * 4) & 0xff;
+      }
+    }
+    for (int p = 1; p < 3; ++p) {
+      for (int y = 0; y < ctx->height / 2; ++y) {
+        memset(frame->data[p] + y * frame->linesize[p], 128 + p * (i % 16), ctx->width / 2);
+      }
+    }
+    frame->pts = i;
+    avcodec_send_frame(ctx, frame);
+    write_packets();
+  }
+  avcodec_send_frame(ctx, nullptr);
+  write_packets();
+
+  av_packet_free(&pkt);
+  av_frame_free(&frame);
+  avcodec_free_context(&ctx);
+  return out.good();
+}
+
+void generateRoute(const BenchConfig &config, bool *has_video) {
+  std::mt19937 rng(config.seed);
+  for (int n = 0; n < config.segments; ++n) {
+    const std::string dir = segmentDir(config, n);
+    util::create_directories(dir, 0755);
+    std::string log = generateLog(config, n, rng);
+    if (config.compress) {
+      std::string compressed(ZSTD_compressBound(log.size()), '\0');
+      compressed.resize(ZSTD_compress(compressed.data(), compressed.size(), log.data(), log.size(), 3));
+      writeFileAtomic(dir + "/rlog.zst", compressed.data(), compressed.size());
+    } else {
+      writeFileAtomic(dir + "/rlog", log.data(), log.size());
+    }
+  }
+  *has_video = config.video_frames > 0 && generateVideo(config, segmentDir(config, 0) + "/fcamera.hevc");
+}
+
+std::string logFile(const BenchConfig &config, int n) {
+  return segmentDir(config, n) + (config.compress ? "/rlog.zst" : "/rlog");
+}
+
+// Parsing throughput of the decompressed log, and of the log file as stored (including decompression)
+void benchParse(const BenchConfig &config, std::map<std::string, std::string> &results) {
+  std::string data = util::read_file(logFile(config, 0));
+  if (config.compress) data = decompressZST(data);
+
+  double t0 = millis_since_boot();
+  LogReader log;
+  log.load(data.data(), data.size());
+  double parse_ms = millis_since_boot() - t0;
+
+  t0 = millis_since_boot();
+  LogReader file_log;
+  file_log.load(logFile(config, 0));
+  double load_ms = millis_since_boot() - t0;
+
+  results["log_mb"] = util::string_format("%.2f", data.size() / 1e6);
+  results["events_per_segment"] = std::to_string(log.events.size());
+  results["parse_mb_per_s"] = util::string_format("%.1f", data.size() / 1e3 / parse_ms);
+  results["load_file_mb_per_s"] = util::string_format("%.1f", data.size() / 1e3 / load_ms);
+}
+
+// Time to merge all segments and walk the merged events in order
+void benchMerge(const BenchConfig &config, std::map<std::string, std::string> &results) {
+  std::vector<std::unique_ptr<LogReader>> logs;
+  for (int n = 0; n < config.segments; ++n) {
+    logs.push_back(std::make_unique<LogReader>());
+    logs.back()->load(logFile(config, n));
+  }
+
+  double t0 = millis_since_boot();
+  SegmentedEvents events;
+  for (const auto &log : logs) {
+    events.addRun(log->events.data(), log->events.data() + log->events.size());
+  }
+  size_t count = 0;
+  uint64_t prev_mono_time = 0;
+  bool sorted = true;
+  for (const Event &e : events) {
+    sorted &= e.mono_time >= prev_mono_time;
+    prev_mono_time = e.mono_time;
+    ++count;
+  }
+  double merge_ms = millis_since_boot() - t0;
+
+  results["merged_events"] = std::to_string(count);
+  results["merge_ms"] = util::string_format("%.2f", merge_ms);
+  results["merge_sorted"] = sorted ? "true" : "false";
+}
+
+// Latency from opening the video to the first frame at a random position, and sequential decode rate
+void benchVideo(const BenchConfig &config, std::map<std::string, std::string> &results) {
+  const std::string file = segmentDir(config, 0) + "/fcamera.hevc";
+  // Measure the decoder, not the frame cache. Without a cache budget prefetching is off too,
+  // so every frame is decoded on this thread and the prefetched frames can't be evicted before use.
+  FrameReader::setCacheBudget(0);
+
+  double t0 = millis_since_boot();
+  FrameReader fr;
+  if (!fr.loadFromFile(RoadCam, file, true) || fr.getFrameCount() == 0) return;
+  double open_ms = millis_since_boot() - t0;
+
+  const int stride = (fr.width + 63) & ~63;
+  VisionBuf buf;
+  buf.allocate(stride * fr.height * 3 / 2);
+  buf.init_yuv(fr.width, fr.height, stride, stride * fr.height);
+
+  std::mt19937 rng(config.seed);
+  const int seek_idx = std::uniform_int_distribution<int>(0, (int)fr.getFrameCount() - 1)(rng);
+  t0 = millis_since_boot();
+  bool ok = fr.get(seek_idx, &buf);
+  double seek_ms = millis_since_boot() - t0;
+
+  FrameReader sequential;
+  sequential.loadFromFile(RoadCam, file, true);
+  t0 = millis_since_boot();
+  int decoded = 0;
+  for (int i = 0; i < (int)sequential.getFrameCount() && sequential.get(i, &buf); ++i) ++decoded;
+  double decode_ms = millis_since_boot() - t0;
+  buf.free();
+
+  // Two readers of the same camera, as when two segments are decoded at once. Each gets its own decoder
+  // from the pool, so together they should decode faster than one reader alone.
+  FrameReader readers[2];
+  std::atomic<int> parallel_decoded = 0;
+  for (auto &r : readers) r.loadFromFile(RoadCam, file, true);
+  t0 = millis_since_boot();
+  std::vector<std::thread> threads;
+  for (auto &r : readers) {
+    threads.emplace_back([&]() {
+      VisionBuf b;
+      b.allocate(stride * r.height * 3 / 2);
+      b.init_yuv(r.width, r.height, stride, stride * r.height);
+      for (int i = 0; i < (int)r.getFrameCount() && r.get(i, &b); ++i) ++parallel_decoded;
+      b.free();
+    });
+  }
+  for (auto &t : threads) t.join();
+  double parallel_decode_ms = millis_since_boot() - t0;
+
+  results["video_frames"] = std::to_string(fr.getFrameCount());
+  results["video_open_ms"] = util::string_format("%.2f", open_ms);
+  results["seek_to_first_frame_ms"] = ok ? util::string_format("%.2f", open_ms + seek_ms) : "null";
+  results["decode_fps"] = util::string_format("%.1f", decoded * 1000.0 / decode_ms);
+  results["two_reader_decode_fps"] = util::string_format("%.1f", parallel_decoded * 1000.0 / parallel_decode_ms);
+}
+
+// Deviation of the publish time of each message from its scheduled time, with real-time pacing.
+// Messages are timed in the event filter and dropped there, so no subscribers are needed.
+void benchPublish(const BenchConfig &config, std::map<std::string, std::string> &results) {
+  Replay replay(BENCH_ROUTE, {}, {}, nullptr, REPLAY_FLAG_NO_VIPC | REPLAY_FLAG_NO_LOOP, config.dir);
+  std::mutex lock;
+  std::vector<double> jitter_us;
+  uint64_t first_mono_time = 0, first_wall_time = 0;
+  replay.installEventFilter([&](const Event *e) {
+    uint64_t now = nanos_since_boot();
+    std::lock_guard lk(lock);
+    if (first_mono_time == 0 || e->mono_time < first_mono_time) {
+      first_mono_time = e->mono_time;
+      first_wall_time = now;
+      jitter_us.clear();
+    }
+    double scheduled = first_wall_time + (e->mono_time - first_mono_time);
+    jitter_us.push_back(std::abs((double)now - scheduled) / 1e3);
+    return true;
+  });
+  if (!replay.load()) return;
+
+  replay.start();
+  util::sleep_for(config.publish_seconds * 1000);
+  replay.pause(true);
+
+  std::lock_guard lk(lock);
+  Stats stats = percentiles(jitter_us);
+  results["published_events"] = std::to_string(jitter_us.size());
+  results["publish_jitter_p50_us"] = util::string_format("%.1f", stats.p50);
+  results["publish_jitter_p99_us"] = util::string_format("%.1f", stats.p99);
+  results["publish_jitter_max_us"] = util::string_format("%.1f", stats.max);
+}
+
+bool parseArgs(int argc, char *argv[], BenchConfig &config) {
+  const struct option options[] = {
+      {"dir", required_argument, nullptr, 'd'},
+      {"segments", required_argument, nullptr, 'n'},
+      {"segment-seconds", required_argument, nullptr, 's'},
+      {"services", required_argument, nullptr, 'S'},
+      {"can-messages", required_argument, nullptr, 'c'},
+      {"no-compress", no_argument, nullptr, 'u'},
+      {"video-frames", required_argument, nullptr, 'v'},
+      {"video-size", required_argument, nullptr, 'V'},
+      {"publish-seconds", required_argument, nullptr, 'p'},
+      {"seed", required_argument, nullptr, 'r'},
+      {"keep", no_argument, nullptr, 'k'},
+      {"output", required_argument, nullptr, 'o'},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  std::string services = DEFAULT_SERVICES;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "d:n:s:S:c:uv:V:p:r:ko:h", options, nullptr)) != -1) {
+    switch (opt) {
+      case 'd': config.dir = optarg; break;
+      case 'n': config.segments = std::max(1, std::atoi(optarg)); break;
+      case 's': config.segment_seconds = std::max(1, std::atoi(optarg)); break;
+      case 'S': services = optarg; break;
+      case 'c': config.can_messages = std::max(1, std::atoi(optarg)); break;
+      case 'u': config.compress = false; break;
+      case 'v': config.video_frames = std::max(0, std::atoi(optarg)); break;
+      case 'V': sscanf(optarg, "%dx%d", &config.video_width, &config.video_height); break;
+      case 'p': config.publish_seconds = std::atof(optarg); break;
+      case 'r': config.seed = std::atoi(optarg); break;
+      case 'k': config.keep = true; break;
+      case 'o': config.output = optarg; break;
+      default:
+        std::cout << "Usage: bench_replay [--dir <dir>] [--segments <n>] [--segment-seconds <n>]\n"
+                     "                    [--services name:hz,...] [--can-messages <n>] [--no-compress]\n"
+                     "                    [--video-frames <n>] [--video-size WxH] [--publish-seconds <n>]\n"
+                     "                    [--seed <n>] [--keep] [--output <file>]\n";
+        return false;
+    }
+  }
+
+  auto event_schema = capnp::Schema::from<cereal::Event>().asStruct();
+  for (const auto &item : split(services, ',')) {
+    auto parts = split(item, ':');
+    if (parts.size() != 2 || !event_schema.findFieldByName(parts[0]) || std::atoi(parts[1].c_str()) <= 0) {
+      std::cerr << "invalid service " << item << "\n";
+      return false;
+    }
+    config.services.emplace_back(parts[0], std::atoi(parts[1].c_str()));
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  BenchConfig config;
+  if (!parseArgs(argc, argv, config)) {
+    return 1;
+  }
+
+  bool temp_dir = config.dir.empty();
+  if (temp_dir) {
+    char tmp_path[] = "/tmp/replay_bench_XXXXXX";
+    config.dir = mkdtemp(tmp_path);
+  }
+
+  bool has_video = false;
+  double t0 = millis_since_boot();
+  generateRoute(config, &has_video);
+  double generate_ms = millis_since_boot() - t0;
+
+  std::map<std::string, std::string> results;
+  benchParse(config, results);
+  benchMerge(config, results);
+  if (has_video) {
+    benchVideo(config, results);
+  }
+  if (config.publish_seconds > 0) {
+    benchPublish(config, results);
+  }
+
+  std::string services;
+  for (const auto &[name, hz] : config.services) {
+    services += (services.empty() ? "" : ",") + name + ":" + std::to_string(hz);
+  }
+  std::ostringstream json;
+  json << "{\n  \"benchmark\": \"replay\",\n  \"config\": {\n"
+            << "    \"segments\": " << config.segments << ",\n"
+            << "    \"segment_seconds\": " << config.segment_seconds << ",\n"
+            << "    \"services\": \"" << services << "\",\n"
+            << "    \"can_messages\": " << config.can_messages << ",\n"
+            << "    \"compress\": " << (config.compress ? "true" : "false") << ",\n"
+            << "    \"video\": " << (has_video ? "true" : "false") << ",\n"
+            << "    \"video_frames\": " << config.video_frames << ",\n"
+            << "    \"video_size\": \"" << config.video_width << "x" << config.video_height << "\",\n"
+            << "    \"seed\": " << config.seed << ",\n"
+            << "    \"generate_ms\": " << util::string_format("%.1f", generate_ms) << "\n"
+            << "  },\n  \"results\": {\n";
+  for (auto it = results.begin(); it != results.end(); ++it) {
+    json << "    \"" << it->first << "\": " << it->second << (std::next(it) != results.end() ? ",\n" : "\n");
+  }
+  json << "  }\n}\n";
+
+  // Replay logs to stdout, so results can go to a file to keep them parseable
+  if (config.output.empty()) {
+    std::cout << json.str();
+  } else if (!writeFileAtomic(config.output, json.str().data(), json.str().size())) {
+    std::cerr << "failed to write " << config.output << "\n";
+  }
+
+  if (temp_dir && !config.keep) {
+    std::filesystem::remove_all(config.dir);
+  }
+  return 0;
+}
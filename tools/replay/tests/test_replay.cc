@@ -1,5 +1,6 @@
 #define CATCH_CONFIG_MAIN
 #include "catch2/catch.hpp"
+#include "common/util.h"
 #include "tools/replay/replay.h"
 
 const std::string TEST_RLOG_URL = "https://commadataci.blob.core.windows.net/openpilotci/0c94aa1e1296d7c6/2021-05-05--19-48-37/0/rlog.bz2";
@@ -7,11 +8,68 @@ const std::string TEST_RLOG_URL = "https://commadataci.blob.core.windows.net/ope
 TEST_CASE("LogReader") {
   SECTION("corrupt log") {
     FileReader reader(true);
-    std::string corrupt_content = reader.read(TEST_RLOG_URL);
+    std::string corrupt_content = *reader.read(TEST_RLOG_URL);
     corrupt_content.resize(corrupt_content.length() / 2);
     corrupt_content = decompressBZ2(corrupt_content);
     LogReader log;
     REQUIRE(log.load(corrupt_content.data(), corrupt_content.size()));
     REQUIRE(log.events.size() > 0);
   }
+
+  SECTION("stream corrupt log") {
+    const std::string log_file = "/tmp/test_replay_corrupt_rlog";
+    std::string content = decompressBZ2(*FileReader(true).read(TEST_RLOG_URL));
+    content.resize(content.size() - 3);
+    REQUIRE(writeFileAtomic(log_file, content.data(), content.size()));
+
+    size_t streamed_events = 0;
+    REQUIRE_FALSE(LogReader().stream(log_file, [&](const Event &e) { ++streamed_events; }));
+    REQUIRE(streamed_events > 0);
+  }
+
+  SECTION("stream") {
+    LogReader log;
+    REQUIRE(log.load(TEST_RLOG_URL, nullptr, true));
+    size_t can_events = std::count_if(log.events.begin(), log.events.end(),
+                                      [](const Event &e) { return e.which == cereal::Event::Which::CAN; });
+
+    size_t streamed_can_events = 0;
+    REQUIRE(LogReader().stream(TEST_RLOG_URL, [&](const Event &e) {
+      if (e.which == cereal::Event::Which::CAN) ++streamed_can_events;
+    }, nullptr, true));
+    REQUIRE(streamed_can_events == can_events);
+  }
+
+  SECTION("event index") {
+    const std::string log_file = "/tmp/test_replay_rlog";
+    std::string content = decompressBZ2(*FileReader(true).read(TEST_RLOG_URL));
+    REQUIRE(writeFileAtomic(log_file, content.data(), content.size()));
+    std::remove((cacheFilePath(log_file) + ".idx").c_str());
+
+    LogReader log;
+    REQUIRE(log.load(log_file, nullptr, true));
+    REQUIRE(util::file_exists(cacheFilePath(log_file) + ".idx"));
+
+    LogReader indexed_log;
+    REQUIRE(indexed_log.load(log_file, nullptr, true));
+    REQUIRE(indexed_log.events.size() == log.events.size());
+    for (size_t i = 0; i < log.events.size(); ++i) {
+      REQUIRE(indexed_log.events[i].mono_time == log.events[i].mono_time);
+      REQUIRE(indexed_log.events[i].which == log.events[i].which);
+      REQUIRE(indexed_log.events[i].data.size() == log.events[i].data.size());
+    }
+
+    // An entry that doesn't frame a message falls back to parsing the log
+    const std::string index_file = cacheFilePath(log_file) + ".idx";
+    std::string index = util::read_file(index_file);
+    const size_t entry_length_offset = 88 + 16;  // first entry, after the header
+    REQUIRE(index.size() > entry_length_offset + sizeof(uint32_t));
+    index[entry_length_offset] ^= 1;
+    REQUIRE(writeFileAtomic(index_file, index.data(), index.size()));
+
+    LogReader reparsed_log;
+    REQUIRE(reparsed_log.load(log_file, nullptr, true));
+    REQUIRE(reparsed_log.events.size() == log.events.size());
+    REQUIRE(reparsed_log.events[0].data.size() == log.events[0].data.size());
+  }
 }
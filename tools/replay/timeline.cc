@@ -2,19 +2,66 @@
 
 #include <algorithm>
 #include <array>
+#include <cstring>
+#include <thread>
+
+#include <capnp/schema.h>
 
 #include "cereal/gen/cpp/log.capnp.h"
+#include "common/util.h"
+
+namespace {
+
+constexpr char CACHE_MAGIC[4] = {'R', 'T', 'L', 'N'};
+constexpr uint32_t CACHE_VERSION = 1;
+
+struct CacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t route_start_ts;
+  uint32_t segments;
+  uint32_t count;
+};
+
+// Keep only the events used by the timeline and the qlog consumers, so the qlogs are
+// parsed in a bounded window instead of holding the whole decompressed log.
+const std::vector<bool> &timelineFilters() {
+  static const std::vector<bool> filters = []() {
+    std::vector<bool> f(capnp::Schema::from<cereal::Event>().asStruct().getUnionFields().size(), false);
+    for (auto which : {cereal::Event::Which::SELFDRIVE_STATE, cereal::Event::Which::CONTROLS_STATE,
+                       cereal::Event::Which::USER_FLAG, cereal::Event::Which::THUMBNAIL}) {
+      f[which] = true;
+    }
+    return f;
+  }();
+  return filters;
+}
+
+}  // namespace
 
 Timeline::~Timeline() {
   should_exit_.store(true);
-  if (thread_.joinable()) {
-    thread_.join();
-  }
+  pool_.reset();  // Drops the pending qlogs and waits for the running ones
 }
 
 void Timeline::initialize(const Route &route, uint64_t route_start_ts, bool local_cache,
                           std::function<void(std::shared_ptr<LogReader>)> callback) {
-  thread_ = std::thread(&Timeline::buildTimeline, this, route, route_start_ts, local_cache, callback);
+  route_start_ts_ = route_start_ts;
+  for (const auto &[n, _] : route.segments()) {
+    segments_[n] = std::nullopt;
+  }
+  if (local_cache) {
+    cache_file_ = cacheFilePath(route.name()) + ".timeline";
+    from_cache_ = loadCache();
+  }
+
+  // One qlog per job. The qlogs are still loaded with a cached timeline for the callback.
+  pool_ = std::make_unique<WorkerPool>(std::clamp((int)std::thread::hardware_concurrency() / 2, 2, 8));
+  for (const auto &[n, segment] : route.segments()) {
+    pool_->submit(this, n, [this, seg_num = n, qlog = segment.qlog, local_cache, callback]() {
+      buildSegment(seg_num, qlog, local_cache, callback);
+    });
+  }
 }
 
 std::optional<uint64_t> Timeline::find(double cur_ts, FindFlag flag) const {
@@ -47,63 +94,190 @@ std::optional<Timeline::Entry> Timeline::findAlertAtTime(double target_time) con
   return std::nullopt;
 }
 
-void Timeline::buildTimeline(const Route &route, uint64_t route_start_ts, bool local_cache,
-                             std::function<void(std::shared_ptr<LogReader>)> callback) {
-  std::optional<size_t> current_engaged_idx, current_alert_idx;
-
-  for (const auto &segment : route.segments()) {
-    if (should_exit_) break;
-
-    auto log = std::make_shared<LogReader>();
-    if (!log->load(segment.second.qlog, &should_exit_, local_cache, 0, 3) || log->events.empty()) {
-      continue;  // Skip if log loading fails or no events
-    }
+void Timeline::buildSegment(int seg_num, const std::string &qlog, bool local_cache,
+                            std::function<void(std::shared_ptr<LogReader>)> callback) {
+  if (should_exit_) return;
 
+  SegmentEntries segment;
+  auto log = std::make_shared<LogReader>(timelineFilters());
+  if (log->load(qlog, &should_exit_, local_cache, 0, 3) && !log->events.empty()) {
+    segment.loaded = true;
+    std::optional<size_t> engaged_idx, alert_idx;
     for (const Event &e : log->events) {
-      double seconds = (e.mono_time - route_start_ts) / 1e9;
+      double seconds = (e.mono_time - route_start_ts_) / 1e9;
       if (e.which == cereal::Event::Which::SELFDRIVE_STATE) {
         capnp::FlatArrayMessageReader reader(e.data);
         auto cs = reader.getRoot<cereal::Event>().getSelfdriveState();
-        updateEngagementStatus(cs, current_engaged_idx, seconds);
-        updateAlertStatus(cs, current_alert_idx, seconds);
+        updateEngagementStatus(cs, segment.entries, engaged_idx, seconds);
+        updateAlertStatus(cs, segment.entries, alert_idx, seconds);
+        if (!segment.first_seconds) {
+          segment.first_seconds = seconds;
+          segment.leading_engaged = engaged_idx;
+          segment.leading_alert = alert_idx;
+        }
       } else if (e.which == cereal::Event::Which::USER_FLAG) {
-        staging_entries_.emplace_back(Entry{seconds, seconds, TimelineType::UserFlag});
+        segment.entries.emplace_back(Entry{seconds, seconds, TimelineType::UserFlag});
       }
     }
+    segment.open_engaged = engaged_idx;
+    segment.open_alert = alert_idx;
+  }
+  if (should_exit_) return;
 
-    // Sort and finalize the timeline entries
-    auto entries = std::make_shared<std::vector<Entry>>(staging_entries_);
-    std::sort(entries->begin(), entries->end(), [](auto &a, auto &b) { return a.start_time < b.start_time; });
-    std::atomic_store(&timeline_entries_, std::move(entries));
-
+  const bool loaded = segment.loaded;
+  {
+    std::lock_guard lock(segments_lock_);
+    segments_[seg_num] = std::move(segment);
+    if (!from_cache_) {
+      mergeTimeline();
+    }
+  }
+  if (loaded) {
     callback(log);  // Notify the callback once the log is processed
   }
 }
 
-void Timeline::updateEngagementStatus(const cereal::SelfdriveState::Reader &cs, std::optional<size_t> &idx, double seconds) {
-  if (idx) staging_entries_[*idx].end_time = seconds;
+void Timeline::mergeTimeline() {
+  // Rebuilt from all finished segments each time, the number of entries is small
+  std::vector<Entry> merged;
+  std::optional<size_t> engaged, alert;  // Entries still active at the end of the previous segment
+  bool complete = true;
+  for (const auto &[n, segment] : segments_) {
+    if (!segment || !segment->loaded) {
+      complete = false;
+      // Don't join entries across a segment that is still loading
+      if (!segment) engaged = alert = std::nullopt;
+      continue;
+    }
+
+    // Active entries last until the first state of the next segment, and continue into it if
+    // the state is unchanged there.
+    if (segment->first_seconds) {
+      if (engaged) merged[*engaged].end_time = *segment->first_seconds;
+      if (alert) merged[*alert].end_time = *segment->first_seconds;
+    }
+    std::vector<size_t> index(segment->entries.size());
+    for (size_t i = 0; i < segment->entries.size(); ++i) {
+      const Entry &entry = segment->entries[i];
+      if (engaged && i == segment->leading_engaged) {
+        merged[*engaged].end_time = entry.end_time;
+        index[i] = *engaged;
+      } else if (alert && i == segment->leading_alert && merged[*alert].type == entry.type &&
+                 merged[*alert].text1 == entry.text1 && merged[*alert].text2 == entry.text2) {
+        merged[*alert].end_time = entry.end_time;
+        index[i] = *alert;
+      } else {
+        index[i] = merged.size();
+        merged.push_back(entry);
+      }
+    }
+    if (segment->first_seconds) {
+      engaged = segment->open_engaged ? std::optional(index[*segment->open_engaged]) : std::nullopt;
+      alert = segment->open_alert ? std::optional(index[*segment->open_alert]) : std::nullopt;
+    }
+  }
+
+  // Sort and finalize the timeline entries
+  auto entries = std::make_shared<std::vector<Entry>>(std::move(merged));
+  std::sort(entries->begin(), entries->end(), [](auto &a, auto &b) { return a.start_time < b.start_time; });
+  std::atomic_store(&timeline_entries_, entries);
+
+  if (complete && !cache_file_.empty()) {
+    writeCache(*entries);
+  }
+}
+
+bool Timeline::loadCache() {
+  std::string content = util::read_file(cache_file_);
+  if (content.size() < sizeof(CacheHeader)) return false;
+
+  CacheHeader header;
+  memcpy(&header, content.data(), sizeof(header));
+  if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != CACHE_VERSION ||
+      header.route_start_ts != route_start_ts_ || header.segments != segments_.size()) {
+    return false;
+  }
+
+  auto entries = std::make_shared<std::vector<Entry>>();
+  entries->reserve(header.count);
+  size_t pos = sizeof(header);
+  auto read = [&](void *dst, size_t size) {
+    if (pos + size > content.size()) return false;
+    memcpy(dst, content.data() + pos, size);
+    pos += size;
+    return true;
+  };
+  auto read_string = [&](std::string &str) {
+    uint32_t size = 0;
+    if (!read(&size, sizeof(size)) || pos + size > content.size()) return false;
+    str.assign(content.data() + pos, size);
+    pos += size;
+    return true;
+  };
+  for (uint32_t i = 0; i < header.count; ++i) {
+    Entry entry = {};
+    int32_t type = 0;
+    if (!read(&entry.start_time, sizeof(entry.start_time)) || !read(&entry.end_time, sizeof(entry.end_time)) ||
+        !read(&type, sizeof(type)) || !read_string(entry.text1) || !read_string(entry.text2)) {
+      rWarning("ignoring corrupt timeline cache %s", cache_file_.c_str());
+      return false;
+    }
+    entry.type = (TimelineType)type;
+    entries->push_back(std::move(entry));
+  }
+  std::atomic_store(&timeline_entries_, entries);
+  DownloadCache::instance().touch(cache_file_);
+  return true;
+}
+
+void Timeline::writeCache(const std::vector<Entry> &entries) {
+  CacheHeader header = {.version = CACHE_VERSION, .route_start_ts = route_start_ts_,
+                        .segments = (uint32_t)segments_.size(), .count = (uint32_t)entries.size()};
+  memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+
+  std::string content((const char *)&header, sizeof(header));
+  auto write_string = [&](const std::string &str) {
+    uint32_t size = str.size();
+    content.append((const char *)&size, sizeof(size));
+    content.append(str);
+  };
+  for (const Entry &entry : entries) {
+    int32_t type = (int32_t)entry.type;
+    content.append((const char *)&entry.start_time, sizeof(entry.start_time));
+    content.append((const char *)&entry.end_time, sizeof(entry.end_time));
+    content.append((const char *)&type, sizeof(type));
+    write_string(entry.text1);
+    write_string(entry.text2);
+  }
+  DownloadCache::instance().write(cache_file_, content.data(), content.size());
+}
+
+void Timeline::updateEngagementStatus(const cereal::SelfdriveState::Reader &cs, std::vector<Entry> &entries,
+                                      std::optional<size_t> &idx, double seconds) {
+  if (idx) entries[*idx].end_time = seconds;
   if (cs.getEnabled()) {
     if (!idx) {
-      idx = staging_entries_.size();
-      staging_entries_.emplace_back(Entry{seconds, seconds, TimelineType::Engaged});
+      idx = entries.size();
+      entries.emplace_back(Entry{seconds, seconds, TimelineType::Engaged});
     }
   } else {
     idx.reset();
   }
 }
 
-void Timeline::updateAlertStatus(const cereal::SelfdriveState::Reader &cs, std::optional<size_t> &idx, double seconds) {
+void Timeline::updateAlertStatus(const cereal::SelfdriveState::Reader &cs, std::vector<Entry> &entries,
+                                 std::optional<size_t> &idx, double seconds) {
   static auto alert_types = std::array{TimelineType::AlertInfo, TimelineType::AlertWarning, TimelineType::AlertCritical};
 
-  Entry *entry = idx ? &staging_entries_[*idx] : nullptr;
+  Entry *entry = idx ? &entries[*idx] : nullptr;
   if (entry) entry->end_time = seconds;
   if (cs.getAlertSize() != cereal::SelfdriveState::AlertSize::NONE) {
     auto type = alert_types[(int)cs.getAlertStatus()];
     std::string text1 = cs.getAlertText1().cStr();
     std::string text2 = cs.getAlertText2().cStr();
     if (!entry || entry->type != type || entry->text1 != text1 || entry->text2 != text2) {
-      idx = staging_entries_.size();
-      staging_entries_.emplace_back(Entry{seconds, seconds, type, text1, text2});  // Start a new entry
+      idx = entries.size();
+      entries.emplace_back(Entry{seconds, seconds, type, text1, text2});  // Start a new entry
     }
   } else {
     idx.reset();
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
-#include <thread>
+#include <string>
 #include <vector>
 
 #include "tools/replay/route.h"
@@ -30,16 +33,35 @@ public:
   const std::shared_ptr<std::vector<Entry>> getEntries() const { return std::atomic_load(&timeline_entries_); }
 
 private:
-  void buildTimeline(const Route &route, uint64_t route_start_ts, bool local_cache,
-                     std::function<void(std::shared_ptr<LogReader>)> callback);
-  void updateEngagementStatus(const cereal::SelfdriveState::Reader &cs, std::optional<size_t> &idx, double seconds);
-  void updateAlertStatus(const cereal::SelfdriveState::Reader &cs, std::optional<size_t> &idx, double seconds);
+  // Entries of one qlog. Engagements and alerts that are still active at the start or the end
+  // of the segment are joined with the neighbouring segments when the timeline is merged.
+  struct SegmentEntries {
+    bool loaded = false;
+    std::optional<double> first_seconds;  // Time of the first selfdriveState
+    std::vector<Entry> entries;
+    std::optional<size_t> leading_engaged, leading_alert;
+    std::optional<size_t> open_engaged, open_alert;
+  };
+
+  void buildSegment(int seg_num, const std::string &qlog, bool local_cache,
+                    std::function<void(std::shared_ptr<LogReader>)> callback);
+  void mergeTimeline();
+  bool loadCache();
+  void writeCache(const std::vector<Entry> &entries);
+  static void updateEngagementStatus(const cereal::SelfdriveState::Reader &cs, std::vector<Entry> &entries,
+                                     std::optional<size_t> &idx, double seconds);
+  static void updateAlertStatus(const cereal::SelfdriveState::Reader &cs, std::vector<Entry> &entries,
+                                std::optional<size_t> &idx, double seconds);
 
-  std::thread thread_;
+  std::unique_ptr<WorkerPool> pool_;
   std::atomic<bool> should_exit_ = false;
+  uint64_t route_start_ts_ = 0;
+  std::string cache_file_;
+  bool from_cache_ = false;
 
-  // Temporarily holds entries before they are sorted and finalized
-  std::vector<Entry> staging_entries_;
+  // Per-segment results, merged into timeline_entries_ as each qlog finishes
+  std::mutex segments_lock_;
+  std::map<int, std::optional<SegmentEntries>> segments_;
 
   // Final sorted timeline entries
   std::shared_ptr<std::vector<Entry>> timeline_entries_;
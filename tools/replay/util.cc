@@ -2,7 +2,11 @@
 
 #include <bzlib.h>
 #include <curl/curl.h>
+#include <fcntl.h>
 #include <openssl/sha.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <cassert>
 #include <algorithm>
@@ -14,6 +18,7 @@
 #include <map>
 #include <mutex>
 #include <numeric>
+#include <tuple>
 #include <utility>
 #include <zstd.h>
 
@@ -90,6 +95,27 @@ size_t write_cb(char *data, size_t size, size_t count, void *userp) {
   return w->write(data, size, count);
 }
 
+struct StreamWriter {
+  CURL *curl;
+  const DownloadDataHandler *on_data;
+  size_t file_size;
+  size_t written = 0;
+};
+
+size_t stream_write_cb(char *data, size_t size, size_t count, void *userp) {
+  auto w = (StreamWriter *)userp;
+  // The status is known before the body arrives. Only the body of a full response is the file,
+  // an error page must not reach the handler.
+  long res_status = 0;
+  curl_easy_getinfo(w->curl, CURLINFO_RESPONSE_CODE, &res_status);
+  size_t bytes = size * count;
+  if (res_status != 200 || w->written + bytes > w->file_size) return 0;
+
+  (*w->on_data)(data, bytes, w->file_size);
+  w->written += bytes;
+  return bytes;
+}
+
 size_t dumy_write_cb(char *data, size_t size, size_t count, void *userp) { return size * count; }
 
 struct DownloadStats {
@@ -269,6 +295,62 @@ std::string httpGet(const std::string &url, size_t chunk_size, std::atomic<bool>
   return httpDownload(url, result, chunk_size, size, abort) ? result : "";
 }
 
+bool httpStream(const std::string &url, const DownloadDataHandler &on_data, std::atomic<bool> *abort) {
+  size_t size = getRemoteFileSize(url, abort);
+  if (size == 0) return false;
+
+  download_stats.add(url, size);
+  CURL *curl = curl_easy_init();
+  StreamWriter writer = {.curl = curl, .on_data = &on_data, .file_size = size};
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, stream_write_cb);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&writer);
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl, CURLOPT_HTTPGET, 1);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
+
+  CURLM *cm = curl_multi_init();
+  curl_multi_add_handle(cm, curl);
+  int still_running = 1;
+  size_t prev_written = 0;
+  while (still_running > 0 && !(abort && *abort)) {
+    CURLMcode mc = curl_multi_perform(cm, &still_running);
+    if (mc != CURLM_OK) {
+      break;
+    }
+    if (still_running > 0) {
+      curl_multi_wait(cm, nullptr, 0, 1000, nullptr);
+    }
+
+    if (((writer.written - prev_written) / (double)size) >= 0.01) {
+      download_stats.update(url, writer.written);
+      prev_written = writer.written;
+    }
+  }
+
+  bool success = false;
+  int msgs_left = -1;
+  CURLMsg *msg = curl_multi_info_read(cm, &msgs_left);
+  if (msg && msg->msg == CURLMSG_DONE && !(abort && *abort)) {
+    long res_status = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &res_status);
+    if (res_status != 200) {
+      rWarning("Download failed: http error code: %d", res_status);
+    } else if (msg->data.result != CURLE_OK) {
+      rWarning("Download failed: connection failure: %d", msg->data.result);
+    } else {
+      success = writer.written == size;
+    }
+  }
+  download_stats.update(url, writer.written, success);
+  download_stats.remove(url);
+
+  curl_multi_remove_handle(cm, curl);
+  curl_easy_cleanup(curl);
+  curl_multi_cleanup(cm);
+  return success;
+}
+
 bool httpDownload(const std::string &url, const std::string &file, size_t chunk_size, std::atomic<bool> *abort) {
   size_t size = getRemoteFileSize(url, abort);
   if (size == 0) return false;
@@ -362,6 +444,133 @@ std::string decompressZST(const std::byte *in, size_t in_size, std::atomic<bool>
   return {};
 }
 
+// StreamDecompressor
+
+StreamDecompressor::StreamDecompressor(Format format, const OutputCallback &callback)
+    : format_(format), callback_(callback), window_(ZSTD_DStreamOutSize(), '\0') {
+  if (format_ == Format::BZ2) {
+    auto strm = new bz_stream{};
+    int bzerror = BZ2_bzDecompressInit(strm, 0, 0);
+    assert(bzerror == BZ_OK);
+    bz_stream_ = strm;
+  } else if (format_ == Format::ZST) {
+    zstd_ctx_ = ZSTD_createDCtx();
+    assert(zstd_ctx_ != nullptr);
+  }
+}
+
+StreamDecompressor::~StreamDecompressor() {
+  if (bz_stream_) {
+    BZ2_bzDecompressEnd((bz_stream *)bz_stream_);
+    delete (bz_stream *)bz_stream_;
+  }
+  if (zstd_ctx_) ZSTD_freeDCtx((ZSTD_DCtx *)zstd_ctx_);
+}
+
+bool StreamDecompressor::decompress(const char *data, size_t size, std::atomic<bool> *abort) {
+  if (format_ == Format::None) {
+    for (size_t pos = 0; pos < size && !(abort && *abort); pos += window_.size()) {
+      callback_(data + pos, std::min(window_.size(), size - pos));
+    }
+  } else if (format_ == Format::BZ2) {
+    auto strm = (bz_stream *)bz_stream_;
+    strm->next_in = (char *)data;
+    strm->avail_in = size;
+    while (!finished_ && !(abort && *abort)) {
+      strm->next_out = window_.data();
+      strm->avail_out = window_.size();
+      unsigned int prev_avail_in = strm->avail_in;
+      int bzerror = BZ2_bzDecompress(strm);
+      size_t produced = window_.size() - strm->avail_out;
+      if ((bzerror != BZ_OK && bzerror != BZ_STREAM_END) || (produced == 0 && prev_avail_in > 0 && prev_avail_in == strm->avail_in)) {
+        rWarning("StreamDecompressor error: content is corrupt");
+        return false;
+      }
+      if (produced > 0) callback_(window_.data(), produced);
+      finished_ = bzerror == BZ_STREAM_END;
+      // Stop once the input is consumed and the decoder has no more output buffered
+      if (strm->avail_in == 0 && strm->avail_out > 0) break;
+    }
+  } else {
+    ZSTD_inBuffer input = {data, size, 0};
+    while (input.pos < input.size && !(abort && *abort)) {
+      ZSTD_outBuffer output = {window_.data(), window_.size(), 0};
+      size_t result = ZSTD_decompressStream((ZSTD_DCtx *)zstd_ctx_, &output, &input);
+      if (ZSTD_isError(result)) {
+        rWarning("StreamDecompressor error: content is corrupt");
+        return false;
+      }
+      if (output.pos > 0) callback_(window_.data(), output.pos);
+    }
+    // Flush data still buffered in the decoder
+    while (!(abort && *abort)) {
+      ZSTD_outBuffer output = {window_.data(), window_.size(), 0};
+      size_t result = ZSTD_decompressStream((ZSTD_DCtx *)zstd_ctx_, &output, &input);
+      if (ZSTD_isError(result) || output.pos == 0) break;
+      callback_(window_.data(), output.pos);
+    }
+  }
+  return !(abort && *abort);
+}
+
+// WorkerPool
+
+WorkerPool::WorkerPool(int num_threads) {
+  for (int i = 0; i < std::max(1, num_threads); ++i) {
+    threads_.emplace_back(&WorkerPool::workerThread, this);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard lock(mutex_);
+    exit_ = true;
+    jobs_.clear();
+  }
+  cv_.notify_all();
+  for (auto &t : threads_) t.join();
+}
+
+void WorkerPool::submit(const void *owner, int priority, std::function<void()> job) {
+  {
+    std::lock_guard lock(mutex_);
+    jobs_.push_back({owner, priority, next_seq_++, std::move(job)});
+  }
+  cv_.notify_one();
+}
+
+void WorkerPool::setPriority(const void *owner, int priority) {
+  std::lock_guard lock(mutex_);
+  for (auto &job : jobs_) {
+    if (job.owner == owner) job.priority = priority;
+  }
+}
+
+size_t WorkerPool::cancel(const void *owner) {
+  std::lock_guard lock(mutex_);
+  size_t size = jobs_.size();
+  jobs_.erase(std::remove_if(jobs_.begin(), jobs_.end(), [owner](auto &job) { return job.owner == owner; }), jobs_.end());
+  return size - jobs_.size();
+}
+
+void WorkerPool::workerThread() {
+  while (true) {
+    std::unique_lock lock(mutex_);
+    cv_.wait(lock, [this]() { return exit_ || !jobs_.empty(); });
+    if (exit_) break;
+
+    // The queue only holds a few jobs per cached segment, so a linear scan is cheap
+    auto it = std::min_element(jobs_.begin(), jobs_.end(), [](auto &a, auto &b) {
+      return std::tie(a.priority, a.seq) < std::tie(b.priority, b.seq);
+    });
+    auto fn = std::move(it->fn);
+    jobs_.erase(it);
+    lock.unlock();
+
+    fn();
+  }
+}
+
 void precise_nano_sleep(int64_t nanoseconds, std::atomic<bool> &interrupt_requested) {
   struct timespec req, rem;
   req.tv_sec = nanoseconds / 1000000000;
@@ -403,6 +612,28 @@ std::vector<std::string> split(std::string_view source, char delimiter) {
   return fields;
 }
 
+std::string dataFingerprint(const char *data, size_t size) {
+  // Hashing the whole data would cost as much as parsing it
+  const size_t sample_size = std::min<size_t>(size, 64 * 1024);
+  std::string sample = std::to_string(size);
+  sample.append(data, sample_size);
+  sample.append(data + size - sample_size, sample_size);
+  return sha256(sample);
+}
+
+bool writeFileAtomic(const std::string &file, const void *data, size_t size) {
+  // Write to a temporary file first so a partially written file is never seen under the final name
+  const std::string tmp_file = file + "." + util::random_string(8) + ".tmp";
+  std::ofstream fs(tmp_file, std::ios::binary | std::ios::out);
+  fs.write((const char *)data, size);
+  fs.close();
+  if (!fs || std::rename(tmp_file.c_str(), file.c_str()) != 0) {
+    std::remove(tmp_file.c_str());
+    return false;
+  }
+  return true;
+}
+
 std::string extractFileName(const std::string &file) {
   size_t queryPos = file.find_first_of("?");
   std::string path = (queryPos != std::string::npos) ? file.substr(0, queryPos) : file;
@@ -432,3 +663,30 @@ MonotonicBuffer::~MonotonicBuffer() {
     free(buf);
   }
 }
+
+// MappedFile
+
+bool MappedFile::open(const std::string &file) {
+  close();
+  int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+
+  struct stat st = {};
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED) {
+      addr_ = addr;
+      size_ = st.st_size;
+    }
+  }
+  ::close(fd);
+  return addr_ != nullptr;
+}
+
+void MappedFile::close() {
+  if (addr_) {
+    munmap(addr_, size_);
+    addr_ = nullptr;
+    size_ = 0;
+  }
+}
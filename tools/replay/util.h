@@ -1,11 +1,14 @@
 #pragma once
 
 #include <atomic>
+#include <condition_variable>
 #include <deque>
 #include <functional>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <vector>
 #include "cereal/messaging/messaging.h"
 
@@ -46,7 +49,78 @@ private:
   static constexpr float growth_factor = 1.5;
 };
 
+// Read-only mmap of a whole file. The data is served from the page cache instead of the heap.
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile() { close(); }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  bool open(const std::string &file);
+  void close();
+  inline bool isOpen() const { return addr_ != nullptr; }
+  inline const char *data() const { return (const char *)addr_; }
+  inline size_t size() const { return size_; }
+
+private:
+  void *addr_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Decompresses BZ2/ZST input pushed in arbitrary chunks. The output is handed to the
+// callback through a fixed-size window, so the full decompressed data is never held in memory.
+class StreamDecompressor {
+public:
+  enum class Format { None, BZ2, ZST };
+  using OutputCallback = std::function<void(const char *data, size_t size)>;
+
+  StreamDecompressor(Format format, const OutputCallback &callback);
+  ~StreamDecompressor();
+  StreamDecompressor(const StreamDecompressor &) = delete;
+  StreamDecompressor &operator=(const StreamDecompressor &) = delete;
+  bool decompress(const char *data, size_t size, std::atomic<bool> *abort = nullptr);
+
+private:
+  Format format_;
+  OutputCallback callback_;
+  std::string window_;
+  void *bz_stream_ = nullptr;
+  void *zstd_ctx_ = nullptr;
+  bool finished_ = false;
+};
+
+// Fixed-size pool of worker threads shared by all loading jobs. Pending jobs run in priority
+// order (lower value first, FIFO on ties). Jobs are tagged with an owner so they can be
+// reprioritized or cancelled together.
+class WorkerPool {
+public:
+  WorkerPool(int num_threads);
+  ~WorkerPool();
+  void submit(const void *owner, int priority, std::function<void()> job);
+  void setPriority(const void *owner, int priority);
+  size_t cancel(const void *owner);  // Returns the number of pending jobs removed
+  inline int size() const { return threads_.size(); }
+
+private:
+  struct Job {
+    const void *owner;
+    int priority;
+    uint64_t seq;
+    std::function<void()> fn;
+  };
+  void workerThread();
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<Job> jobs_;
+  std::vector<std::thread> threads_;
+  uint64_t next_seq_ = 0;
+  bool exit_ = false;
+};
+
 std::string sha256(const std::string &str);
+// Cheap identity of a large buffer for validating sidecar indexes: sha256 of the size and the first and last 64KB
+std::string dataFingerprint(const char *data, size_t size);
 void precise_nano_sleep(int64_t nanoseconds, std::atomic<bool> &interrupt_requested);
 std::string decompressBZ2(const std::string &in, std::atomic<bool> *abort = nullptr);
 std::string decompressBZ2(const std::byte *in, size_t in_size, std::atomic<bool> *abort = nullptr);
@@ -55,11 +129,17 @@ std::string decompressZST(const std::byte *in, size_t in_size, std::atomic<bool>
 std::string getUrlWithoutQuery(const std::string &url);
 size_t getRemoteFileSize(const std::string &url, std::atomic<bool> *abort = nullptr);
 std::string httpGet(const std::string &url, size_t chunk_size = 0, std::atomic<bool> *abort = nullptr);
+// Called with each piece of the file as it arrives. `file_size` is the size of the whole file.
+using DownloadDataHandler = std::function<void(const char *data, size_t size, size_t file_size)>;
+// Downloads over a single connection and passes the file to `on_data` without keeping it in memory.
+// Only the body of a successful response is passed on.
+bool httpStream(const std::string &url, const DownloadDataHandler &on_data, std::atomic<bool> *abort = nullptr);
 
 typedef std::function<void(uint64_t cur, uint64_t total, bool success)> DownloadProgressHandler;
 void installDownloadProgressHandler(DownloadProgressHandler);
 bool httpDownload(const std::string &url, const std::string &file, size_t chunk_size = 0, std::atomic<bool> *abort = nullptr);
 std::string formattedDataSize(size_t size);
+bool writeFileAtomic(const std::string &file, const void *data, size_t size);
 std::string extractFileName(const std::string& file);
 std::vector<std::string> split(std::string_view source, char delimiter);
 